@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//counts heap allocations of every thread, to check which parts of the mapping allocate memory (e.g., barcode alignments).
+//Only active if compiled with -DCOUNT_ALLOCATIONS (e.g., make demultiplex CXXFLAGS="-O3 -DCOUNT_ALLOCATIONS"),
+//otherwise all counters stay zero and no operator new is replaced.
+//The replaced operator new must be defined in exactly one translation unit: define DEFINE_ALLOCATION_COUNTER before including this header.
+
+inline thread_local unsigned long long threadAllocations = 0;
+//allocations during all barcode alignments (summed over threads)
+inline std::atomic<unsigned long long> alignmentAllocations(0);
+
+inline unsigned long long thread_allocation_count()
+{
+    return threadAllocations;
+}
+
+#if defined(COUNT_ALLOCATIONS) && defined(DEFINE_ALLOCATION_COUNTER)
+void* operator new(std::size_t size)
+{
+    ++threadAllocations;
+    if(void* ptr = std::malloc(size == 0 ? 1 : size)){return ptr;}
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
@@ -7,8 +7,16 @@
 #include <thread>
 #include <unordered_set>
 #include <unordered_map>
+#include <string_view>
+#include <functional>
 
 #include "helper.hpp"
+#include "AllocationCounter.hpp"
+#include "MyersAlignment.hpp"
+#include "PackedBarcodes.hpp"
+#include "BarcodeNeighborhoodIndex.hpp"
+#include "BarcodeSegmentIndex.hpp"
+#include "ReverseComplement.hpp"
 
 class Barcode;
 typedef std::shared_ptr<Barcode> BarcodePtr;
@@ -29,6 +37,17 @@ struct mappingSolution{
     int differenceInBarcodeLength;
 }; 
 
+//result of aligning a barcode to a read: the found barcode is a view of the barcode stored in the Barcode object
+//(or of the read for wildcards), it stays valid as long as the Barcode (and the read) exists
+struct BarcodeAlignment
+{
+    std::string_view barcode;
+    int targetEnd = 0; //number of read bases (starting at targetOffset) that belong to the barcode
+    int delNum = 0;
+    int insNum = 0;
+    int substNum = 0;
+};
+
 //new datatypes
 class Barcode
 {
@@ -46,32 +65,31 @@ class Barcode
     //reverse complement is a Barcode function that should be available globally
     static std::string generate_reverse_complement(std::string seq)
     {
-        auto lambda = [](const char c) 
+        std::string newSeq(seq.size(), 'N');
+        if(!reverse_complement(seq, &newSeq[0]))
         {
-            switch (c) 
-            {
-                case 'A':
-                    return 'T';
-                case 'G':
-                    return 'C';
-                case 'C':
-                    return 'G';
-                case 'T':
-                    return 'A';
-                case 'N':
-                    return 'N';
-                default:
-                    throw std::domain_error("Invalid nucleotide.");
-            }
-        };
-        std::string newSeq = seq;
-        std::transform(seq.crbegin(), seq.crend(), newSeq.begin(), lambda);
+            throw std::domain_error("Invalid nucleotide.");
+        }
         return newSeq;
     }
-    //overwritten function to match sequence pattern(s)
-    virtual bool align(std::string& matchedBarcode, const std::string& fastqLine, const unsigned int targetOffset,
-                       int& targetEnd, int& delNum, int& insNum, int& substNum,
-                       bool reverse = false) = 0;
+    //aligns the barcode to the read starting at targetOffset, the result is written into alignment
+    //(counts the allocations of the alignment when compiled with COUNT_ALLOCATIONS).
+    //For reverse mapping revCompLine can be the reverse complement of the whole read (empty if not available),
+    //barcodes then look up the read in their forward indexes.
+    //maxMismatches is the error budget left for the pattern: barcodes with more edits can not be part of the best pattern anymore
+    //(constant barcodes then align with fewer mismatches in a shorter window, other barcodes use their own mismatches)
+    bool align(BarcodeAlignment& alignment, std::string_view fastqLine, const unsigned int targetOffset, bool reverse = false,
+               std::string_view revCompLine = std::string_view(), const int maxMismatches = INT_MAX)
+    {
+        #ifdef COUNT_ALLOCATIONS
+            const unsigned long long allocations = thread_allocation_count();
+            const bool found = align_sequence(alignment, fastqLine, targetOffset, reverse, revCompLine, maxMismatches);
+            alignmentAllocations += thread_allocation_count() - allocations;
+            return found;
+        #else
+            return align_sequence(alignment, fastqLine, targetOffset, reverse, revCompLine, maxMismatches);
+        #endif
+    }
     virtual std::vector<std::string> get_patterns() = 0;
     virtual bool is_wildcard() = 0;
     virtual bool is_constant() = 0;
@@ -79,15 +97,20 @@ class Barcode
     virtual bool is_dna() = 0;
     virtual bool is_read_end() = 0;
 
+    protected:
+    //overwritten function to match sequence pattern(s)
+    virtual bool align_sequence(BarcodeAlignment& alignment, std::string_view fastqLine, const unsigned int targetOffset,
+                                bool reverse, std::string_view revCompLine, const int maxMismatches) = 0;
+
 };
 
 class ConstantBarcode : public Barcode
 {
 
     public:
-    ConstantBarcode(std::string inPattern, int inMismatches) : Barcode(inPattern, inMismatches), pattern(inPattern)
+    ConstantBarcode(std::string inPattern, int inMismatches) : Barcode(inPattern, inMismatches), pattern(inPattern),
+    revCompPattern(generate_reverse_complement(inPattern)), profile(pattern), revCompProfile(revCompPattern)
     {
-        revCompPattern = generate_reverse_complement(pattern);
         // Configure Edlib
         config = edlibNewAlignConfig(
             inMismatches,        // Maximum allowed edit distance
@@ -101,64 +124,165 @@ class ConstantBarcode : public Barcode
         return std::make_shared<ConstantBarcode>(*this);
     }
 
-    bool align(std::string& matchedBarcode, const std::string& fastqLine,const unsigned int targetOffset,
-               int& targetEnd, int& delNum, int& insNum, int& substNum,
-               bool reverse = false)
+    std::vector<std::string> get_patterns()
     {
+        std::vector<std::string> patterns = {pattern};
+        return patterns;
+    }
+    bool is_wildcard(){return false;}
+    bool is_constant(){return true;}
+    bool is_stop(){return false;}
+    bool is_dna(){return false;}
+    bool is_read_end(){return false;}
+
+    //aligns the barcode to a batch of reads (read i starting at targetOffsets[i]), with the same result as align for every read.
+    //Reads that do not map exactly are collected and aligned MyersPattern::batchLanes reads at once (one read per SIMD lane).
+    //maxMismatches (if set) is the error budget of every read, like in align
+    void align_batch(BarcodeAlignment* alignments, bool* found, const std::string_view* fastqLines,
+                     const unsigned int* targetOffsets, const size_t readNum, bool reverse = false,
+                     const int* maxMismatches = nullptr)
+    {
+        #ifdef COUNT_ALLOCATIONS
+            const unsigned long long allocations = thread_allocation_count();
+        #endif
+
+        const std::string& usedPattern = reverse ? revCompPattern : pattern;
+        const MyersPattern& usedProfile = reverse ? revCompProfile : profile;
+
+        //reads of the next batch alignment
+        std::string_view laneTargets[MyersPattern::batchLanes];
+        size_t laneReads[MyersPattern::batchLanes];
+        MyersAlignmentResult laneResults[MyersPattern::batchLanes];
+        int laneNum = 0;
+        auto align_lanes = [&]()
+        {
+            usedProfile.align_batch(laneTargets, laneNum, mismatches, laneResults);
+            for(int lane = 0; lane < laneNum; ++lane)
+            {
+                BarcodeAlignment& alignment = alignments[laneReads[lane]];
+                //all lanes align with the mismatches of the linker, reads with a smaller budget are checked afterwards
+                const int edits = laneResults[lane].delNum + laneResults[lane].insNum + laneResults[lane].substNum;
+                found[laneReads[lane]] = laneResults[lane].found && edits <= allowed_mismatches(maxMismatches, laneReads[lane]);
+                alignment.targetEnd += laneResults[lane].targetEnd;
+                alignment.delNum += laneResults[lane].delNum;
+                alignment.insNum += laneResults[lane].insNum;
+                alignment.substNum += laneResults[lane].substNum;
+            }
+            laneNum = 0;
+        };
+
+        for(size_t read = 0; read < readNum; ++read)
+        {
+            BarcodeAlignment& alignment = alignments[read];
+            alignment.barcode = pattern;
+            found[read] = false;
+
+            if(fastqLines[read].substr(targetOffsets[read], usedPattern.length()) == usedPattern)
+            {
+                alignment.targetEnd = usedPattern.length();
+                found[read] = true;
+                continue;
+            }
+            const int allowedMismatches = allowed_mismatches(maxMismatches, read);
+            if(allowedMismatches <= 0)
+            {
+                continue;
+            }
+
+            std::string_view target = alignment_target(fastqLines[read], targetOffsets[read], allowedMismatches);
+            if(!usedProfile.is_usable() || target.size() > static_cast<size_t>(MyersPattern::maxBatchTargetLength))
+            {
+                EdlibAlignConfig usedConfig = config;
+                usedConfig.k = allowedMismatches;
+                found[read] = run_alignment(usedProfile, usedPattern, target, alignment.targetEnd, usedConfig,
+                                            alignment.delNum, alignment.insNum, alignment.substNum);
+                continue;
+            }
+            laneTargets[laneNum] = target;
+            laneReads[laneNum] = read;
+            if(++laneNum == MyersPattern::batchLanes){align_lanes();}
+        }
+        if(laneNum > 0){align_lanes();}
+
+        #ifdef COUNT_ALLOCATIONS
+            alignmentAllocations += thread_allocation_count() - allocations;
+        #endif
+    }
+
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view fastqLine, const unsigned int targetOffset,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
+    {
+        (void)revCompLine; //the linker is aligned to the read itself
         bool foundAlignment = false;
 
         //set the pattern to use for reverse or forward mapping
-        std::string usedPattern = pattern;
-        if(reverse){usedPattern = revCompPattern;}
+        const std::string& usedPattern = reverse ? revCompPattern : pattern;
 
         //if we allow for zero mismathces check if we can map it immediately
-        std::string exactTarget = fastqLine.substr(targetOffset, usedPattern.length());
+        std::string_view exactTarget = fastqLine.substr(targetOffset, usedPattern.length());
         if(exactTarget == usedPattern)
         {
-            targetEnd = usedPattern.length();
-            matchedBarcode = pattern;
+            alignment.targetEnd = usedPattern.length();
+            alignment.barcode = pattern;
             return true;
         }
-        else if(mismatches == 0) //return false if we do not allowe for any mismatches
+        //return false if we do not allowe for any mismatches (or the pattern has no error budget left)
+        const int allowedMismatches = std::min(mismatches, maxMismatches);
+        if(allowedMismatches <= 0)
         {
             return false;
         }
 
-        //get length of substring, length does not depend on reverse/ forward pattern
-        std::string target;
-        int substringLength = pattern.length()+mismatches;
-        if(targetOffset + substringLength > fastqLine.size()){substringLength = fastqLine.size()-targetOffset;};
-        //std::cout << "\t LENGTH: " <<substringLength << " seq: " << fastqLine.size()<< "\n";
-        target = fastqLine.substr(targetOffset, substringLength);
+        //an alignment with at most allowedMismatches edits ends within the pattern length plus allowedMismatches,
+        //the smaller window and limit give the same alignment if it is within the budget
+        std::string_view target = alignment_target(fastqLine, targetOffset, allowedMismatches);
+        EdlibAlignConfig usedConfig = config;
+        usedConfig.k = allowedMismatches;
 
         //map the pattern to the target sequence
-        foundAlignment = run_alignment(usedPattern, target, targetEnd, config, delNum,  insNum, substNum);
-        matchedBarcode = pattern;
+        foundAlignment = run_alignment(reverse ? revCompProfile : profile, usedPattern, target, alignment.targetEnd, usedConfig,
+                                       alignment.delNum, alignment.insNum, alignment.substNum);
+        alignment.barcode = pattern;
 
         return foundAlignment;
     }
 
-    std::vector<std::string> get_patterns()
-    {
-        std::vector<std::string> patterns = {pattern};
-        return patterns;
-    }
-    bool is_wildcard(){return false;}
-    bool is_constant(){return true;}
-    bool is_stop(){return false;}
-    bool is_dna(){return false;}
-    bool is_read_end(){return false;}
-
     private: 
+        //mismatches of a read of align_batch
+        int allowed_mismatches(const int* maxMismatches, const size_t read) const
+        {
+            return (maxMismatches == nullptr) ? mismatches : std::min(mismatches, maxMismatches[read]);
+        }
+
+        //part of the read the pattern is aligned to (pattern length plus the allowed mismatches)
+        std::string_view alignment_target(std::string_view fastqLine, const unsigned int targetOffset, const int allowedMismatches) const
+        {
+            //get length of substring, length does not depend on reverse/ forward pattern
+            int substringLength = pattern.length()+allowedMismatches;
+            if(targetOffset + substringLength > fastqLine.size()){substringLength = fastqLine.size()-targetOffset;};
+            return fastqLine.substr(targetOffset, substringLength);
+        }
+
         std::string pattern;
         std::string revCompPattern;
+        //bit-vector profiles of the fw/rv pattern
+        MyersPattern profile;
+        MyersPattern revCompProfile;
         EdlibAlignConfig config;
 };
 class VariableBarcode : public Barcode
 {
 
     public:
-    VariableBarcode(std::vector<std::string> inPatterns, std::string name, int inMismatches) : Barcode(name, inMismatches), patterns(inPatterns)
+    //reverseMapping: barcodes are also mapped to reverse reads (reverse complement of the barcode in the read)
+    //orientedReverseReads: reverse reads are passed also as reverse complement, all reverse look-ups except the segment index
+    //use the forward indexes on this sequence and the reverse complement indexes are not built
+    //indexMemoryBudget: bytes left for neighborhood indexes (shared by all barcodes of the patterns, nullptr: no limit),
+    //the memory of the built indexes is subtracted from it
+    VariableBarcode(std::vector<std::string> inPatterns, std::string name, int inMismatches, int threads = 1,
+                    bool reverseMapping = true, bool orientedReverseReads = false, size_t* indexMemoryBudget = nullptr)
+                    : Barcode(name, inMismatches), patterns(inPatterns)
     {
         for(std::string pattern : patterns)
         {
@@ -174,7 +298,6 @@ class VariableBarcode : public Barcode
             NULL, 0             // No custom alphabet
         );
 
-        //instant look-up table for perfect barcodes
         equalLengthBarcodes = true;
         size_t lengthOne = patterns.at(0).size();
         for (const std::string& pattern : patterns) 
@@ -185,10 +308,14 @@ class VariableBarcode : public Barcode
                 break;
             }
         }
-        if(equalLengthBarcodes)
-        {
-            barcodeSet.insert(patterns.begin(), patterns.end());
-        }
+        //one table per barcode length (staggered barcodes), a read is looked up with the longest length first
+        const bool reverseIndexes = reverseMapping && !orientedReverseReads;
+        fwExactBuckets = make_exact_buckets(patterns);
+        if(reverseIndexes){rvExactBuckets = make_exact_buckets(revCompPatterns);}
+
+        //bit-vector profiles of all fw/rv barcodes for the alignments
+        fwProfiles = make_myers_patterns(patterns);
+        rvProfiles = make_myers_patterns(revCompPatterns);
 
         //calculate minimum conversion rates of barcodes
         //for now this is only calculated if the number of barcodes is less than 1000, 
@@ -196,12 +323,44 @@ class VariableBarcode : public Barcode
         if(patterns.size() < 100000)
         {
             calculateConversionRate = true;
-            calculate_barcode_conversionRates();
+            calculate_barcode_conversionRates(threads);
         }
         else
         {
-            calculate_prefix_hash(5);
-            pefixMapCalculated = true;
+            //too many barcodes to align all of them: index the barcodes by error-free segments
+            fwSegmentIndex = std::make_shared<const BarcodeSegmentIndex>(patterns, mismatches);
+            if(reverseMapping){rvSegmentIndex = std::make_shared<const BarcodeSegmentIndex>(revCompPatterns, mismatches);}
+        }
+
+        //packed whitelist to filter barcodes before aligning them (read-only, therefore shared between clones of this barcode)
+        packedPatterns = std::make_shared<const PackedBarcodeWhitelist>(patterns, revCompPatterns, mismatches);
+
+        //for few mismatches we can store all sequences within this distance of a barcode in a hash table
+        //(only if this table does not get too big and fits into the index memory, otherwise we align barcodes)
+        const size_t indexNum = reverseIndexes ? 2 : 1;
+        const size_t estimatedIndexBytes = (equalLengthBarcodes && BarcodeNeighborhoodIndex::can_build(patterns, mismatches)) ?
+                                           indexNum * BarcodeNeighborhoodIndex::estimate_memory_bytes(patterns.size(), lengthOne, mismatches) : 0;
+        if(estimatedIndexBytes > 0 && indexMemoryBudget != nullptr && estimatedIndexBytes > *indexMemoryBudget)
+        {
+            std::cout << "No index of all sequences within " << mismatches << " mismatches for barcodes in " << name << ": it needs up to "
+                      << estimatedIndexBytes/(1024*1024) << " MB, but only " << *indexMemoryBudget/(1024*1024)
+                      << " MB of the index memory (-g) are left. Barcodes are aligned instead.\n";
+        }
+        else if(estimatedIndexBytes > 0)
+        {
+            fwNeighborhoodIndex = std::make_shared<const BarcodeNeighborhoodIndex>(patterns, mismatches, threads);
+            size_t indexSize = fwNeighborhoodIndex->size();
+            size_t indexBytes = fwNeighborhoodIndex->memory_bytes();
+            if(reverseIndexes)
+            {
+                rvNeighborhoodIndex = std::make_shared<const BarcodeNeighborhoodIndex>(revCompPatterns, mismatches, threads);
+                indexSize += rvNeighborhoodIndex->size();
+                indexBytes += rvNeighborhoodIndex->memory_bytes();
+            }
+            std::cout << "Created index of all sequences within " << mismatches << " mismatches for barcodes in " << name << ": " 
+                      << indexSize << " sequences (" << indexBytes/(1024*1024) << " MB)\n";
+            //the memory for building the index is free again, only its hash tables stay
+            if(indexMemoryBudget != nullptr){*indexMemoryBudget -= std::min(indexBytes, *indexMemoryBudget);}
         }
     }
     std::shared_ptr<Barcode> clone() const override 
@@ -209,65 +368,90 @@ class VariableBarcode : public Barcode
         return std::make_shared<VariableBarcode>(*this);
     }
 
-    void calculate_prefix_hash(const int prefixLen)
+    void calculate_barcode_conversionRates(const int threads)
     {
-        for (const std::string& seq : patterns) 
+        //conversion rates are only used to stop mapping early (bestEditDist < minConversion/2, with bestEditDist <= mismatches),
+        //and for the warnings (rate <= mismatches, rate == 0). Therefore rates above 2*mismatches+2 are stored as 2*mismatches+2:
+        //(2*mismatches+2)/2 is still bigger than every accepted edit distance, so early stops and warnings are the same as for the real rates.
+        //This allows us to stop every alignment as soon as it can not get better than the best conversion found so far
+        const int rateBound = 2*mismatches + 2;
+        std::vector<int> minRates(patterns.size(), rateBound);
+        std::vector<size_t> minElements(patterns.size(), 0);
+
+        //packed barcodes to skip pairs with a lower bound of the distance that is already too high
+        PackedBarcodeWhitelist packedBarcodes(patterns, revCompPatterns, rateBound - 1);
+        packedBarcodes.prepare_pairwise_bounds(patterns);
+
+        //every thread calculates the conversion rates of every threadNum-th barcode
+        const int threadNum = std::max(1, threads);
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threadNum; ++t)
         {
-            //make forward prefix
-            std::string fwPrefix = seq.substr(0, prefixLen);
-            fwPrefixMap[fwPrefix].push_back(seq);
+            workers.emplace_back([this, &packedBarcodes, &minRates, &minElements, rateBound, t, threadNum]()
+            {
+                std::vector<uint8_t> lowerBounds(packedBarcodes.padded_size());
+                for (size_t i = t; i < patterns.size(); i += threadNum) 
+                {
+                    const std::string& a = patterns.at(i);
+                    int min_rate = rateBound;
+                    if(packedBarcodes.is_usable()){packedBarcodes.pairwise_lower_bounds(i, lowerBounds.data());}
 
-            //make reverse prefix
-            std::string rvSeq = generate_reverse_complement(seq);
-            std::string rvPrefix = rvSeq.substr(0, prefixLen);
-            rvPrefixMap[rvPrefix].push_back(rvSeq);
+                    for (size_t j = 0; j < patterns.size() && min_rate > 0; ++j) 
+                    {
+                        if(i == j){continue;}
+                        const std::string& b = patterns.at(j);
+
+                        //for stagger barcode the first barcode has to be pattern, the secone the target, bcs. we do not cound deletions on the target
+                        // e.g.: barcode A and AGT should have a conversion rate of 0! So for staggered barcodes we need to test ALL barcodes and then take
+                        //the best match with the longest matching sequence...
+                        const bool aIsPattern = !(a.length() > b.length());
+                        //the lower bounds are calculated for a as pattern
+                        if(aIsPattern && packedBarcodes.is_usable() && lowerBounds[j] >= min_rate){continue;}
+
+                        const std::string& pattern = aIsPattern ? a : b;
+                        const std::string& target = aIsPattern ? b : a;
+                        const MyersPattern& profile = (*fwProfiles)[aIsPattern ? i : j];
+                        if(profile.is_usable())
+                        {
+                            //only search for alignments that are better than the best one so far
+                            const int distance = profile.distance(target.data(), static_cast<int>(target.length()), min_rate - 1);
+                            if(distance != -1 && distance < min_rate)
+                            {
+                                min_rate = distance;
+                                minElements.at(i) = j;
+                            }
+                            continue;
+                        }
+
+                        //only search for alignments that are better than the best one so far
+                        EdlibAlignConfig barcodeConversionConfig = edlibNewAlignConfig(
+                            min_rate - 1,       // maximum edit distance that still improves the conversion rate
+                            EDLIB_MODE_SHW,     // Semi-global alignment (deletions in the target at the end are not penalized), 
+                                                // the developers refer to it also as 'Prefix method', e.g. one barcode is ATC and another ATCATC
+                                                //this distance should still be zero...
+                            EDLIB_TASK_DISTANCE,// only the distance is needed
+                            NULL, 0);           // No custom alphabet
+                        EdlibAlignResult result = edlibAlign(pattern.c_str(), pattern.length(), target.c_str(), target.length(), barcodeConversionConfig);
+
+                        if (result.status == EDLIB_STATUS_OK && result.editDistance != -1 && result.editDistance < min_rate) 
+                        {
+                            min_rate = result.editDistance;
+                            minElements.at(i) = j;
+                        }
+                        edlibFreeAlignResult(result);
+                    }
+                    minRates.at(i) = min_rate;
+                }
+            });
         }
-    }
-
-    void calculate_barcode_conversionRates()
-    {
-        EdlibAlignConfig barcodeConversionConfig = edlibNewAlignConfig(
-            -1,                 // no limit for edit distancve
-            EDLIB_MODE_SHW,     // Semi-global alignment (deletions in the target at the end are not penalized), 
-                                // the developers refer to it also as 'Prefix method', e.g. one barcode is ATC and another ATCATC
-                                //this distance should still be zero...
-            EDLIB_TASK_PATH,    // Request full alignment path (M, I, D, S)
-            NULL, 0);             // No custom alphabet
+        for(std::thread& worker : workers){worker.join();}
 
+        //warnings and the map of conversion rates in the order of barcodes
         for (size_t i = 0; i < patterns.size(); ++i) 
         {
-            const std::string a = patterns.at(i);
-            int min_rate = std::numeric_limits<int>::max();
-            int minElement = std::numeric_limits<int>::max();
-
-            for (size_t j = 0; j < patterns.size(); ++j) 
-            {
-                if(i == j){continue;}
-
-                const std::string b = patterns.at(j);
-                int del = 0;
-                int ins = 0;
-                int subst = 0;
-                int targetEnd;
-
-                //for stagger barcode the first barcode has to be pattern, the secone the target, bcs. we do not cound deletions on the target
-                // e.g.: barcode A and AGT should have a conversion rate of 0! So for staggered barcodes we need to test ALL barcodes and then take
-                //the best match with the longest matching sequence...
-                if (a.length() > b.length()) 
-                {
-                    run_alignment(b, a, targetEnd, barcodeConversionConfig, del, ins, subst);
-                } else 
-                {
-                    run_alignment(a, b, targetEnd, barcodeConversionConfig, del, ins, subst);
-                }
-
-                int rate = del + ins + subst;
-                if (rate < min_rate) 
-                {
-                    min_rate = rate;
-                    minElement = j;
-                }
-            }
+            const std::string& a = patterns.at(i);
+            const int min_rate = minRates.at(i);
+            const size_t minElement = minElements.at(i);
 
             //warning if barcodes are the same/ or one is suffix of the other
             if(min_rate == 0)
@@ -288,102 +472,153 @@ class VariableBarcode : public Barcode
         }
     }
 
-    bool align(std::string& matchedBarcode, const std::string& fastqLine, const unsigned int targetOffset,
-        int& targetEnd, int& delNum, int& insNum, int& substNum,
-        bool reverse = false)
+    std::vector<std::string> get_patterns()
+    {
+        return patterns;
+    }
+    bool is_wildcard(){return false;}
+    bool is_constant(){return false;}
+    bool is_stop(){return false;}
+    bool is_dna(){return false;}
+    bool is_read_end(){return false;}
+
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view fastqLine, const unsigned int targetOffset,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
     {
-        //check if we can instantly match pattern
-        if(equalLengthBarcodes && (fastqLine.size() >= (targetOffset + patterns.at(0).size())))
+        //the budget of the pattern is not used here: which barcode is taken (shortest/ tied barcodes, the early stop
+        //of the conversion rates) also depends on barcodes with more edits, the pattern is stopped after the barcode instead
+        (void)maxMismatches;
+
+        //the reverse complement of the read matches a barcode if the read matches the reverse complement of the barcode:
+        //with an oriented read (revCompLine) the read part at targetOffset is the part of revCompLine that ends at orientedEnd,
+        //and we look it up in the forward indexes (if an index of the used orientation is missing we align the barcodes)
+        const bool oriented = reverse && !revCompLine.empty() && targetOffset <= fastqLine.size();
+        const size_t orientedEnd = oriented ? fastqLine.size() - targetOffset : 0;
+        const std::vector<ExactBucket>& exactBuckets = (reverse && !oriented) ? rvExactBuckets : fwExactBuckets;
+        const BarcodeNeighborhoodIndexPtr& neighborhoodIndex = (reverse && !oriented) ? rvNeighborhoodIndex : fwNeighborhoodIndex;
+
+        //check if we can instantly match pattern: for barcodes of different lengths the longest barcode that matches is stored
+        //(like for aligned barcodes, where we prefer the longer barcode if two barcodes map equally well)
+        for(const ExactBucket& bucket : exactBuckets)
         {
-            std::string exactTarget = fastqLine.substr(targetOffset, patterns.at(0).size());
-            if(reverse){exactTarget = generate_reverse_complement(exactTarget);}
-            if (barcodeSet.find(exactTarget) != barcodeSet.end()) 
+            if(fastqLine.size() < (targetOffset + bucket.length)){continue;}
+            const uint32_t barcodeId = oriented ?
+                find_exact(patterns, bucket.ids, revCompLine.substr(orientedEnd - bucket.length, bucket.length)) :
+                find_exact(reverse ? revCompPatterns : patterns, bucket.ids, fastqLine.substr(targetOffset, bucket.length));
+            if (barcodeId != noBarcode) 
             {
-                targetEnd = patterns.at(0).size();
-                matchedBarcode = exactTarget;
+                alignment.targetEnd = bucket.length;
+                alignment.barcode = patterns.at(barcodeId);
                 return true;
-            }  
-            else if(mismatches == 0)
+            }
+        }
+        //without mismatches a barcode can only map exactly
+        if(mismatches == 0 && !exactBuckets.empty())
+        {
+            return false;
+        }
+
+        //look up the best barcode in the index of all sequences within the allowed mismatches
+        if(neighborhoodIndex != nullptr && targetOffset < fastqLine.size())
+        {
+            std::string_view target = fastqLine.substr(targetOffset, patterns.at(0).size() + mismatches);
+            uint32_t barcodeId;
+            int distance;
+            BarcodeNeighborhoodIndex::LookupResult lookup = oriented ?
+                neighborhoodIndex->find_best_barcode_reverse(revCompLine.substr(0, orientedEnd), barcodeId, distance) :
+                neighborhoodIndex->find_best_barcode(target, barcodeId, distance);
+            if(lookup == BarcodeNeighborhoodIndex::LookupResult::NoMatch || lookup == BarcodeNeighborhoodIndex::LookupResult::Ambiguous)
             {
                 return false;
             }
+            else if(lookup == BarcodeNeighborhoodIndex::LookupResult::Unique)
+            {
+                //align only the best barcode to get the exact edits and end position of the barcode in the read
+                alignment.delNum=alignment.insNum=alignment.substNum=alignment.targetEnd=0;
+                const std::string& usedPattern = reverse ? revCompPatterns.at(barcodeId) : patterns.at(barcodeId);
+                const MyersPattern& usedProfile = reverse ? rvProfiles->at(barcodeId) : fwProfiles->at(barcodeId);
+                if(!run_alignment(usedProfile, usedPattern, target, alignment.targetEnd, config,
+                                  alignment.delNum, alignment.insNum, alignment.substNum))
+                {
+                    return false;
+                }
+                alignment.barcode = patterns.at(barcodeId);
+                return true;
+            }
+            //otherwise the read contains unknown bases (e.g., N), and we align it to all barcodes
         }
 
-        std::vector<std::string> patternsToMap = patterns;
-        std::vector<std::string> patternsToStore = patterns;
-
-        //get the reverse pattern list if we have reverse string
-        if(reverse){patternsToMap = revCompPatterns;}
+        //get the reverse pattern list if we have reverse string (the stored barcode is always the forward barcode)
+        const std::vector<std::string>& patternsToMap = reverse ? revCompPatterns : patterns;
 
-        std::string bestFoundPattern;
+        std::string_view bestFoundPattern;
         bool bestFoundAlignment = false;
         int bestTargetEnd = -1;
         int bestEditDist = mismatches+1;
         bool severalMatches = false; //if there are several best-fitting solutions (only the case when the number of allowed mismatches
         //is bigger than possible barcode-conversion numbers) we discard the solution
 
-        //if we have a hash map, fill the patterns that we need to check
-        if(pefixMapCalculated)
+        //for big whitelists only align barcodes that share an error-free segment with the read
+        //(candidates are in the order of the whitelist, same as when aligning all barcodes)
+        //the candidate list is scratch space of the thread: threads share the barcode objects
+        static thread_local std::vector<uint32_t> candidateIds;
+        const BarcodeSegmentIndexPtr& segmentIndex = reverse ? rvSegmentIndex : fwSegmentIndex;
+        const bool useSegmentIndex = (segmentIndex != nullptr);
+        if(useSegmentIndex)
         {
-            std::vector<std::string> prefixPatterns;
-            std::vector<std::string> fwPrefixPatterns;
+            segmentIndex->find_candidates(fastqLine, targetOffset, candidateIds);
+        }
+        const size_t barcodesToMap = useSegmentIndex ? candidateIds.size() : patternsToMap.size();
 
-            std::unordered_map<std::string, std::vector<std::string>> prefixMap = fwPrefixMap;
-            if(reverse)
-            {
-                prefixMap = rvPrefixMap;
-            }
-            for (const auto& pair : prefixMap) 
+        //lower bounds of the edit distance for the current block of barcodes
+        const bool usePackedFilter = packedPatterns->is_usable() && targetOffset <= fastqLine.size();
+        uint8_t lowerBounds[PackedBarcodeWhitelist::blockSize];
+
+        for(size_t barcodeIdx = 0; barcodeIdx != barcodesToMap; ++barcodeIdx)
+        {
+            const size_t patternIdx = useSegmentIndex ? candidateIds[barcodeIdx] : barcodeIdx;
+
+            //skip barcodes that can not be stored as a (new) best match anyways: its edit distance is bigger than the allowed mismatches
+            //or bigger than the best distance found so far. Those barcodes would not change the result, the order of the remaining
+            //alignments stays the same, therefore results are identical to aligning all barcodes
+            if(usePackedFilter)
             {
-                std::string usedPattern = pair.first;
-
-                int delNumTmp;
-                int insNumTmp;
-                int substNumTmp;
-                delNumTmp=insNumTmp=substNumTmp=targetEnd=0;
-                std::string target;
-                int substringLength = usedPattern.length()+mismatches;
-                target = fastqLine.substr(targetOffset, substringLength);
-                bool foundAlignment = run_alignment(usedPattern, target, targetEnd, config, delNumTmp,  insNumTmp, substNumTmp);
-                if(foundAlignment)
+                const size_t blockIdx = barcodeIdx % PackedBarcodeWhitelist::blockSize;
+                if(blockIdx == 0 && useSegmentIndex)
                 {
-                    for (const std::string& seq : pair.second) 
-                    {
-                            prefixPatterns.push_back(seq);
-                            std::string storePattern = seq;
-                            if(reverse){storePattern = generate_reverse_complement(seq);}
-                            fwPrefixPatterns.push_back(storePattern);
-                    }
+                    packedPatterns->lower_bounds(fastqLine, targetOffset, reverse, &candidateIds[barcodeIdx],
+                                                 std::min(PackedBarcodeWhitelist::blockSize, barcodesToMap - barcodeIdx), lowerBounds);
+                }
+                else if(blockIdx == 0)
+                {
+                    packedPatterns->lower_bounds(fastqLine, targetOffset, reverse, patternIdx, lowerBounds);
+                }
+                if(lowerBounds[blockIdx] > std::min(mismatches, bestEditDist))
+                {
+                    continue;
                 }
             }
-            //normally patternsToMap is just all FW or RV patterns, here we create these vectors new to only include patterns with a prefix that
-            //is possible given a number of MM
-            patternsToMap = prefixPatterns;
-            //same goes for patternsToStore, this is normally just a list of patterns (FW), but now needs to be manually adjusted,
-            //it is same as patternsToMap in case of FW mapping
-            patternsToStore = fwPrefixPatterns;
-        }
 
-        for(size_t patternIdx = 0; patternIdx!= patternsToMap.size(); ++patternIdx)
-        {
             bool foundAlignment = false;
 
             int delNumTmp;
             int insNumTmp;
             int substNumTmp;
+            int targetEnd;
             delNumTmp=insNumTmp=substNumTmp=targetEnd=0;
             //get pattern, its length can vary
-            std::string usedPattern = patternsToMap.at(patternIdx);
+            const std::string& usedPattern = patternsToMap[patternIdx];
 
             //define target sequence (can differ for every barcode due to its length)
-            std::string target;
             int substringLength = usedPattern.length()+mismatches;
             //std::cout << "\t LENGTH: " <<substringLength << " seq: " << fastqLine.size()<< "\n";
             if(targetOffset + substringLength > fastqLine.size()){substringLength = fastqLine.size()-targetOffset;};
-            target = fastqLine.substr(targetOffset, substringLength);
+            std::string_view target = fastqLine.substr(targetOffset, substringLength);
 
             //map the pattern to the target sequence
-            foundAlignment = run_alignment(usedPattern, target, targetEnd, config, delNumTmp,  insNumTmp, substNumTmp);
+            const MyersPattern& usedProfile = reverse ? (*rvProfiles)[patternIdx] : (*fwProfiles)[patternIdx];
+            foundAlignment = run_alignment(usedProfile, usedPattern, target, targetEnd, config, delNumTmp,  insNumTmp, substNumTmp);
             
             if(foundAlignment && (delNumTmp+insNumTmp+substNumTmp)<=bestEditDist)
             {
@@ -407,17 +642,17 @@ class VariableBarcode : public Barcode
                 }
 
                 bestFoundAlignment = foundAlignment;
-                bestFoundPattern = patternsToStore.at(patternIdx); //the barcode is the TRUE forward barcode, not the reverse complement
+                bestFoundPattern = patterns[patternIdx]; //the barcode is the TRUE forward barcode, not the reverse complement
                 bestTargetEnd = targetEnd;
                 bestEditDist = (delNumTmp+insNumTmp+substNumTmp);
-                delNum = delNumTmp;
-                insNum = insNumTmp;
-                substNum = substNumTmp;
+                alignment.delNum = delNumTmp;
+                alignment.insNum = insNumTmp;
+                alignment.substNum = substNumTmp;
 
                 //if we found a new best match, check if this is already the best match we can ever get (minimal conversion dist between barcodes)
                 if(calculateConversionRate)
                 {
-                    int minConversion = pattern_conversionrates.at(patternsToStore.at(patternIdx));
+                    int minConversion = pattern_conversionrates.at(patterns[patternIdx]);
                     //we can do this since levenshtein distance fullfills the triangle inequality is a distance metric
                     //imagine there is a second barcode that could fit better: this second barcode must have a shorter distance to target sequence
                     //than our pattern. Now there r two options 1.) while converting pattern to target we would 'go through' the second barcode. In this
@@ -439,35 +674,87 @@ class VariableBarcode : public Barcode
             return false;
         }
 
-        targetEnd = bestTargetEnd;
-        matchedBarcode = bestFoundPattern;
+        alignment.targetEnd = bestTargetEnd;
+        alignment.barcode = bestFoundPattern;
 
         return bestFoundAlignment;
     }
 
-    std::vector<std::string> get_patterns()
-    {
-        return patterns;
-    }
-    bool is_wildcard(){return false;}
-    bool is_constant(){return false;}
-    bool is_stop(){return false;}
-    bool is_dna(){return false;}
-    bool is_read_end(){return false;}
-
     private:
+        static constexpr uint32_t noBarcode = UINT32_MAX;
+
+        //open addressing hash table of the IDs of all barcodes of one length (hash of the barcode sequence),
+        //to look up the read without copying it
+        struct ExactBucket
+        {
+            size_t length;
+            std::vector<uint32_t> ids;
+        };
+
+        //exact tables of all barcode lengths, the longest length first
+        static std::vector<ExactBucket> make_exact_buckets(const std::vector<std::string>& barcodes)
+        {
+            std::vector<size_t> lengths;
+            for(const std::string& barcode : barcodes){lengths.push_back(barcode.size());}
+            std::sort(lengths.begin(), lengths.end(), std::greater<size_t>());
+            lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+
+            std::vector<ExactBucket> buckets;
+            for(const size_t length : lengths)
+            {
+                buckets.push_back(ExactBucket{length, make_exact_table(barcodes, length)});
+            }
+            return buckets;
+        }
+        static std::vector<uint32_t> make_exact_table(const std::vector<std::string>& barcodes, const size_t length)
+        {
+            size_t barcodeNum = 0;
+            for(const std::string& barcode : barcodes){if(barcode.size() == length){++barcodeNum;}}
+            size_t tableSize = 1;
+            while(tableSize < 2*barcodeNum){tableSize <<= 1;}
+            std::vector<uint32_t> table(tableSize, noBarcode);
+            for(uint32_t barcodeId = 0; barcodeId < barcodes.size(); ++barcodeId)
+            {
+                if(barcodes[barcodeId].size() != length){continue;}
+                size_t slot = std::hash<std::string_view>()(barcodes[barcodeId]) & (tableSize - 1);
+                while(table[slot] != noBarcode && barcodes[table[slot]] != barcodes[barcodeId]){slot = (slot + 1) & (tableSize - 1);}
+                if(table[slot] == noBarcode){table[slot] = barcodeId;}
+            }
+            return table;
+        }
+        static uint32_t find_exact(const std::vector<std::string>& barcodes, const std::vector<uint32_t>& table, std::string_view seq)
+        {
+            size_t slot = std::hash<std::string_view>()(seq) & (table.size() - 1);
+            while(table[slot] != noBarcode)
+            {
+                if(barcodes[table[slot]] == seq){return table[slot];}
+                slot = (slot + 1) & (table.size() - 1);
+            }
+            return noBarcode;
+        }
+
         std::vector<std::string> patterns;
         std::vector<std::string> revCompPatterns;
-        std::unordered_set<std::string> barcodeSet;
+        //instant look-up of barcodes (reverse tables are empty/ nullptr if they are not built)
+        std::vector<ExactBucket> fwExactBuckets;
+        std::vector<ExactBucket> rvExactBuckets;
         bool equalLengthBarcodes;
 
         std::unordered_map<std::string, int> pattern_conversionrates;
         bool calculateConversionRate = false;
 
-        // Map: first 5 bases → list of sequences
-        std::unordered_map<std::string, std::vector<std::string>> fwPrefixMap;
-        std::unordered_map<std::string, std::vector<std::string>> rvPrefixMap;
-        bool pefixMapCalculated = false;
+        //segment index for big whitelists (nullptr if we align all barcodes)
+        BarcodeSegmentIndexPtr fwSegmentIndex;
+        BarcodeSegmentIndexPtr rvSegmentIndex;
+
+        //2-bit packed fw/rv barcodes for a fast lower bound on the edit distance
+        PackedBarcodeWhitelistPtr packedPatterns;
+        //bit-vector profiles of the fw/rv barcodes
+        MyersPatternsPtr fwProfiles;
+        MyersPatternsPtr rvProfiles;
+        //hash tables of all sequences within the allowed mismatches of a barcode (nullptr if not used)
+        BarcodeNeighborhoodIndexPtr fwNeighborhoodIndex;
+        BarcodeNeighborhoodIndexPtr rvNeighborhoodIndex;
 
         EdlibAlignConfig config;
 };
@@ -483,21 +770,6 @@ class WildcardBarcode : public Barcode
         return std::make_shared<WildcardBarcode>(*this);
     }
 
-    bool align(std::string& matchedBarcode, const std::string& target, const unsigned int positionInFastqLine,
-        int& targetEnd, int& delNum, int& insNum, int& substNum,
-        bool reverse = false)
-    {
-        (void)delNum; // silence unused parameter warning
-        (void)insNum; // silence unused parameter warning
-        (void)substNum; // silence unused parameter warning
-        (void)reverse; // silence unused parameter warning
-
-        matchedBarcode = target.substr(positionInFastqLine, length);
-        targetEnd = (target.length() < length) ? target.length() : length;
-        // e.g.: [AGTAGT]cccc: start=0 end=6 end is first not included idx
-        return true;
-    }
-
     std::vector<std::string> get_patterns()
     {
         std::vector<std::string> patterns = {std::string(length, 'X')};
@@ -509,6 +781,20 @@ class WildcardBarcode : public Barcode
     bool is_dna(){return false;}
     bool is_read_end(){return false;}
 
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view target, const unsigned int positionInFastqLine,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
+    {
+        (void)reverse; // silence unused parameter warning
+        (void)revCompLine; // silence unused parameter warning
+        (void)maxMismatches; // silence unused parameter warning
+
+        alignment.barcode = target.substr(positionInFastqLine, length);
+        alignment.targetEnd = (target.length() < length) ? target.length() : length;
+        // e.g.: [AGTAGT]cccc: start=0 end=6 end is first not included idx
+        return true;
+    }
+
 };
 
 //A stop-barcode: mapping on both sides is only done up to here
@@ -520,22 +806,6 @@ class StopBarcode : public Barcode
     std::shared_ptr<Barcode> clone() const override {
         return std::make_shared<StopBarcode>(*this);
     }
-    bool align(std::string& matchedBarcode, const std::string& target, const unsigned int targetOffset,
-        int& targetEnd, int& delNum, int& insNum, int& substNum,
-        bool reverse = false)
-
-        {
-            (void)matchedBarcode; // silence unused parameter warning
-            (void)target; // silence unused parameter warning
-            (void)targetOffset; // silence unused parameter warning
-            (void)targetEnd; // silence unused parameter warning
-            (void)delNum; // silence unused parameter warning
-            (void)insNum; // silence unused parameter warning
-            (void)substNum; // silence unused parameter warning
-            (void)reverse; // silence unused parameter warning
-
-            return false;
-        }
     std::vector<std::string> get_patterns()
     {
         std::vector<std::string> patterns = {pattern};
@@ -547,6 +817,20 @@ class StopBarcode : public Barcode
     bool is_dna(){return false;}
     bool is_read_end(){return false;}
 
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view target, const unsigned int targetOffset,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
+        {
+            (void)alignment; // silence unused parameter warning
+            (void)target; // silence unused parameter warning
+            (void)targetOffset; // silence unused parameter warning
+            (void)reverse; // silence unused parameter warning
+            (void)revCompLine; // silence unused parameter warning
+            (void)maxMismatches; // silence unused parameter warning
+
+            return false;
+        }
+
     private:
     std::string pattern; //just a string of "XXXXX"
 };
@@ -560,22 +844,6 @@ class ReadSeperatorBarcode : public Barcode
     std::shared_ptr<Barcode> clone() const override {
         return std::make_shared<ReadSeperatorBarcode>(*this);
     }
-    bool align(std::string& matchedBarcode, const std::string& target, const unsigned int targetOffset,
-        int& targetEnd, int& delNum, int& insNum, int& substNum,
-        bool reverse = false)
-
-        {
-            (void)matchedBarcode; // silence unused parameter warning
-            (void)target; // silence unused parameter warning
-            (void)targetOffset; // silence unused parameter warning
-            (void)targetEnd; // silence unused parameter warning
-            (void)delNum; // silence unused parameter warning
-            (void)insNum; // silence unused parameter warning
-            (void)substNum; // silence unused parameter warning
-            (void)reverse; // silence unused parameter warning
-
-            return false;
-        }
     std::vector<std::string> get_patterns()
     {
         std::vector<std::string> patterns = {pattern};
@@ -587,6 +855,20 @@ class ReadSeperatorBarcode : public Barcode
     bool is_dna(){return false;}
     bool is_read_end(){return true;}
 
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view target, const unsigned int targetOffset,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
+        {
+            (void)alignment; // silence unused parameter warning
+            (void)target; // silence unused parameter warning
+            (void)targetOffset; // silence unused parameter warning
+            (void)reverse; // silence unused parameter warning
+            (void)revCompLine; // silence unused parameter warning
+            (void)maxMismatches; // silence unused parameter warning
+
+            return false;
+        }
+
     private:
     std::string pattern; //just a string of "XXXXX"
 };
@@ -601,22 +883,6 @@ class DNABarcode : public Barcode
     std::shared_ptr<Barcode> clone() const override {
         return std::make_shared<DNABarcode>(*this);
     }
-    bool align(std::string& matchedBarcode, const std::string& target, const unsigned int targetOffset,
-        int& targetEnd, int& delNum, int& insNum, int& substNum,
-        bool reverse = false)
-
-        {
-            (void)matchedBarcode; // silence unused parameter warning
-            (void)target; // silence unused parameter warning
-            (void)targetOffset; // silence unused parameter warning
-            (void)targetEnd; // silence unused parameter warning
-            (void)delNum; // silence unused parameter warning
-            (void)insNum; // silence unused parameter warning
-            (void)substNum; // silence unused parameter warning
-            (void)reverse; // silence unused parameter warning
-
-            return false;
-        }
     std::vector<std::string> get_patterns()
     {
         std::vector<std::string> patterns = {pattern};
@@ -628,6 +894,20 @@ class DNABarcode : public Barcode
     bool is_dna(){return true;}
     bool is_read_end(){return false;}
 
+    protected:
+    bool align_sequence(BarcodeAlignment& alignment, std::string_view target, const unsigned int targetOffset,
+                        bool reverse, std::string_view revCompLine, const int maxMismatches)
+        {
+            (void)alignment; // silence unused parameter warning
+            (void)target; // silence unused parameter warning
+            (void)targetOffset; // silence unused parameter warning
+            (void)reverse; // silence unused parameter warning
+            (void)revCompLine; // silence unused parameter warning
+            (void)maxMismatches; // silence unused parameter warning
+
+            return false;
+        }
+
     private:
     std::string pattern; //just a string of "DNA"
 };
@@ -728,4 +1008,21 @@ class BarcodePattern
 };
 
 typedef std::shared_ptr<BarcodePattern> BarcodePatternPtr; 
-typedef std::shared_ptr<std::vector<BarcodePatternPtr>> MultipleBarcodePatternVectorPtr; 
\ No newline at end of file
+typedef std::shared_ptr<std::vector<BarcodePatternPtr>> MultipleBarcodePatternVectorPtr; 
+
+//the barcode patterns once they are parsed: everything the mapping needs is compiled into the barcodes (whitelist look-ups,
+//alignment profiles and lengths of the sequences). The set is never changed afterwards and all threads share the same patterns.
+class PatternSet
+{
+    public:
+        explicit PatternSet(const MultipleBarcodePatternVectorPtr& patternList) : patterns(patternList->begin(), patternList->end()) {}
+
+        std::size_t size() const {return patterns.size();}
+        const BarcodePatternPtr& operator[](const std::size_t i) const {return patterns[i];}
+        std::vector<BarcodePatternPtr>::const_iterator begin() const {return patterns.begin();}
+        std::vector<BarcodePatternPtr>::const_iterator end() const {return patterns.end();}
+
+    private:
+        const std::vector<BarcodePatternPtr> patterns;
+};
+typedef std::shared_ptr<const PatternSet> PatternSetPtr;
@@ -10,6 +10,20 @@ bool check_if_seq_too_short(const size_t& offset, const std::string& seq)
     return false;
 }
 
+//barcodes after itr that would still be aligned (wildcards and DNA are only extracted), used to count the alignments
+//skipped when a pattern is stopped by its score bound
+template <typename BarcodeIterator>
+unsigned long long remaining_alignments(BarcodeIterator itr, const BarcodeIterator end)
+{
+    unsigned long long alignments = 0;
+    for(; itr < end; ++itr)
+    {
+        if((*itr)->is_stop() || (*itr)->is_read_end()){break;}
+        if(!(*itr)->is_wildcard() && !(*itr)->is_dna()){++alignments;}
+    }
+    return alignments;
+}
+
 std::string trim(const std::string& str) 
 {
     const std::string whitespace = " \t\r\f\v\n";  // Added '\n' to include newlines
@@ -269,7 +283,8 @@ BarcodePatternPtr Mapping<MappingPolicy, FilePolicy>::create_barcodeVector_from_
     const std::vector<int>& mismatchList, 
     const std::string& patternName,
     std::unordered_map<std::string, std::vector<std::string>>& fileToBarcodesMap,
-    const input& input)
+    const input& input,
+    size_t& indexMemoryBudget)
 {
     BarcodeVector barcodeVector;
     BarcodeVector detachedReverseVector;
@@ -331,7 +346,10 @@ BarcodePatternPtr Mapping<MappingPolicy, FilePolicy>::create_barcodeVector_from_
         //create Variable Barcode from this data
         if(isVariable)
         {
-            VariableBarcode barcode(fileToBarcodesMap.at(patternElement), patternElement, mismatchList.at(barcodeIdx));
+            //reverse complement barcodes are only looked up for paired-end reads that are not mapped detached
+            const bool reverseMapping = !input.reverseFile.empty() && !input.detachedReverseMapping;
+            VariableBarcode barcode(fileToBarcodesMap.at(patternElement), patternElement, mismatchList.at(barcodeIdx), input.threads,
+                                    reverseMapping, input.orientReverseRead, &indexMemoryBudget);
             std::shared_ptr<VariableBarcode> barcodePtr(std::make_shared<VariableBarcode>(barcode));
             if (input.detachedReverseMapping && isReversePattern) 
             {
@@ -494,9 +512,12 @@ bool Mapping<MappingPolicy, FilePolicy>::generate_barcode_patterns(const input&
 
     // parse all files with variables barcodes (guides, BC1, BC2, ..., ABs)
     // parse mismatches, pattern, lengths of patterns (e.g. UMI legnth 15)
+    //the neighborhood indexes of all barcode columns share the index memory
+    size_t indexMemoryBudget = static_cast<size_t>(input.indexMemory) * 1024 * 1024;
     for(size_t i = 0; i < patternList.size(); i++)
     {
-        barcodePatternList->emplace_back(create_barcodeVector_from_patternLine(patternList.at(i).second, mismatchList.at(i), patternList.at(i).first, fileToBarcodesMap, input));
+        barcodePatternList->emplace_back(create_barcodeVector_from_patternLine(patternList.at(i).second, mismatchList.at(i), patternList.at(i).first, fileToBarcodesMap, input,
+                                                                               indexMemoryBudget));
     }
 
     return true;
@@ -508,7 +529,8 @@ bool MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(const st
                                         DemultiplexedLine& demultiplexedLine, const input& input, 
                                         BarcodePatternPtr barcodePatterns,
                                         int& mmScore,
-                                        OneLineDemultiplexingStatsPtr stats)
+                                        OneLineDemultiplexingStatsPtr stats,
+                                        const int scoreBound)
 {
     (void) input; //only needed for pairwise splitting of lines
     
@@ -522,20 +544,16 @@ bool MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(const st
         ++patternItr)
     {
 
-        //barcode-specific variables
-        std::string barcode = ""; //the actual real barcode that we find (mismatch corrected)
-        int del = 0; 
-        int ins = 0;
-        int subst = 0;
-        int targetEnd = 0;
+        //barcode-specific variables: the actual real barcode that we find (mismatch corrected), its end in the read and the edits
+        BarcodeAlignment alignment;
         ++position;
 
         //if we have a wildcard, just extract the necessary barcodes
         if((*patternItr)->is_wildcard())
         {
-            (*patternItr)->align(barcode, seq.first.line, positionInFastqLine, targetEnd, del, ins, subst);
-            positionInFastqLine += (targetEnd);
-            demultiplexedLine.barcodeList.push_back(barcode);
+            (*patternItr)->align(alignment, seq.first.line, positionInFastqLine);
+            positionInFastqLine += (alignment.targetEnd);
+            demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
 
             if(stats != nullptr)
             {
@@ -585,7 +603,8 @@ bool MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(const st
         }
 
         //std::cout << " trying " << seq.first.line << "\n";
-        if(!(*patternItr)->align(barcode, seq.first.line, positionInFastqLine, targetEnd, del, ins, subst))
+        //barcodes with more edits than left by the score bound can not make this pattern the best one
+        if(!(*patternItr)->align(alignment, seq.first.line, positionInFastqLine, false, std::string_view(), scoreBound - 1 - totalEdits))
         {            
             //save until where we mapped
             if(stats != nullptr)
@@ -598,21 +617,29 @@ bool MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(const st
 
         //std::cout << "ALIGN: found " << barcode << " within " << seq.first.line.substr(positionInFastqLine,targetEnd) << " with D: " << del << ", I: " << ins << " and S: " << subst << "\n";
 
-        totalEdits = totalEdits + del + ins + subst;
-        positionInFastqLine += targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
+        totalEdits = totalEdits + alignment.delNum + alignment.insNum + alignment.substNum;
+        positionInFastqLine += alignment.targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
         //positionInFastqLine is the first position to INCLUDE in next alignment
 
-        assert(barcode != "");
+        //another pattern already maps with at most as many edits: stop mapping the rest of this one
+        if(totalEdits >= scoreBound)
+        {
+            ++prunedPatternMappings;
+            prunedBarcodeAlignments += remaining_alignments(patternItr + 1, barcodePatterns->end());
+            return false;
+        }
+
+        assert(!alignment.barcode.empty());
         if(stats != nullptr)
         {
-            stats->insertions.push_back(ins);
-            stats->deletions.push_back(del);
-            stats->substitutions.push_back(subst);
+            stats->insertions.push_back(alignment.insNum);
+            stats->deletions.push_back(alignment.delNum);
+            stats->substitutions.push_back(alignment.substNum);
         }
         
         //add this match to the BarcodeMapping
         //barcodeMap.emplace_back(std::make_shared<std::string>(mappedBarcode));
-        demultiplexedLine.barcodeList.push_back(barcode);
+        demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
     }
 
     if(stats != nullptr)
@@ -632,13 +659,167 @@ bool MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(const st
     return true;
 }
 
+void MapEachBarcodeSequentiallyPolicy::split_lines_into_barcode_patterns(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                                        std::vector<DemultiplexedLine>& demultiplexedLines, const input& input, 
+                                        BarcodePatternPtr barcodePatterns,
+                                        std::vector<int>& mmScores, std::vector<bool>& results,
+                                        const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                                        const std::vector<int>& scoreBounds)
+{
+    (void) input; //only needed for pairwise splitting of lines
+
+    //read specific variables: position of the next barcode in every read and the edits so far,
+    //results[i] is true as long as all barcodes of read i mapped
+    const size_t readNum = seqs.size();
+    std::vector<unsigned int> positionsInFastqLine(readNum, 0);
+    std::vector<int> totalEdits(readNum, 0);
+    results.assign(readNum, true);
+    int position = -1;
+
+    //reads that are still mapped, with their sequence and offset (input of the batch alignment of constant barcodes)
+    std::vector<size_t> mappedReads;
+    std::vector<std::string_view> mappedLines;
+    std::vector<unsigned int> mappedOffsets;
+    std::vector<int> mappedBudgets; //edits a barcode of the read can have before the read reaches its score bound
+    std::vector<BarcodeAlignment> alignments;
+    std::unique_ptr<bool[]> found(new bool[readNum]);
+
+    for(BarcodeVector::iterator patternItr = barcodePatterns->begin(); 
+        patternItr < barcodePatterns->end(); 
+        ++patternItr)
+    {
+        ++position;
+
+        if((*patternItr)->is_stop() || (*patternItr)->is_read_end())
+        {
+            //stop here: we do not continue mapping after stop barcode [*] or when the read ends
+            break;
+        }
+        else if((*patternItr)->is_dna())
+        {
+            //make sure DNA is the last part of a sequence
+            if(!(*(patternItr+1))->is_read_end())
+            {
+                std::cerr << "After a DNA pattern a read-end pattern [-] must follow, since we do not know the length of the DNA pattern.\n\
+                 Therefore a valid pattern would be ether ... [DNA][-]... or ...[-][DNA]...\n\
+                Please adjust pattern file accordingly.";
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        //collect all reads that still map (wildcards and DNA do not check the read length)
+        mappedReads.clear();
+        mappedLines.clear();
+        mappedOffsets.clear();
+        mappedBudgets.clear();
+        const bool checkLength = !((*patternItr)->is_wildcard() || (*patternItr)->is_dna());
+        for(size_t read = 0; read < readNum; ++read)
+        {
+            if(!results[read]){continue;}
+            // could happen in the case of deletions in the UMI sequence...
+            if(checkLength && check_if_seq_too_short(positionsInFastqLine[read], seqs[read]->first.line))
+            {
+                results[read] = false;
+                continue;
+            }
+            mappedReads.push_back(read);
+            mappedLines.push_back(seqs[read]->first.line);
+            mappedOffsets.push_back(positionsInFastqLine[read]);
+            mappedBudgets.push_back(scoreBounds[read] - 1 - totalEdits[read]);
+        }
+        alignments.assign(mappedReads.size(), BarcodeAlignment());
+
+        if((*patternItr)->is_dna())
+        {
+            for(const size_t read : mappedReads)
+            {
+                //set dna, quality (name was already set when getting next line to the name of forward read ONLY)
+                const fastqLine& seq = seqs[read]->first;
+                demultiplexedLines[read].dna = seq.line.substr(positionsInFastqLine[read], seq.line.length());
+                demultiplexedLines[read].dnaQuality = seq.quality.substr(positionsInFastqLine[read], seq.line.length());
+                demultiplexedLines[read].containsDNA = true;
+            }
+            continue;
+        }
+        else if((*patternItr)->is_constant())
+        {
+            //align the linker to all reads at once
+            std::static_pointer_cast<ConstantBarcode>(*patternItr)->align_batch(alignments.data(), found.get(), mappedLines.data(),
+                                                                                mappedOffsets.data(), mappedReads.size(),
+                                                                                false, mappedBudgets.data());
+        }
+        else
+        {
+            for(size_t i = 0; i < mappedReads.size(); ++i)
+            {
+                found[i] = (*patternItr)->align(alignments[i], mappedLines[i], mappedOffsets[i], false, std::string_view(), mappedBudgets[i]);
+            }
+        }
+
+        for(size_t i = 0; i < mappedReads.size(); ++i)
+        {
+            const size_t read = mappedReads[i];
+            const BarcodeAlignment& alignment = alignments[i];
+            if(!found[i])
+            {
+                //save until where we mapped
+                if(stats[read] != nullptr)
+                {
+                    stats[read]->failedLinesMappingFw.first = barcodePatterns->patternName;
+                    stats[read]->failedLinesMappingFw.second = position;
+                }
+                results[read] = false;
+                continue;
+            }
+
+            totalEdits[read] += alignment.delNum + alignment.insNum + alignment.substNum;
+            positionsInFastqLine[read] += alignment.targetEnd;
+            if(totalEdits[read] >= scoreBounds[read])
+            {
+                ++prunedPatternMappings;
+                prunedBarcodeAlignments += remaining_alignments(patternItr + 1, barcodePatterns->end());
+                results[read] = false;
+                continue;
+            }
+
+            assert((*patternItr)->is_wildcard() || !alignment.barcode.empty());
+            if(stats[read] != nullptr)
+            {
+                stats[read]->insertions.push_back(alignment.insNum);
+                stats[read]->deletions.push_back(alignment.delNum);
+                stats[read]->substitutions.push_back(alignment.substNum);
+            }
+            demultiplexedLines[read].barcodeList.emplace_back(alignment.barcode);
+        }
+    }
+
+    for(size_t read = 0; read < readNum; ++read)
+    {
+        if(!results[read]){continue;}
+        if(stats[read] != nullptr)
+        {
+            if(totalEdits[read] == 0)
+            {
+                ++stats[read]->perfectMatches;
+            }
+            else
+            {
+                ++stats[read]->moderateMatches;
+            }
+        }
+        mmScores[read] = totalEdits[read];
+    }
+}
+
 bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq, 
                                                            BarcodePatternPtr barcodePatterns,
                                                            OneLineDemultiplexingStatsPtr stats,
                                                            DemultiplexedLine& demultiplexedLine,
                                                            unsigned int& barcodePosition,
                                                            int& totalEdits,
-                                                           PatternType type = PatternType::Forward)
+                                                           PatternType type = PatternType::Forward,
+                                                           const int scoreBound = std::numeric_limits<int>::max(),
+                                                           bool* stoppedAtScoreBound = nullptr)
 {
 
     //fastq-read specific variables
@@ -651,12 +832,8 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq,
         ++patternItr)
     {
 
-        //barcode-specific variables
-        std::string barcode = ""; //the actual real barcode that we find (mismatch corrected)
-        int del = 0; 
-        int ins = 0;
-        int subst = 0;
-        int targetEnd = 0;
+        //barcode-specific variables: the actual real barcode that we find (mismatch corrected), its end in the read and the edits
+        BarcodeAlignment alignment;
         ++position;
 
         //if we have mapped to the end of the sequence (but barcodes of the pattern are still missing)
@@ -665,10 +842,10 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq,
         //if we have a wildcard skip this matching, we match again the next sequence
         if((*patternItr)->is_wildcard())
         {
-            (*patternItr)->align(barcode, seq.line, positionInFastqLine, targetEnd, del, ins, subst);
-            positionInFastqLine += (targetEnd);
+            (*patternItr)->align(alignment, seq.line, positionInFastqLine);
+            positionInFastqLine += (alignment.targetEnd);
             ++barcodePosition; //increase the count of found positions
-            demultiplexedLine.barcodeList.push_back(barcode);
+            demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
 
             if(stats != nullptr)
             {       
@@ -722,8 +899,8 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq,
 
         //IF NON OF THE ABOVE - TRY TO MAP PATTERN
 
-        //if we did not match a pattern
-        if(!(*patternItr)->align(barcode,seq.line, positionInFastqLine, targetEnd, del, ins, subst))
+        //if we did not match a pattern (or not with the edits left by the score bound)
+        if(!(*patternItr)->align(alignment, seq.line, positionInFastqLine, false, std::string_view(), scoreBound - 1 - totalEdits))
         {
             //save until where we mapped
             if(stats != nullptr)
@@ -731,26 +908,37 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq,
                 stats->failedLinesMappingFw.first = barcodePatterns->patternName;
                 stats->failedLinesMappingFw.second = position;
             }
+            //the score bound left fewer edits than the barcode allows: the pattern can not beat the best pattern (even if the barcode
+            //would map with all its mismatches), the mapping was stopped by the bound
+            if(stoppedAtScoreBound != nullptr && scoreBound - 1 - totalEdits < (*patternItr)->mismatches){*stoppedAtScoreBound = true;}
             return false;
         }
         
         //std::cout << "ALIGN FW: found " << barcode << " at start " << positionInFastqLine << " with new end " << targetEnd << "\n";
 
-        totalEdits = totalEdits + del + ins + subst;
-        positionInFastqLine += targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
+        totalEdits = totalEdits + alignment.delNum + alignment.insNum + alignment.substNum;
+        positionInFastqLine += alignment.targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
         //positionInFastqLine is the first position to INCLUDE in next alignment
 
-        assert(barcode != "");
+        if(totalEdits >= scoreBound)
+        {
+            ++prunedPatternMappings;
+            prunedBarcodeAlignments += remaining_alignments(patternItr + 1, barcodePatterns->end(type));
+            if(stoppedAtScoreBound != nullptr){*stoppedAtScoreBound = true;}
+            return false;
+        }
+
+        assert(!alignment.barcode.empty());
         if(stats != nullptr)
         {
-            stats->insertions.push_back(ins);
-            stats->deletions.push_back(del);
-            stats->substitutions.push_back(subst);
+            stats->insertions.push_back(alignment.insNum);
+            stats->deletions.push_back(alignment.delNum);
+            stats->substitutions.push_back(alignment.substNum);
         }
 
         //add this match to the BarcodeMapping
         //barcodeMap.emplace_back(std::make_shared<std::string>(mappedBarcode));
-        demultiplexedLine.barcodeList.push_back(barcode);
+        demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
         ++barcodePosition; //increase the count of found positions
     }
 
@@ -758,11 +946,13 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_forward(const fastqLine& seq,
 }
 
 bool MapEachBarcodeSequentiallyPolicyPairwise::map_reverse(const fastqLine& seq, 
+                                                           std::string_view revCompLine,
                                                            BarcodePatternPtr barcodePatterns,
                                                            OneLineDemultiplexingStatsPtr stats,
                                                            DemultiplexedLine& demultiplexedLine,
                                                            unsigned int& barcodePosition,
-                                                           int& totalEdits)
+                                                           int& totalEdits,
+                                                           const int scoreBound)
 {
     //fastq-read specific variables
     unsigned int positionInFastqLine = 0;
@@ -774,12 +964,8 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_reverse(const fastqLine& seq,
         ++patternItr)
     {
 
-        //barcode-specific variables
-        std::string barcode = ""; //the actual real barcode that we find (mismatch corrected)
-        int del = 0; 
-        int ins = 0;
-        int subst = 0;
-        int targetEnd = 0;
+        //barcode-specific variables: the actual real barcode that we find (mismatch corrected), its end in the read and the edits
+        BarcodeAlignment alignment;
         ++position;
 
         //if we have mapped to the end of the sequence (but barcodes of the pattern are still missing)
@@ -788,10 +974,10 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_reverse(const fastqLine& seq,
         //if we have a wildcard skip this matching, we match again the next sequence
         if((*patternItr)->is_wildcard())
         {
-            (*patternItr)->align(barcode, seq.line, positionInFastqLine, targetEnd, del, ins, subst);
-            positionInFastqLine += (targetEnd);
+            (*patternItr)->align(alignment, seq.line, positionInFastqLine);
+            positionInFastqLine += (alignment.targetEnd);
             ++barcodePosition; //increase the count of found positions
-            demultiplexedLine.barcodeList.push_back(barcode);
+            demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
 
             if(stats != nullptr)
             {
@@ -843,7 +1029,7 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_reverse(const fastqLine& seq,
         }
 
         //map each pattern with reverse complement
-        if(!(*patternItr)->align(barcode,seq.line, positionInFastqLine, targetEnd, del, ins, subst, true))
+        if(!(*patternItr)->align(alignment, seq.line, positionInFastqLine, true, revCompLine, scoreBound - 1 - totalEdits))
         {
             //save until where we mapped
             if(stats != nullptr)
@@ -855,21 +1041,28 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::map_reverse(const fastqLine& seq,
         }
         //std::cout << "ALIGN RV: found " << barcode << " at start " << positionInFastqLine << " with new end " << targetEnd << "\n";
 
-        totalEdits = totalEdits + del + ins + subst;
-        positionInFastqLine += targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
+        totalEdits = totalEdits + alignment.delNum + alignment.insNum + alignment.substNum;
+        positionInFastqLine += alignment.targetEnd; //targetEnd is zero indexed alst position in target-sequence that maps to pattern
         //positionInFastqLine is the first position to INCLUDE in next alignment
 
-        assert(barcode != "");
+        if(totalEdits >= scoreBound)
+        {
+            ++prunedPatternMappings;
+            prunedBarcodeAlignments += remaining_alignments(patternItr + 1, barcodePatterns->rend());
+            return false;
+        }
+
+        assert(!alignment.barcode.empty());
         if(stats != nullptr)
         {
-            stats->insertions.push_back(ins);
-            stats->deletions.push_back(del);
-            stats->substitutions.push_back(subst);
+            stats->insertions.push_back(alignment.insNum);
+            stats->deletions.push_back(alignment.delNum);
+            stats->substitutions.push_back(alignment.substNum);
         }
       
         //add this match to the BarcodeMapping
         //barcodeMap.emplace_back(std::make_shared<std::string>(mappedBarcode));
-        demultiplexedLine.barcodeList.push_back(barcode);
+        demultiplexedLine.barcodeList.emplace_back(alignment.barcode);
         ++barcodePosition; //increase the count of found positions
     }
 
@@ -1022,7 +1215,8 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
                                         const input& input,
                                         BarcodePatternPtr barcodePatterns,
                                         int& mmScore,
-                                        OneLineDemultiplexingStatsPtr stats)
+                                        OneLineDemultiplexingStatsPtr stats,
+                                        const int scoreBound)
 {
 
     bool pairwiseMappingSuccess = false;
@@ -1033,7 +1227,15 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
         unsigned int barcodePositionFw = 0;
         int tmpMMScore = 0;
         //for forward read we immediately add barcodes to demultiplexedLine.barcodeList, which is then extended in combine pattern, IF we find all patterns
-        bool forwardSuccess = map_forward(seq.first, barcodePatterns, stats, demultiplexedLine, barcodePositionFw, tmpMMScore);
+        //both reads must map: the reverse read is not mapped if the forward read already fails (or reaches the score bound)
+        bool stoppedAtScoreBound = false;
+        bool forwardSuccess = map_forward(seq.first, barcodePatterns, stats, demultiplexedLine, barcodePositionFw, tmpMMScore,
+                                          PatternType::Forward, scoreBound, &stoppedAtScoreBound);
+        if(!forwardSuccess)
+        {
+            stoppedAtScoreBound ? ++skippedReverseMappingsPruned : ++skippedReverseMappingsFailed;
+            return false;
+        }
 
         DemultiplexedLine demultiplexedLineRv;
         unsigned int barcodePositionRv = 0;
@@ -1046,7 +1248,8 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
         if(stats != nullptr){statsRvPtr = std::make_shared<OneLineDemultiplexingStats>();}
         else{statsRvPtr = nullptr;}
 
-        bool reverseSuccess = map_forward(seq.second, barcodePatterns, statsRvPtr, demultiplexedLineRv,barcodePositionRv, tmpMMScore, PatternType::Reverse);
+        bool reverseSuccess = map_forward(seq.second, barcodePatterns, statsRvPtr, demultiplexedLineRv,barcodePositionRv, tmpMMScore,
+                                          PatternType::Reverse, scoreBound);
 
         if(forwardSuccess && reverseSuccess)
         {
@@ -1091,10 +1294,27 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
         unsigned int barcodePositionFw = 0;
         int tmpMMScore = 0;
         //for forward read we immediately add barcodes to demultiplexedLine.barcodeList, which is then extended in combine pattern, IF we find all patterns
-        map_forward(seq.first, barcodePatterns, stats, demultiplexedLine, barcodePositionFw, tmpMMScore);
+        //the barcodes are aligned with all their mismatches: a barcode that does not map is missing in between the reads (not a failure),
+        //the score bound is only checked for the mapped barcodes
+        const bool forwardSuccess = map_forward(seq.first, barcodePatterns, stats, demultiplexedLine, barcodePositionFw, tmpMMScore);
+        if(tmpMMScore >= scoreBound)
+        {
+            ++prunedPatternMappings;
+            prunedBarcodeAlignments += remaining_alignments(barcodePatterns->rbegin(), barcodePatterns->rend());
+            return false;
+        }
         DemultiplexedLine demultiplexedLineRv;
         unsigned int barcodePositionRv = 0;
 
+        //the forward read maps the whole pattern perfectly: the reverse read could only confirm it
+        if(input.lazyReverseMapping && forwardSuccess && tmpMMScore == 0 && barcodePositionFw == barcodePatterns->size())
+        {
+            ++skippedReverseMappingsComplete;
+            pairwiseMappingSuccess = combine_mapping(barcodePatterns, demultiplexedLine, barcodePositionFw, demultiplexedLineRv, barcodePositionRv, stats, nullptr, tmpMMScore);
+            if(pairwiseMappingSuccess){mmScore = tmpMMScore;}
+            return pairwiseMappingSuccess;
+        }
+
     //  std::cout << "FOUND FOWARD: ";
     //  for(auto el : demultiplexedLine.barcodeList)
     //  {
@@ -1110,7 +1330,23 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
         if(stats != nullptr){statsRvPtr = std::make_shared<OneLineDemultiplexingStats>();}
         else{statsRvPtr = nullptr;}
         
-        map_reverse(seq.second, barcodePatterns, statsRvPtr, demultiplexedLineRv,barcodePositionRv, tmpMMScore);
+        //reverse complement of the whole reverse read (once per read, in a buffer of the thread), reads with other bases
+        //than ACGTN are mapped without it
+        std::string_view revCompLine;
+        if(input.orientReverseRead)
+        {
+            static thread_local std::string revCompBuffer;
+            revCompBuffer.resize(seq.second.line.size());
+            if(reverse_complement(seq.second.line, &revCompBuffer[0])){revCompLine = revCompBuffer;}
+        }
+
+        map_reverse(seq.second, revCompLine, barcodePatterns, statsRvPtr, demultiplexedLineRv,barcodePositionRv, tmpMMScore,
+                    std::numeric_limits<int>::max());
+        if(tmpMMScore >= scoreBound)
+        {
+            ++prunedPatternMappings;
+            return false;
+        }
 
     // std::cout << "FOUND REVERSE: ";
     // for(auto el : demultiplexedLineRv.barcodeList)
@@ -1127,34 +1363,51 @@ bool MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(
     return (pairwiseMappingSuccess);
 }
 
+void MapEachBarcodeSequentiallyPolicyPairwise::split_lines_into_barcode_patterns(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                                        std::vector<DemultiplexedLine>& demultiplexedLines, const input& input, 
+                                        BarcodePatternPtr barcodePatterns,
+                                        std::vector<int>& mmScores, std::vector<bool>& results,
+                                        const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                                        const std::vector<int>& scoreBounds)
+{
+    results.assign(seqs.size(), false);
+    for(size_t read = 0; read < seqs.size(); ++read)
+    {
+        results[read] = split_line_into_barcode_patterns(*seqs[read], demultiplexedLines[read], input, barcodePatterns,
+                                                         mmScores[read], stats[read], scoreBounds[read]);
+    }
+}
+
 template <typename MappingPolicy, typename FilePolicy>
 bool Mapping<MappingPolicy, FilePolicy>::demultiplex_read(const std::pair<fastqLine, fastqLine>& seq, 
                                                           DemultiplexedLine& demultiplexedLine,
                                                           BarcodePatternPtr pattern,
                                                           const input& input, 
-                                                          const unsigned long long& count, const unsigned long long& totalReadCount,
                                                           int& mmScore,
-                                                          OneLineDemultiplexingStatsPtr stats)
+                                                          OneLineDemultiplexingStatsPtr stats,
+                                                          const int scoreBound)
 {
     //split line into patterns (barcodeMap, barcodePatters, stats are passed as reference or ptr)
     //and can be read by each thread, "addValue" method for barcodeMap is thread safe also for concurrent writing
     bool result;
 
     //demultipelxed barcodes are stored in barcodeMap
-    result = this->split_line_into_barcode_patterns(seq, demultiplexedLine, input, pattern, mmScore, stats);
-
-    //update status bar
-    unsigned long long step = (totalReadCount + 50) / 100;
-    if (step > 0 && count % step == 0 && totalReadCount != ULLONG_MAX && count < totalReadCount) //update at every 1,000th entry
-    {
-        double perc = count/(double)totalReadCount;
-        std::lock_guard<std::mutex> guard(*printProgressLock);
-        printProgress(perc);
-    }
+    result = this->split_line_into_barcode_patterns(seq, demultiplexedLine, input, pattern, mmScore, stats, scoreBound);
 
     return(result);
 }
 
+template <typename MappingPolicy, typename FilePolicy>
+void Mapping<MappingPolicy, FilePolicy>::demultiplex_reads(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                                                           std::vector<DemultiplexedLine>& demultiplexedLines,
+                                                           BarcodePatternPtr pattern,
+                                                           const input& input, 
+                                                           std::vector<int>& mmScores, std::vector<bool>& results,
+                                                           const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                                                           const std::vector<int>& scoreBounds)
+{
+    this->split_lines_into_barcode_patterns(seqs, demultiplexedLines, input, pattern, mmScores, results, stats, scoreBounds);
+}
 
 //THIS POLICY IS FOR NOW DISABLED, IT NEEEDS MAYOR CHANGES AFTER USING NEW ALIGNER AND IS NO LONGER SUPPORTED
 /*
@@ -1270,9 +1523,96 @@ bool MapAroundConstantBarcodesAsAnchorPolicy::split_line_into_barcode_patterns(c
 }
 */
 
+bool MapMergedReadPairsPolicy::merge_pair(const std::pair<fastqLine, fastqLine>& seq, std::pair<fastqLine, fastqLine>& mergedSeq)
+{
+    const bool merged = ReadPairMerger::merge(seq.first, seq.second, mergedSeq.first);
+    merged ? ++mergedReadPairs : ++unmergedReadPairs;
+    return merged;
+}
+
+bool MapMergedReadPairsPolicy::is_mergeable(const BarcodePatternPtr& barcodePatterns)
+{
+    //patterns that end in one read or contain DNA are split between the reads: they can not be mapped on the merged read
+    if(barcodePatterns->containsDNA){return false;}
+    for(const BarcodePtr& barcode : *(barcodePatterns->barcodePattern))
+    {
+        if(barcode->is_stop() || barcode->is_read_end() || barcode->is_dna()){return false;}
+    }
+    return true;
+}
+
+bool MapMergedReadPairsPolicy::split_line_into_barcode_patterns(const std::pair<fastqLine, fastqLine>& seq, 
+                                        const std::pair<fastqLine, fastqLine>* mergedSeq,
+                                        DemultiplexedLine& demultiplexedLine,
+                                        const input& input,
+                                        BarcodePatternPtr barcodePatterns,
+                                        int& mmScore,
+                                        OneLineDemultiplexingStatsPtr stats,
+                                        const int scoreBound)
+{
+    if(mergedSeq == nullptr || !is_mergeable(barcodePatterns))
+    {
+        return MapEachBarcodeSequentiallyPolicyPairwise::split_line_into_barcode_patterns(seq, demultiplexedLine, input, barcodePatterns,
+                                                                                           mmScore, stats, scoreBound);
+    }
+    return MapEachBarcodeSequentiallyPolicy::split_line_into_barcode_patterns(*mergedSeq, demultiplexedLine, input, barcodePatterns,
+                                                                               mmScore, stats, scoreBound);
+}
+
+void MapMergedReadPairsPolicy::split_lines_into_barcode_patterns(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                                        const std::vector<const std::pair<fastqLine, fastqLine>*>& mergedSeqs,
+                                        std::vector<DemultiplexedLine>& demultiplexedLines, const input& input, 
+                                        BarcodePatternPtr barcodePatterns,
+                                        std::vector<int>& mmScores, std::vector<bool>& results,
+                                        const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                                        const std::vector<int>& scoreBounds)
+{
+    results.assign(seqs.size(), false);
+    for(size_t read = 0; read < seqs.size(); ++read)
+    {
+        results[read] = split_line_into_barcode_patterns(*seqs[read], mergedSeqs[read], demultiplexedLines[read], input, barcodePatterns,
+                                                         mmScores[read], stats[read], scoreBounds[read]);
+    }
+}
+
+bool MapMergedReadPairsPolicy::split_line_into_barcode_patterns(const std::pair<fastqLine, fastqLine>& seq, 
+                                        DemultiplexedLine& demultiplexedLine,
+                                        const input& input,
+                                        BarcodePatternPtr barcodePatterns,
+                                        int& mmScore,
+                                        OneLineDemultiplexingStatsPtr stats,
+                                        const int scoreBound)
+{
+    std::pair<fastqLine, fastqLine> mergedSeq;
+    const bool merged = is_mergeable(barcodePatterns) && ReadPairMerger::merge(seq.first, seq.second, mergedSeq.first);
+    return split_line_into_barcode_patterns(seq, merged ? &mergedSeq : nullptr, demultiplexedLine, input, barcodePatterns,
+                                            mmScore, stats, scoreBound);
+}
+
+void MapMergedReadPairsPolicy::split_lines_into_barcode_patterns(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                                        std::vector<DemultiplexedLine>& demultiplexedLines, const input& input, 
+                                        BarcodePatternPtr barcodePatterns,
+                                        std::vector<int>& mmScores, std::vector<bool>& results,
+                                        const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                                        const std::vector<int>& scoreBounds)
+{
+    results.assign(seqs.size(), false);
+    for(size_t read = 0; read < seqs.size(); ++read)
+    {
+        results[read] = split_line_into_barcode_patterns(*seqs[read], demultiplexedLines[read], input, barcodePatterns,
+                                                         mmScores[read], stats[read], scoreBounds[read]);
+    }
+}
+
 template class Mapping<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromFastqFilePolicy>;
 template class Mapping<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromFastqFilePolicyPairedEnd>;
+template class Mapping<MapMergedReadPairsPolicy, ExtractLinesFromFastqFilePolicyPairedEnd>;
 template class Mapping<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromTxtFilesPolicy>;
+#ifdef WITH_HTSLIB
+template class Mapping<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromBamFilePolicy>;
+template class Mapping<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromBamFilePolicy>;
+template class Mapping<MapMergedReadPairsPolicy, ExtractLinesFromBamFilePolicy>;
+#endif
 
 //ANCHOR POLICIES ARE NOT LONGER SUPPORTED, LAST WORKING COMMIT IS BEFORE MERGE OF MULTIPATTERN BRANCH
 //template class Mapping<MapAroundConstantBarcodesAsAnchorPolicy, ExtractLinesFromTxtFilesPolicy>;
@@ -18,13 +18,38 @@
 #include <cmath>
 #include <unordered_map>
 #include <filesystem>
+#include <limits>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
 
 #include "seqtk/kseq.h"
 #include "dataTypes.hpp"
 #include "DemultiplexedLine.hpp"
 #include "DemultiplexedStatistics.hpp"
-
-KSEQ_INIT(gzFile, gzread)
+#include "ReadPairMerging.hpp"
+#include "DecompressedInputStream.hpp"
+#include "MappedInputFile.hpp"
+#ifdef WITH_HTSLIB
+#include <htslib/sam.h>
+#include <htslib/bgzf.h>
+#endif
+
+KSEQ_INIT(DecompressedInputStream*, read_decompressed_input)
+
+//branch and bound over the patterns of a read: a pattern is only mapped until its edits reach the score bound
+//(the best score of another pattern), these counters sum up (over all threads) how many pattern mappings were stopped
+//and how many barcode alignments were skipped by it
+inline std::atomic<unsigned long long> prunedPatternMappings(0);
+inline std::atomic<unsigned long long> prunedBarcodeAlignments(0);
+//paired-end reads whose reverse read was not mapped: the forward read already mapped the whole pattern without edits (lazy reverse
+//mapping) or, in detached mode, the forward read failed or its mapping was stopped at the score bound (it can not beat the best pattern)
+inline std::atomic<unsigned long long> skippedReverseMappingsComplete(0);
+inline std::atomic<unsigned long long> skippedReverseMappingsFailed(0);
+inline std::atomic<unsigned long long> skippedReverseMappingsPruned(0);
+//paired-end reads that were merged into one read before mapping, and pairs that do not overlap (mapped as pairs)
+inline std::atomic<unsigned long long> mergedReadPairs(0);
+inline std::atomic<unsigned long long> unmergedReadPairs(0);
 
 /** @brief mapping sequentially each barcode leaving no pattern out,
  *if a pattern can not be found the read is discarded
@@ -32,11 +57,22 @@ KSEQ_INIT(gzFile, gzread)
 class MapEachBarcodeSequentiallyPolicy
 {
     public:
+        //scoreBound: the mapping fails as soon as the edits reach this bound (the pattern can not beat another pattern anymore)
         bool split_line_into_barcode_patterns(
             const std::pair<fastqLine, fastqLine>& seq, 
             DemultiplexedLine& demultiplexedLine, const input& input,
             BarcodePatternPtr barcodePatterns, 
-            int& mmScore, OneLineDemultiplexingStatsPtr stats);
+            int& mmScore, OneLineDemultiplexingStatsPtr stats,
+            const int scoreBound);
+        //same as split_line_into_barcode_patterns for a batch of reads: every barcode is mapped for all reads
+        //before the next one (constant barcodes are aligned to all reads at once), reads that fail are dropped
+        void split_lines_into_barcode_patterns(
+            const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+            std::vector<DemultiplexedLine>& demultiplexedLines, const input& input,
+            BarcodePatternPtr barcodePatterns, 
+            std::vector<int>& mmScores, std::vector<bool>& results,
+            const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+            const std::vector<int>& scoreBounds);
 };
 
 /** @brief like the sequential barcode mapping policy, for paired-end reads
@@ -44,19 +80,25 @@ class MapEachBarcodeSequentiallyPolicy
 class MapEachBarcodeSequentiallyPolicyPairwise
 {
     private:
+        //stoppedAtScoreBound (if set) is set when the mapping fails because of the score bound and not a missing barcode
         bool map_forward(const fastqLine& seq,
                         BarcodePatternPtr barcodePatterns,
                         OneLineDemultiplexingStatsPtr stats,
                         DemultiplexedLine& demultiplexedLine,
                         unsigned int& barcodePosition,
                         int& score_sum,
-                        PatternType type);
+                        PatternType type,
+                        const int scoreBound,
+                        bool* stoppedAtScoreBound);
+        //revCompLine is the reverse complement of the read (empty if not used)
         bool map_reverse(const fastqLine& seq, 
+                        std::string_view revCompLine,
                         BarcodePatternPtr barcodePatterns,
                         OneLineDemultiplexingStatsPtr stats,
                         DemultiplexedLine& demultiplexedLine,
                         unsigned int& barcodePosition,
-                        int& score_sum);
+                        int& score_sum,
+                        const int scoreBound);
         bool combine_mapping(const BarcodePatternPtr& barcodePatterns,
                              DemultiplexedLine& demultiplexedLineFw, //this list is extended to real list
                              const unsigned int& barcodePositionFw,
@@ -71,7 +113,67 @@ class MapEachBarcodeSequentiallyPolicyPairwise
             DemultiplexedLine& demultiplexedLine,
             const input& input, 
             BarcodePatternPtr barcodePatterns, int& mmScore,
-            OneLineDemultiplexingStatsPtr stats);
+            OneLineDemultiplexingStatsPtr stats,
+            const int scoreBound);
+        //paired-end reads of a batch are mapped one by one
+        void split_lines_into_barcode_patterns(
+            const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+            std::vector<DemultiplexedLine>& demultiplexedLines, const input& input,
+            BarcodePatternPtr barcodePatterns, 
+            std::vector<int>& mmScores, std::vector<bool>& results,
+            const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+            const std::vector<int>& scoreBounds);
+};
+
+/** @brief paired-end reads whose forward and reverse read overlap are merged into one read first (ReadPairMerger)
+ * and mapped like a single read with MapEachBarcodeSequentiallyPolicy: the barcodes in the overlap are aligned only once.
+ * Pairs that do not overlap and patterns with a stop [*], read-end [-] or DNA (their parts are in different reads)
+ * are mapped like MapEachBarcodeSequentiallyPolicyPairwise
+ **/
+class MapMergedReadPairsPolicy : private MapEachBarcodeSequentiallyPolicy, private MapEachBarcodeSequentiallyPolicyPairwise
+{
+    public:
+        //merges the reads of a pair into the forward read of mergedSeq (and counts the pair as merged or not merged),
+        //the Demultiplexer merges every pair once before it is mapped to its patterns
+        static bool merge_pair(const std::pair<fastqLine, fastqLine>& seq, std::pair<fastqLine, fastqLine>& mergedSeq);
+        //the pattern can be mapped on the merged read: it has no stop, read-end or DNA
+        static bool is_mergeable(const BarcodePatternPtr& barcodePatterns);
+
+        //maps the merged read mergedSeq of the pair (nullptr if the reads do not overlap) or the pair itself
+        //if the pattern can not be mapped on the merged read
+        bool split_line_into_barcode_patterns(
+            const std::pair<fastqLine, fastqLine>& seq,  
+            const std::pair<fastqLine, fastqLine>* mergedSeq,
+            DemultiplexedLine& demultiplexedLine,
+            const input& input, 
+            BarcodePatternPtr barcodePatterns, int& mmScore,
+            OneLineDemultiplexingStatsPtr stats,
+            const int scoreBound);
+        //paired-end reads of a batch (and their merged reads) are mapped one by one
+        void split_lines_into_barcode_patterns(
+            const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+            const std::vector<const std::pair<fastqLine, fastqLine>*>& mergedSeqs,
+            std::vector<DemultiplexedLine>& demultiplexedLines, const input& input,
+            BarcodePatternPtr barcodePatterns, 
+            std::vector<int>& mmScores, std::vector<bool>& results,
+            const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+            const std::vector<int>& scoreBounds);
+
+        //interface of all policies: the pair is merged for this pattern only (and not counted)
+        bool split_line_into_barcode_patterns(
+            const std::pair<fastqLine, fastqLine>& seq,  
+            DemultiplexedLine& demultiplexedLine,
+            const input& input, 
+            BarcodePatternPtr barcodePatterns, int& mmScore,
+            OneLineDemultiplexingStatsPtr stats,
+            const int scoreBound);
+        void split_lines_into_barcode_patterns(
+            const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+            std::vector<DemultiplexedLine>& demultiplexedLines, const input& input,
+            BarcodePatternPtr barcodePatterns, 
+            std::vector<int>& mmScores, std::vector<bool>& results,
+            const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+            const std::vector<int>& scoreBounds);
 };
 
 /**
@@ -96,47 +198,33 @@ class MapAroundConstantBarcodesAsAnchorPolicy
 class ExtractLinesFromTxtFilesPolicy
 {
     public:
-    void init_file(const std::string& fwFile, const std::string& rvFile)
+    void init_file(const std::string& fwFile, const std::string& rvFile, const int threads = 1)
     {       
         (void)rvFile; //we have only a forward fastq-read
+        totalBytes = fileSize(fwFile);
+
+        //the file is memory mapped and parsed by several threads (read as stream if it can not be mapped)
+        mappedFile = std::make_unique<MappedInputFile>();
+        if(mappedFile->open(fwFile, MappedInputFile::Format::Lines, threads)){return;}
+        mappedFile.reset();
 
         //no error handling for txt file right now
         fileStream.open(fwFile, std::ios::in);
 
-        //check if file can be opened & count lines
-        if (fileStream.is_open()) 
-        {
-            fileStream.seekg(0);
-            //counting newlines for proxy of read number
-            totalReads = std::count(std::istreambuf_iterator<char>(fileStream),
-                                    std::istreambuf_iterator<char>(), '\n');
-                                        // Check last character (only if file isn't empty)
-            //if the last line has no newline add +1
-            if (fileStream.tellg() > 0) 
-            {
-                fileStream.clear(); // Clear EOF flag
-                fileStream.seekg(-1, std::ios::end);
-                char lastChar;
-                fileStream.get(lastChar);
-                if (lastChar != '\n') {
-                    totalReads += 1;
-                }
-            }
-        } 
-        else 
+        //check if file can be opened (the file is read only once, progress is the position in the file)
+        if (!fileStream.is_open()) 
         {
             std::cerr << "Error opening input txt-file!" << std::endl;
             exit(EXIT_FAILURE);
         }
-
-        fileStream.clear();
-        fileStream.seekg(0);
     }
 
     //for txt files we assume every line contains a line of bases
     //quality and read names DO NOT exist
     bool get_next_line(std::pair<fastqLine, fastqLine>& line)
     {   
+        if(mappedFile){return mappedFile->next_read(line.first);}
+
         bool returnValue = true;
         if(!std::getline(fileStream, line.first.line))
         {
@@ -152,16 +240,24 @@ class ExtractLinesFromTxtFilesPolicy
 
     void close_file()
     {
-        fileStream.close();
+        if(mappedFile){mappedFile->close();}
+        else{fileStream.close();}
     }
 
-    unsigned long long get_read_number()
+    //bytes of the file that were read so far and the size of the file
+    long long get_bytes_read()
+    {
+        if(mappedFile){return mappedFile->bytes_read();}
+        return static_cast<long long>(fileStream.tellg());
+    }
+    unsigned long long get_file_size()
     {
-        return totalReads;
+        return totalBytes;
     }
     
     std::ifstream fileStream;
-    unsigned long long totalReads;
+    std::unique_ptr<MappedInputFile> mappedFile;
+    unsigned long long totalBytes = 0;
 };
 
 ///parser policy for fastq(.gz) files
@@ -169,37 +265,40 @@ class ExtractLinesFromFastqFilePolicy
 {
     public:
 
-    void init_file(const std::string& fwFile, const std::string& rvFile)
+    //uncompressed files are memory mapped and parsed by several threads, compressed files are decompressed in their own threads
+    //(threads is the number of threads for parsing or for BGZF files)
+    void init_file(const std::string& fwFile, const std::string& rvFile, const int threads = 1)
     {
         (void)rvFile; //we have only a forward fastq-read
+        //progress is the (compressed) offset in the file: the file is read only once
+        totalBytes = fileSize(fwFile);
 
-        fp = gzopen(fwFile.c_str(),"r");
-        if(fp == Z_NULL)
+        if(DecompressedInputStream::is_uncompressed(fwFile))
+        {
+            mappedFile = std::make_unique<MappedInputFile>();
+            if(mappedFile->open(fwFile, MappedInputFile::Format::Fastq, threads)){return;}
+            mappedFile.reset();
+        }
+
+        fp = std::make_unique<DecompressedInputStream>();
+        if(!fp->open(fwFile, threads))
         {
             std::string errMess = "Invalid file: " + fwFile;
             throw std::domain_error(errMess);
             exit(EXIT_FAILURE);
         }
-        ks = kseq_init(fp);
-        totalReads = 0;
-        std::pair<fastqLine, fastqLine> line;
-        while(get_next_line(line))
-        {
-            if(totalReads == ULLONG_MAX)
-            {
-                std::cout << "WARNING: Analysing more than " << std::to_string(ULLONG_MAX) << " reads. There will be no status update\n";
-                gzrewind(fp);
-                ks = kseq_init(fp);
-                return;
-            }
-            ++totalReads;
-        }
-        gzrewind(fp);
-        ks = kseq_init(fp);
+        ks = kseq_init(fp.get());
     }
 
     bool get_next_line(std::pair<fastqLine, fastqLine>& line, bool reverse = false)
     {
+        return get_next_read(reverse ? line.second : line.first);
+    }
+
+    //the read is copied into the strings of read, which keep their memory (read is reused for the next reads)
+    bool get_next_read(fastqLine& read)
+    {
+        if(mappedFile){return mappedFile->next_read(read);}
         if(kseq_read(ks) < 0)
         {
             if(strlen(ks->seq.s) != strlen(ks->qual.s))
@@ -212,70 +311,363 @@ class ExtractLinesFromFastqFilePolicy
             }
             return false;
         }
-        if(!reverse)
-        {
-            line.first.line = std::string(ks->seq.s);
-            line.first.quality = std::string(ks->qual.s);
-            line.first.name = std::string(ks->name.s);
-        }
-        else
-        {
-            line.second.line = std::string(ks->seq.s);
-            line.second.quality = std::string(ks->qual.s);
-            line.second.name = std::string(ks->name.s);
-        }
+        read.line.assign(ks->seq.s, ks->seq.l);
+        read.quality.assign(ks->qual.s, ks->qual.l);
+        read.name.assign(ks->name.s, ks->name.l);
         return true;
     }
 
     void close_file()
     {
+        if(mappedFile)
+        {
+            mappedFile->close();
+            return;
+        }
         kseq_destroy(ks);
-        gzclose(fp);
+        fp->close();
     }
 
-    unsigned long long get_read_number()
+    //compressed bytes of the file that were read so far and the size of the file
+    long long get_bytes_read()
     {
-        return totalReads;
+        if(mappedFile){return mappedFile->bytes_read();}
+        return fp->compressed_offset();
+    }
+    unsigned long long get_file_size()
+    {
+        return totalBytes;
     }
 
     kseq_t* ks;
-    unsigned long long totalReads;
-    gzFile fp;
+    unsigned long long totalBytes = 0;
+    std::unique_ptr<DecompressedInputStream> fp;
+    std::unique_ptr<MappedInputFile> mappedFile;
+
+};
+
+//parses a fastq file in its own thread into batches of reads (for paired-end reads both files are parsed concurrently).
+//Batches are recycled: the reader gets the next batch and returns the previous one to the parsing thread
+class ConcurrentFastqReader
+{
+    public:
+        static const size_t batchReads = 4096; //even: interleaved read pairs are in the same batch
+        static const size_t batchNum = 4;
+
+        ~ConcurrentFastqReader(){if(parsingThread.joinable()){close_file();}}
+
+        void init_file(const std::string& file, const int threads)
+        {
+            fileManager.init_file(file, "", threads);
+            parsingThread = std::thread(&ConcurrentFastqReader::parse, this);
+        }
+
+        //next batch of reads (with less than batchReads reads at the end of the file)
+        std::vector<fastqLine>& next_batch(size_t& readNum)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(currentBatch >= 0){freeBatches.push_back(currentBatch);}
+            batchesChanged.notify_all();
+            batchesChanged.wait(lock, [this](){return !readyBatches.empty() || parsingDone;});
+            if(readyBatches.empty())
+            {
+                currentBatch = -1;
+                readNum = 0;
+                return emptyBatch;
+            }
+            currentBatch = readyBatches.front().first;
+            readNum = readyBatches.front().second;
+            readyBatches.pop_front();
+            return batches[currentBatch];
+        }
+
+        void close_file()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            batchesChanged.notify_all();
+            if(parsingThread.joinable()){parsingThread.join();}
+            fileManager.close_file();
+        }
+
+        long long get_bytes_read(){return fileManager.get_bytes_read();}
+        unsigned long long get_file_size(){return fileManager.get_file_size();}
+
+    private:
+        void parse()
+        {
+            bool fileEnd = false;
+            while(!fileEnd)
+            {
+                int batchIdx;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    batchesChanged.wait(lock, [this](){return !freeBatches.empty() || stop;});
+                    if(stop){break;}
+                    batchIdx = freeBatches.back();
+                    freeBatches.pop_back();
+                }
 
+                std::vector<fastqLine>& batch = batches[batchIdx];
+                batch.resize(batchReads);
+                size_t readNum = 0;
+                while(readNum < batchReads && fileManager.get_next_read(batch[readNum])){++readNum;}
+                fileEnd = (readNum < batchReads);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    readyBatches.emplace_back(batchIdx, readNum);
+                }
+                batchesChanged.notify_all();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                parsingDone = true;
+            }
+            batchesChanged.notify_all();
+        }
+
+        ExtractLinesFromFastqFilePolicy fileManager;
+        std::thread parsingThread;
+
+        std::mutex mutex;
+        std::condition_variable batchesChanged;
+        std::vector<fastqLine> batches[batchNum];
+        std::vector<int> freeBatches = {0, 1, 2, 3};
+        std::deque<std::pair<int, size_t>> readyBatches; //batch and its number of reads
+        int currentBatch = -1; //batch of the reader
+        std::vector<fastqLine> emptyBatch;
+        bool parsingDone = false;
+        bool stop = false;
 };
 
+//paired-end reads: forward and reverse reads are parsed concurrently into batches, the pairs of a batch are taken one by one
+//(their strings are swapped into line). The read names of a batch are compared when the batch is taken.
+//Interleaved fastq files (forward and reverse read of a pair are consecutive records) are given as the same forward and reverse file:
+//the pairs are then taken from the batches of one file (batches have an even number of reads, pairs are never split).
 class ExtractLinesFromFastqFilePolicyPairedEnd
 {
 
     public:
-        void init_file(const std::string& fwFile, const std::string& rvFile)
+        void init_file(const std::string& fwFile, const std::string& rvFile, const int threads = 1)
         {
-            fwFileManager.init_file(fwFile, "");
-            rvFileManager.init_file(rvFile, "");
+            interleaved = (fwFile == rvFile);
+            fwReader.init_file(fwFile, threads);
+            if(!interleaved){rvReader.init_file(rvFile, threads);}
         }
 
         bool get_next_line(std::pair<fastqLine, fastqLine>& line)
         {
-            bool fwBool = fwFileManager.get_next_line(line);
-            bool rvBool = rvFileManager.get_next_line(line, true);
-            return(fwBool&&rvBool);
+            if(position == pairNum)
+            {
+                if(!next_batches()){return false;}
+            }
+            std::swap(line.first, (*fwBatch)[fw_index(position)]);
+            std::swap(line.second, (*rvBatch)[rv_index(position)]);
+            ++position;
+            return true;
         }
 
         void close_file()
         {
-            fwFileManager.close_file();
-            rvFileManager.close_file();
+            fwReader.close_file();
+            if(!interleaved){rvReader.close_file();}
+        }
+
+        //both files are read in lockstep: the progress of the forward file is the progress of the pairs
+        long long get_bytes_read()
+        {
+            return(fwReader.get_bytes_read());
+        }
+        unsigned long long get_file_size()
+        {
+            return(fwReader.get_file_size());
+        }
+
+    private:
+        //takes the next batches of both files and checks that they contain the same reads
+        bool next_batches()
+        {
+            size_t fwReadNum = 0;
+            size_t rvReadNum = 0;
+            fwBatch = &fwReader.next_batch(fwReadNum);
+            if(interleaved)
+            {
+                rvBatch = fwBatch;
+                rvReadNum = fwReadNum / 2;
+                fwReadNum -= rvReadNum;
+            }
+            else
+            {
+                rvBatch = &rvReader.next_batch(rvReadNum);
+            }
+            if(mateMissing){return false;}
+            if(fwReadNum != rvReadNum)
+            {
+                std::cerr << "WARNING: forward and reverse read files have a different number of reads, the reads without mate are not mapped\n";
+                mateMissing = true;
+            }
+            pairNum = std::min(fwReadNum, rvReadNum);
+            position = 0;
+
+            for(size_t read = 0; read < pairNum; ++read)
+            {
+                const fastqLine& fwRead = (*fwBatch)[fw_index(read)];
+                const fastqLine& rvRead = (*rvBatch)[rv_index(read)];
+                if(!same_read_name(fwRead.name, rvRead.name))
+                {
+                    std::cerr << "Error: forward and reverse reads are not in the same order (forward read: " << fwRead.name 
+                              << ", reverse read: " << rvRead.name << ")\n";
+                    exit(EXIT_FAILURE);
+                }
+            }
+            return(pairNum > 0);
+        }
+
+        //position of the forward and reverse read of a pair in their batches
+        size_t fw_index(const size_t pair) const {return(interleaved ? 2*pair : pair);}
+        size_t rv_index(const size_t pair) const {return(interleaved ? 2*pair + 1 : pair);}
+
+        //names of mates are the same, except for an optional /1 and /2 at the end
+        static bool same_read_name(const std::string& fwName, const std::string& rvName)
+        {
+            if(fwName == rvName){return true;}
+            const size_t length = fwName.size();
+            return(length >= 2 && rvName.size() == length && fwName.compare(length - 2, 2, "/1") == 0 && 
+                   rvName.compare(length - 2, 2, "/2") == 0 && fwName.compare(0, length - 2, rvName, 0, length - 2) == 0);
+        }
+
+        ConcurrentFastqReader fwReader;
+        ConcurrentFastqReader rvReader;
+        std::vector<fastqLine>* fwBatch = nullptr;
+        std::vector<fastqLine>* rvBatch = nullptr;
+        size_t position = 0;
+        size_t pairNum = 0;
+        bool mateMissing = false;
+        bool interleaved = false;
+};
+
+#ifdef WITH_HTSLIB
+//parser policy for unaligned BAM/CRAM files (only built with htslib: make demultiplex HTSLIB=1). htslib decompresses the file with
+//several threads. Paired-end reads are consecutive records with the flags READ1 and READ2, the reverse file is then the same file as
+//the forward file (see is_paired). Secondary and supplementary records are skipped, records on the reverse strand (aligned BAM files)
+//are reverse complemented back into the orientation of the sequencer.
+class ExtractLinesFromBamFilePolicy
+{
+    public:
+    void init_file(const std::string& fwFile, const std::string& rvFile, const int threads = 1)
+    {
+        pairedEnd = !rvFile.empty();
+        totalBytes = fileSize(fwFile);
+        open_bam(fwFile, threads, fp, header);
+        record = bam_init1();
+    }
+
+    bool get_next_line(std::pair<fastqLine, fastqLine>& line)
+    {
+        if(!pairedEnd){return next_record(line.first);}
+
+        if(!next_record(line.first)){return false;}
+        const bool fwFirst = record->core.flag & BAM_FREAD1;
+        if(!next_record(line.second) || !fwFirst || !(record->core.flag & BAM_FREAD2) || line.first.name != line.second.name)
+        {
+            std::cerr << "Error: paired-end reads in BAM/CRAM files must be consecutive records with the flags READ1 and READ2 "
+                      << "and the same name (read: " << line.first.name << ")\n";
+            exit(EXIT_FAILURE);
+        }
+        return true;
+    }
+
+    void close_file()
+    {
+        bam_destroy1(record);
+        sam_hdr_destroy(header);
+        sam_close(fp);
+    }
+
+    //compressed bytes of the file that were read so far (no progress for CRAM files) and the size of the file
+    long long get_bytes_read()
+    {
+        if(fp->format.format != bam){return -1;}
+        return static_cast<long long>(bgzf_tell(fp->fp.bgzf) >> 16);
+    }
+    unsigned long long get_file_size()
+    {
+        return totalBytes;
+    }
+
+    //true if the first primary record of the file is part of a read pair
+    static bool is_paired(const std::string& fileName)
+    {
+        samFile* file = nullptr;
+        sam_hdr_t* fileHeader = nullptr;
+        open_bam(fileName, 1, file, fileHeader);
+        bam1_t* firstRecord = bam_init1();
+        bool paired = false;
+        while(sam_read1(file, fileHeader, firstRecord) >= 0)
+        {
+            if(firstRecord->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)){continue;}
+            paired = firstRecord->core.flag & BAM_FPAIRED;
+            break;
         }
+        bam_destroy1(firstRecord);
+        sam_hdr_destroy(fileHeader);
+        sam_close(file);
+        return paired;
+    }
 
-        unsigned long long get_read_number()
+    private:
+    static void open_bam(const std::string& fileName, const int threads, samFile*& file, sam_hdr_t*& fileHeader)
+    {
+        file = sam_open(fileName.c_str(), "r");
+        if(file == nullptr || (fileHeader = sam_hdr_read(file)) == nullptr)
         {
-            assert(fwFileManager.get_read_number() == rvFileManager.get_read_number());
-            return(fwFileManager.get_read_number());
+            std::cerr << "Error opening input BAM/CRAM file: " << fileName << "\n";
+            exit(EXIT_FAILURE);
         }
+        if(threads > 1){hts_set_threads(file, threads);}
+    }
 
-        ExtractLinesFromFastqFilePolicy fwFileManager;
-        ExtractLinesFromFastqFilePolicy rvFileManager;
+    //decodes the next primary record into read (the strings keep their memory), false at the end of the file
+    bool next_record(fastqLine& read)
+    {
+        int result;
+        while((result = sam_read1(fp, header, record)) >= 0 && (record->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY))){}
+        if(result < -1)
+        {
+            std::cerr << "Error: truncated or corrupt record in the input BAM/CRAM file\n";
+            exit(EXIT_FAILURE);
+        }
+        if(result < 0){return false;}
+
+        const int length = record->core.l_qseq;
+        const uint8_t* sequence = bam_get_seq(record);
+        const uint8_t* quality = bam_get_qual(record);
+        const bool reverse = record->core.flag & BAM_FREVERSE;
+        //qualities are missing if the first one is 0xff
+        const bool withQuality = length > 0 && quality[0] != 0xff;
+        read.name.assign(bam_get_qname(record));
+        read.line.resize(length);
+        read.quality.resize(withQuality ? length : 0);
+        for(int i = 0; i < length; ++i)
+        {
+            const int position = reverse ? length - 1 - i : i;
+            const char base = seq_nt16_str[bam_seqi(sequence, i)];
+            const char complement = complementTable[static_cast<unsigned char>(base)];
+            read.line[position] = reverse ? (complement ? complement : 'N') : base;
+            if(withQuality){read.quality[position] = static_cast<char>(quality[i] + 33);}
+        }
+        return true;
+    }
+
+    samFile* fp = nullptr;
+    sam_hdr_t* header = nullptr;
+    bam1_t* record = nullptr;
+    bool pairedEnd = false;
+    unsigned long long totalBytes = 0;
 };
+#endif
 
 /** @brief generic class for the barcode mapping
  * @param MappingPolicy: the policy used to map one barcode after the other, probably mostly used one should be
@@ -291,9 +683,6 @@ class Mapping : protected MappingPolicy, protected FilePolicy
         ///explicit costructor to initiate the uniqueCharSet for the barcodes in DemultiplexedReads
         Mapping()
         {
-
-            //lock to write progress in terminal
-            printProgressLock = std::make_unique<std::mutex>();
             barcodePatternList = std::make_shared<std::vector<BarcodePatternPtr>>();
         }
 
@@ -303,8 +692,6 @@ class Mapping : protected MappingPolicy, protected FilePolicy
         void parse_barcode_data(const input& input, std::vector<std::pair<std::string, char> >& patterns, std::vector<int>& mismatches, 
                                 std::vector<std::vector<std::string> >& varyingBarcodes);
 
-        //lock for update bar
-        std::unique_ptr<std::mutex> printProgressLock;  
 
     protected:
 
@@ -328,7 +715,8 @@ class Mapping : protected MappingPolicy, protected FilePolicy
             const std::vector<int>& mismatchList, 
             const std::string& patternName,
             std::unordered_map<std::string, std::vector<std::string>>& fileToBarcodesMap,
-            const input& input);
+            const input& input,
+            size_t& indexMemoryBudget);
         bool generate_barcode_patterns(const input& input);
 
 //OLD FUNCTION:
@@ -343,13 +731,22 @@ class Mapping : protected MappingPolicy, protected FilePolicy
             return barcodePatternList;
         }
 
-        //wrapper to call the actual mapping function on one read and updates the status bar
+        //wrapper to call the actual mapping function on one read
+        //(the mapping stops as soon as the read has scoreBound edits, e.g., the score of the best other pattern)
         bool demultiplex_read(const std::pair<fastqLine, fastqLine>& seq, 
                               DemultiplexedLine& demultiplexedLine,
                               BarcodePatternPtr pattern,
                               const input& input, 
-                              const unsigned long long& count, const unsigned long long& totalReadCount,
                               int& mmScore,
-                              OneLineDemultiplexingStatsPtr stats);
+                              OneLineDemultiplexingStatsPtr stats,
+                              const int scoreBound = std::numeric_limits<int>::max());
+        //same for a batch of reads (pointers to the reads: a subset of a batch is mapped without copying its reads)
+        void demultiplex_reads(const std::vector<const std::pair<fastqLine, fastqLine>*>& seqs, 
+                               std::vector<DemultiplexedLine>& demultiplexedLines,
+                               BarcodePatternPtr pattern,
+                               const input& input, 
+                                std::vector<int>& mmScores, std::vector<bool>& results,
+                               const std::vector<OneLineDemultiplexingStatsPtr>& stats,
+                               const std::vector<int>& scoreBounds);
 
 };
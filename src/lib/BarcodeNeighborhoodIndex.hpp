@@ -0,0 +1,404 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+
+//hash index of all sequences within k edits of a whitelist of equal-length barcodes:
+//sequence -> (barcode ID, edit distance) or an ambiguous marker, if several barcodes have the same minimal distance to this sequence.
+//It allows us to find the best barcode for a read with a few hash look-ups instead of aligning all barcodes.
+//
+//Barcodes are mapped semi-globally (EDLIB_MODE_SHW: no penalty for the remaining read after the barcode), the distance
+//of a barcode of length L to the read is therefore the minimum over the edit distances to the read-prefixes of length L-k...L+k.
+//We look up all those prefixes and keep the barcode with the minimal distance (if it is unique).
+//
+//The index is built with several threads: every thread creates the neighborhoods of a subset of barcodes and distributes them
+//into one bucket per partition (part of the hash table), afterwards every thread fills the hash table of one partition.
+class BarcodeNeighborhoodIndex
+{
+    public:
+
+    //the index is only built for up to 2 edits, for more edits the neighborhoods are too big
+    static const int maxDistance = 2;
+    //we do not build an index if creating it would need more than this many neighbors (16 bytes each)
+    static const size_t maxNeighbors = 1ULL << 25;
+
+    enum class LookupResult
+    {
+        NoMatch,    // no barcode within k edits
+        Unique,     // exactly one barcode with the minimal distance
+        Ambiguous,  // several barcodes with the minimal distance
+        Unknown     // read contains other bases than ACGT, we have to align it
+    };
+
+    //estimated number of neighbors to generate, used to decide if we build the index or align reads to all barcodes
+    static size_t estimate_neighbors(const size_t barcodeNumber, const size_t barcodeLength, const int k)
+    {
+        //number of single edits: deletions, substitutions (3 other bases), insertions (4 bases at L+1 positions)
+        auto singleEdits = [](const size_t length){return 8*length + 4;};
+        size_t neighborsPerBarcode = 1;
+        if(k >= 1){neighborsPerBarcode += singleEdits(barcodeLength);}
+        if(k >= 2){neighborsPerBarcode += singleEdits(barcodeLength) * singleEdits(barcodeLength + 1);}
+        return barcodeNumber * neighborsPerBarcode;
+    }
+
+    //upper bound of the memory needed to build the index: the neighbors that are distributed into the buckets and the hash table
+    //(load factor of at least 0.25, if all neighbors are different sequences). The hash table stays after building.
+    static size_t estimate_memory_bytes(const size_t barcodeNumber, const size_t barcodeLength, const int k)
+    {
+        const size_t neighbors = estimate_neighbors(barcodeNumber, barcodeLength, k);
+        return neighbors * sizeof(Neighbor) + 4 * neighbors * sizeof(Slot);
+    }
+
+    //barcodes must all have the same length, contain only ACGT and k must be in [1, maxDistance]
+    //(check with can_build before)
+    BarcodeNeighborhoodIndex(const std::vector<std::string>& barcodes, const int k, const int threads)
+    : k(k), barcodeLength(barcodes.at(0).size())
+    {
+        //partitions of the hash table (power of 2, to get it from the hash)
+        int threadNum = std::max(1, threads);
+        partitionBits = 0;
+        while((1 << partitionBits) < threadNum){++partitionBits;}
+        const size_t partitionNum = 1ULL << partitionBits;
+
+        //1.) create the neighborhoods of all barcodes, bucketed by partition
+        std::vector<std::vector<std::vector<Neighbor>>> buckets(threadNum, std::vector<std::vector<Neighbor>>(partitionNum));
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threadNum; ++t)
+        {
+            workers.emplace_back([this, &barcodes, &buckets, t, threadNum]()
+            {
+                std::vector<Neighbor> neighbors;
+                for(size_t barcodeId = t; barcodeId < barcodes.size(); barcodeId += threadNum)
+                {
+                    neighbors.clear();
+                    generate_neighbors(barcodes.at(barcodeId), static_cast<uint32_t>(barcodeId), neighbors);
+                    for(const Neighbor& neighbor : neighbors)
+                    {
+                        buckets.at(t).at(partition_of(hash(neighbor.key))).push_back(neighbor);
+                    }
+                }
+            });
+        }
+        for(std::thread& worker : workers){worker.join();}
+        workers.clear();
+
+        //2.) fill the hash table of every partition
+        partitions.resize(partitionNum);
+        for(size_t p = 0; p < partitionNum; ++p)
+        {
+            workers.emplace_back([this, &buckets, p, threadNum]()
+            {
+                size_t neighborNum = 0;
+                for(int t = 0; t < threadNum; ++t){neighborNum += buckets.at(t).at(p).size();}
+                Partition& partition = partitions.at(p);
+                //load factor is at most 0.5
+                size_t capacity = 16;
+                while(capacity < 2*neighborNum){capacity <<= 1;}
+                partition.slots.assign(capacity, Slot());
+                partition.mask = capacity - 1;
+                for(int t = 0; t < threadNum; ++t)
+                {
+                    for(const Neighbor& neighbor : buckets.at(t).at(p)){insert(partition, neighbor);}
+                    std::vector<Neighbor>().swap(buckets.at(t).at(p)); //free memory of this bucket
+                }
+            });
+            if(workers.size() == static_cast<size_t>(threadNum) || p + 1 == partitionNum)
+            {
+                for(std::thread& worker : workers){worker.join();}
+                workers.clear();
+            }
+        }
+    }
+
+    static bool can_build(const std::vector<std::string>& barcodes, const int k)
+    {
+        if(barcodes.empty() || k < 1 || k > maxDistance){return false;}
+        //sequences are stored as 2-bit words together with their length
+        const size_t length = barcodes.at(0).size();
+        if(length == 0 || length + k > maxSequenceLength){return false;}
+        for(const std::string& barcode : barcodes)
+        {
+            if(barcode.size() != length){return false;}
+            for(const char c : barcode)
+            {
+                if(base_code(c) < 0){return false;}
+            }
+        }
+        return estimate_neighbors(barcodes.size(), length, k) <= maxNeighbors;
+    }
+
+    //finds the barcode with minimal semi-global edit distance to target (the read starting at the barcode position,
+    //at least barcodeLength+k bases long if the read is long enough)
+    LookupResult find_best_barcode(std::string_view target, uint32_t& barcodeId, int& distance) const
+    {
+        //all prefixes of the target that could align with at most k edits
+        const size_t shortestPrefix = (barcodeLength > static_cast<size_t>(k)) ? barcodeLength - k : 0;
+        const size_t longestPrefix = std::min(barcodeLength + k, target.size());
+        if(longestPrefix < shortestPrefix){return LookupResult::NoMatch;}
+
+        uint64_t prefixWord = 0;
+        for(size_t i = 0; i < longestPrefix; ++i)
+        {
+            const int code = base_code(target[i]);
+            if(code < 0){return LookupResult::Unknown;}
+            prefixWord |= (static_cast<uint64_t>(code) << (2*i));
+        }
+
+        LookupState state(k);
+        for(size_t prefixLength = shortestPrefix; prefixLength <= longestPrefix; ++prefixLength)
+        {
+            const uint64_t lowBits = (1ULL << (2*prefixLength)) - 1;
+            state.add(find(make_key(prefixWord & lowBits, prefixLength)));
+        }
+        return state.result(k, barcodeId, distance);
+    }
+
+    //same look-up for a read that was reverse complemented: the suffixes of revCompTarget are the reverse complements of the
+    //read prefixes, they are looked up in the index of the forward barcodes (the edit distance of two sequences is the same
+    //as the one of their reverse complements). The result is the same as find_best_barcode with the index of the reverse
+    //complement barcodes and the read.
+    LookupResult find_best_barcode_reverse(std::string_view revCompTarget, uint32_t& barcodeId, int& distance) const
+    {
+        const size_t shortestSuffix = (barcodeLength > static_cast<size_t>(k)) ? barcodeLength - k : 0;
+        const size_t longestSuffix = std::min(barcodeLength + k, revCompTarget.size());
+        if(longestSuffix < shortestSuffix){return LookupResult::NoMatch;}
+
+        //packed suffixes: adding a base in front shifts the suffix by one base
+        std::array<uint64_t, maxSequenceLength + 1> suffixWords;
+        suffixWords[0] = 0;
+        uint64_t suffixWord = 0;
+        for(size_t suffixLength = 1; suffixLength <= longestSuffix; ++suffixLength)
+        {
+            const int code = base_code(revCompTarget[revCompTarget.size() - suffixLength]);
+            if(code < 0){return LookupResult::Unknown;}
+            suffixWord = (suffixWord << 2) | static_cast<uint64_t>(code);
+            suffixWords[suffixLength] = suffixWord;
+        }
+
+        LookupState state(k);
+        for(size_t suffixLength = shortestSuffix; suffixLength <= longestSuffix; ++suffixLength)
+        {
+            state.add(find(make_key(suffixWords[suffixLength], suffixLength)));
+        }
+        return state.result(k, barcodeId, distance);
+    }
+
+    size_t size() const
+    {
+        size_t entries = 0;
+        for(const Partition& partition : partitions){entries += partition.entries;}
+        return entries;
+    }
+
+    size_t memory_bytes() const
+    {
+        size_t bytes = 0;
+        for(const Partition& partition : partitions){bytes += partition.slots.size() * sizeof(Slot);}
+        return bytes;
+    }
+
+    private:
+
+    static const uint32_t ambiguous = UINT32_MAX;
+    static const uint64_t emptyKey = UINT64_MAX;
+    //sequence (2 bits per base) and its length (upper bits) must fit into one 64-bit key
+    static const size_t maxSequenceLength = 28;
+
+    struct Neighbor
+    {
+        uint64_t key;
+        uint32_t barcodeId;
+        uint8_t distance;
+    };
+
+    struct Slot
+    {
+        uint64_t key = emptyKey;
+        uint32_t barcodeId = ambiguous;
+        uint8_t distance = UINT8_MAX;
+    };
+
+    //best barcode of the look-ups of all read prefixes (the same barcode can be found for several prefixes)
+    struct LookupState
+    {
+        int bestDistance;
+        uint32_t bestId = ambiguous;
+        bool severalMatches = false;
+
+        explicit LookupState(const int k) : bestDistance(k + 1) {}
+
+        void add(const Slot* slot)
+        {
+            if(slot == nullptr){return;}
+            if(slot->distance < bestDistance)
+            {
+                bestDistance = slot->distance;
+                bestId = slot->barcodeId;
+                severalMatches = (slot->barcodeId == ambiguous);
+            }
+            else if(slot->distance == bestDistance && (slot->barcodeId == ambiguous || slot->barcodeId != bestId))
+            {
+                severalMatches = true;
+            }
+        }
+
+        LookupResult result(const int k, uint32_t& barcodeId, int& distance) const
+        {
+            if(bestDistance > k){return LookupResult::NoMatch;}
+            if(severalMatches){return LookupResult::Ambiguous;}
+            barcodeId = bestId;
+            distance = bestDistance;
+            return LookupResult::Unique;
+        }
+    };
+
+    struct Partition
+    {
+        std::vector<Slot> slots;
+        size_t mask = 0;
+        size_t entries = 0;
+    };
+
+    static inline int base_code(const char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    static inline uint64_t make_key(const uint64_t word, const size_t length)
+    {
+        return word | (static_cast<uint64_t>(length) << 56);
+    }
+
+    static inline uint64_t hash(uint64_t key)
+    {
+        //splitmix64 finalizer
+        key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+    inline size_t partition_of(const uint64_t hashValue) const
+    {
+        return (partitionBits == 0) ? 0 : static_cast<size_t>(hashValue >> (64 - partitionBits));
+    }
+
+    const Slot* find(const uint64_t key) const
+    {
+        const uint64_t hashValue = hash(key);
+        const Partition& partition = partitions[partition_of(hashValue)];
+        for(size_t pos = hashValue & partition.mask; ; pos = (pos + 1) & partition.mask)
+        {
+            const Slot& slot = partition.slots[pos];
+            if(slot.key == key){return &slot;}
+            if(slot.key == emptyKey){return nullptr;}
+        }
+    }
+
+    //keep the minimal distance for every sequence, and mark it as ambiguous if two barcodes share this distance
+    static void insert(Partition& partition, const Neighbor& neighbor)
+    {
+        for(size_t pos = hash(neighbor.key) & partition.mask; ; pos = (pos + 1) & partition.mask)
+        {
+            Slot& slot = partition.slots[pos];
+            if(slot.key == emptyKey)
+            {
+                slot.key = neighbor.key;
+                slot.barcodeId = neighbor.barcodeId;
+                slot.distance = neighbor.distance;
+                ++partition.entries;
+                return;
+            }
+            if(slot.key == neighbor.key)
+            {
+                if(neighbor.distance < slot.distance)
+                {
+                    slot.barcodeId = neighbor.barcodeId;
+                    slot.distance = neighbor.distance;
+                }
+                else if(neighbor.distance == slot.distance && neighbor.barcodeId != slot.barcodeId)
+                {
+                    slot.barcodeId = ambiguous;
+                }
+                return;
+            }
+        }
+    }
+
+    //all sequences within k edits of barcode (with their minimal distance, every sequence only once)
+    void generate_neighbors(const std::string& barcode, const uint32_t barcodeId, std::vector<Neighbor>& neighbors) const
+    {
+        std::vector<std::pair<std::string, int>> sequences = {{barcode, 0}};
+        size_t lastRoundStart = 0;
+        const char bases[] = {'A', 'C', 'G', 'T'};
+        for(int edit = 1; edit <= k; ++edit)
+        {
+            const size_t lastRoundEnd = sequences.size();
+            for(size_t s = lastRoundStart; s < lastRoundEnd; ++s)
+            {
+                const std::string seq = sequences[s].first;
+                for(size_t pos = 0; pos <= seq.size(); ++pos)
+                {
+                    for(const char base : bases)
+                    {
+                        //insertion
+                        sequences.emplace_back(seq.substr(0, pos) + base + seq.substr(pos), edit);
+                        //substitution
+                        if(pos < seq.size() && seq[pos] != base)
+                        {
+                            std::string substituted = seq;
+                            substituted[pos] = base;
+                            sequences.emplace_back(substituted, edit);
+                        }
+                    }
+                    //deletion
+                    if(pos < seq.size())
+                    {
+                        sequences.emplace_back(seq.substr(0, pos) + seq.substr(pos + 1), edit);
+                    }
+                }
+            }
+            lastRoundStart = lastRoundEnd;
+        }
+
+        for(const std::pair<std::string, int>& sequence : sequences)
+        {
+            uint64_t word = 0;
+            for(size_t i = 0; i < sequence.first.size(); ++i)
+            {
+                word |= (static_cast<uint64_t>(base_code(sequence.first[i])) << (2*i));
+            }
+            neighbors.push_back({make_key(word, sequence.first.size()), barcodeId, static_cast<uint8_t>(sequence.second)});
+        }
+
+        //keep every sequence once with its minimal distance
+        std::sort(neighbors.begin(), neighbors.end(), [](const Neighbor& a, const Neighbor& b)
+        {
+            return (a.key < b.key) || (a.key == b.key && a.distance < b.distance);
+        });
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end(), [](const Neighbor& a, const Neighbor& b)
+        {
+            return a.key == b.key;
+        }), neighbors.end());
+    }
+
+    int k;
+    size_t barcodeLength;
+    int partitionBits;
+    std::vector<Partition> partitions;
+};
+typedef std::shared_ptr<const BarcodeNeighborhoodIndex> BarcodeNeighborhoodIndexPtr;
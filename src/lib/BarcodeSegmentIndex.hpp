@@ -0,0 +1,155 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+//index for big barcode whitelists (e.g., 10X or spatial barcodes) to find all barcodes that might align with at most k edits
+//to a read, without aligning every barcode.
+//
+//PIGEONHOLE: every barcode is split into k+1 segments. Each edit changes at most one segment, therefore in an alignment with
+//at most k edits at least one segment maps to the read without any error. Since the barcode is aligned from the start of the read
+//(EDLIB_MODE_SHW), this segment is shifted by at most k positions in the read.
+//We store for every segment (start, length) a sorted table: segment sequence -> barcodes, and look up the read sequences at all
+//possible shifts. The resulting candidates still have to be aligned, but their number does not grow with the whole whitelist.
+//The index is read-only after construction and shared between threads.
+class BarcodeSegmentIndex
+{
+    public:
+
+    BarcodeSegmentIndex(const std::vector<std::string>& barcodes, const int k)
+    : k(k)
+    {
+        //sequences of every segment (start, length) with the barcode they come from
+        std::map<std::pair<size_t, size_t>, std::vector<std::pair<uint64_t, uint32_t>>> segmentSequences;
+        for(size_t barcodeId = 0; barcodeId < barcodes.size(); ++barcodeId)
+        {
+            const std::string& barcode = barcodes.at(barcodeId);
+            const size_t segmentNum = static_cast<size_t>(k) + 1;
+            std::vector<std::pair<std::pair<size_t, size_t>, uint64_t>> segments;
+            bool packed = (barcode.size() >= segmentNum);
+            for(size_t segment = 0; segment < segmentNum && packed; ++segment)
+            {
+                const size_t start = segment * barcode.size() / segmentNum;
+                //a longer segment is stored with its first 32 bases only (they must also map without errors)
+                const size_t length = std::min(static_cast<size_t>(32), (segment + 1) * barcode.size() / segmentNum - start);
+                uint64_t key = 0;
+                packed = pack(barcode, start, length, key);
+                segments.push_back(std::make_pair(std::make_pair(start, length), key));
+            }
+            //barcodes shorter than k+1 bases (or with other bases than ACGT) are always candidates
+            if(!packed)
+            {
+                alwaysCandidates.push_back(static_cast<uint32_t>(barcodeId));
+                continue;
+            }
+            for(const auto& segment : segments)
+            {
+                segmentSequences[segment.first].emplace_back(segment.second, static_cast<uint32_t>(barcodeId));
+            }
+        }
+
+        for(auto& segmentEntry : segmentSequences)
+        {
+            std::vector<std::pair<uint64_t, uint32_t>>& sequences = segmentEntry.second;
+            std::sort(sequences.begin(), sequences.end());
+
+            SegmentTable table;
+            table.start = segmentEntry.first.first;
+            table.length = segmentEntry.first.second;
+            for(const std::pair<uint64_t, uint32_t>& sequence : sequences)
+            {
+                if(table.keys.empty() || table.keys.back() != sequence.first)
+                {
+                    table.keys.push_back(sequence.first);
+                    table.offsets.push_back(static_cast<uint32_t>(table.barcodeIds.size()));
+                }
+                table.barcodeIds.push_back(sequence.second);
+            }
+            table.offsets.push_back(static_cast<uint32_t>(table.barcodeIds.size()));
+            std::vector<std::pair<uint64_t, uint32_t>>().swap(sequences);
+            tables.push_back(std::move(table));
+        }
+    }
+
+    //writes the IDs of all barcodes that could align with at most k edits to the read at targetOffset into candidateIds
+    //(sorted in order of the whitelist, every ID once)
+    void find_candidates(std::string_view fastqLine, const unsigned int targetOffset, std::vector<uint32_t>& candidateIds) const
+    {
+        candidateIds.assign(alwaysCandidates.begin(), alwaysCandidates.end());
+        const long long readLength = static_cast<long long>(fastqLine.size()) - targetOffset;
+
+        for(const SegmentTable& table : tables)
+        {
+            for(int shift = -k; shift <= k; ++shift)
+            {
+                const long long readStart = static_cast<long long>(table.start) + shift;
+                if(readStart < 0 || readStart + static_cast<long long>(table.length) > readLength){continue;}
+
+                //bases other than ACGT never map exactly to a barcode
+                uint64_t key = 0;
+                if(!pack(fastqLine, targetOffset + readStart, table.length, key)){continue;}
+
+                std::vector<uint64_t>::const_iterator keyItr = std::lower_bound(table.keys.begin(), table.keys.end(), key);
+                if(keyItr == table.keys.end() || *keyItr != key){continue;}
+                const size_t keyIdx = keyItr - table.keys.begin();
+                candidateIds.insert(candidateIds.end(), table.barcodeIds.begin() + table.offsets[keyIdx],
+                                    table.barcodeIds.begin() + table.offsets[keyIdx + 1]);
+            }
+        }
+
+        std::sort(candidateIds.begin(), candidateIds.end());
+        candidateIds.erase(std::unique(candidateIds.begin(), candidateIds.end()), candidateIds.end());
+    }
+
+    size_t memory_bytes() const
+    {
+        size_t bytes = alwaysCandidates.size() * sizeof(uint32_t);
+        for(const SegmentTable& table : tables)
+        {
+            bytes += table.keys.size() * sizeof(uint64_t) + (table.offsets.size() + table.barcodeIds.size()) * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    private:
+
+    //sorted segment sequences (2-bit packed) of all barcodes with the same segment start/length,
+    //barcodes of keys[i] are barcodeIds[offsets[i]...offsets[i+1]]
+    struct SegmentTable
+    {
+        size_t start;
+        size_t length;
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> barcodeIds;
+    };
+
+    static bool pack(std::string_view seq, const size_t start, const size_t length, uint64_t& key)
+    {
+        key = 0;
+        for(size_t i = 0; i < length; ++i)
+        {
+            uint64_t code;
+            switch (seq[start + i])
+            {
+                case 'A': code = 0; break;
+                case 'C': code = 1; break;
+                case 'G': code = 2; break;
+                case 'T': code = 3; break;
+                default: return false;
+            }
+            key |= (code << (2*i));
+        }
+        return true;
+    }
+
+    int k;
+    std::vector<SegmentTable> tables;
+    std::vector<uint32_t> alwaysCandidates;
+};
+typedef std::shared_ptr<const BarcodeSegmentIndex> BarcodeSegmentIndexPtr;
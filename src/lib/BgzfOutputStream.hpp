@@ -0,0 +1,165 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <zlib.h>
+
+//stream buffer that compresses everything written to it into BGZF blocks (blocked gzip as written by bgzip and htslib):
+//every block is an independent gzip member with at most 64KB, the size of the block is stored in the extra field 'BC' of its header.
+//Files of BGZF blocks can be concatenated byte by byte, the result is read by gzip/ zcat and htslib (and by the parallel
+//decompression of our input). A complete file ends with an empty EOF block, which is appended once the file is complete (append_eof).
+class BgzfStreamBuffer : public std::streambuf
+{
+    public:
+
+    static const int maxBlockSize = 0xff00; //uncompressed bytes of a block (as bgzip: the compressed block must fit into 64KB)
+    static const int headerSize = 18;
+    static const int footerSize = 8;
+
+    BgzfStreamBuffer(std::streambuf* fileBuffer, const int level, const int blockSize)
+    : file(fileBuffer)
+    {
+        //level and block size are checked when parsing the arguments (-z, -k), a block is never silently shortened
+        if(level < 1 || level > 9 || blockSize < 1 || blockSize > maxBlockSize)
+        {
+            std::cerr << "Error: invalid BGZF output (compression level " << level << " must be 1-9, block size " << blockSize
+                      << " must be 1-" << maxBlockSize << " bytes)\n";
+            exit(EXIT_FAILURE);
+        }
+        buffer.resize(blockSize);
+        std::memset(&stream, 0, sizeof(stream));
+        //raw deflate: header and footer of the gzip member are written here
+        if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            std::cerr << "Error: could not initialize the compression of an output file (compression level " << level << ")\n";
+            exit(EXIT_FAILURE);
+        }
+        compressedBlock.resize(1 << 16);
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+    ~BgzfStreamBuffer()
+    {
+        sync();
+        deflateEnd(&stream);
+    }
+
+    //appends the empty block that marks the end of a BGZF file
+    static void append_eof(const std::string& fileName)
+    {
+        static const unsigned char eofBlock[28] = {0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+                                                   0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        std::ofstream out(fileName, std::ios::app | std::ios::binary);
+        out.write(reinterpret_cast<const char*>(eofBlock), sizeof(eofBlock));
+    }
+
+    protected:
+
+    //the buffer is full: it is compressed into a block
+    int_type overflow(int_type character) override
+    {
+        if(!write_buffer()){return traits_type::eof();}
+        if(!traits_type::eq_int_type(character, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(character);
+            pbump(1);
+        }
+        return traits_type::not_eof(character);
+    }
+
+    //the remaining data becomes a (shorter) block
+    int sync() override
+    {
+        if(!write_buffer()){return -1;}
+        return file->pubsync();
+    }
+
+    private:
+
+    bool write_buffer()
+    {
+        const int length = static_cast<int>(pptr() - pbase());
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return(length == 0 || write_block(buffer.data(), length));
+    }
+
+    //compresses data into one block (or two blocks if it does not fit into 64KB after compression, e.g. random data)
+    bool write_block(const char* data, const int length)
+    {
+        deflateReset(&stream);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        stream.next_out = reinterpret_cast<Bytef*>(compressedBlock.data() + headerSize);
+        stream.avail_out = static_cast<uInt>(compressedBlock.size() - headerSize - footerSize);
+        if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+        {
+            const int half = length / 2;
+            return(write_block(data, half) && write_block(data + half, length - half));
+        }
+
+        const int blockSize = headerSize + static_cast<int>(stream.total_out) + footerSize;
+        unsigned char* block = compressedBlock.data();
+        static const unsigned char header[16] = {0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00};
+        std::memcpy(block, header, sizeof(header));
+        write_le(block + 16, static_cast<uint32_t>(blockSize - 1), 2);
+        unsigned char* footer = block + blockSize - footerSize;
+        write_le(footer, static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data), static_cast<uInt>(length))), 4);
+        write_le(footer + 4, static_cast<uint32_t>(length), 4);
+        return(file->sputn(reinterpret_cast<const char*>(block), blockSize) == blockSize);
+    }
+
+    static void write_le(unsigned char* out, const uint32_t value, const int bytes)
+    {
+        for(int i = 0; i < bytes; ++i){out[i] = static_cast<unsigned char>(value >> (8*i));}
+    }
+
+    std::streambuf* file;
+    std::vector<char> buffer;
+    std::vector<unsigned char> compressedBlock;
+    z_stream stream;
+};
+
+//output file that is written uncompressed or (with a compression level > 0) as BGZF blocks of blockSize bytes
+class OutputFileStream : public std::ostream
+{
+    public:
+
+    OutputFileStream(const std::string& fileName, const int level = 0, const int blockSize = BgzfStreamBuffer::maxBlockSize,
+                     const std::ios::openmode mode = std::ios::out)
+    : std::ostream(nullptr)
+    {
+        file.open(fileName, mode | std::ios::out | (level > 0 ? std::ios::binary : std::ios::openmode()));
+        if(level > 0)
+        {
+            compressor = std::make_unique<BgzfStreamBuffer>(&file, level, blockSize);
+            rdbuf(compressor.get());
+        }
+        else
+        {
+            rdbuf(&file);
+        }
+    }
+    ~OutputFileStream(){close();}
+
+    bool is_open() const {return file.is_open();}
+
+    //writes the last block and closes the file
+    void close()
+    {
+        if(!file.is_open()){return;}
+        compressor.reset();
+        rdbuf(&file);
+        file.close();
+    }
+
+    private:
+    std::filebuf file;
+    std::unique_ptr<BgzfStreamBuffer> compressor;
+};
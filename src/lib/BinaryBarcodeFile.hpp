@@ -0,0 +1,413 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//binary columnar file of the demultiplexed barcodes of a pattern (written by demultiplex -y instead of the tsv, read by count):
+//HEADER: magic, the columns (names as in the tsv header) and for every column its type:
+//      Dictionary: all its barcodes (the whitelist of a variable barcode, a constant), every read stores the index of its barcode (uint16 or uint32)
+//      Sequence: wildcards (UMIs) are 2-bit packed, every read stores the length of its sequence (1 byte) and the packed bases.
+//      Sequences with other bases than A,C,G,T (or longer than 254) are exceptions: their length is 255 and they are stored
+//      unpacked in the exception list of the chunk (read in chunk, length, sequence), all other reads stay packed
+//CHUNKS: the reads follow in chunks of up to chunkReads reads, a chunk stores all values of a column together.
+//Integers are little-endian, the file is memory mapped by the reader.
+struct BinaryBarcodeColumn
+{
+    enum class Type : uint8_t {Dictionary = 0, Sequence = 1};
+
+    std::string name;
+    Type type = Type::Dictionary;
+    std::vector<std::string> dictionary;
+    uint8_t indexBytes = 2;
+    uint32_t maxLength = 0; //longest packed sequence of a sequence column
+
+    static constexpr uint8_t exceptionLength = 255; //length of an exception of a sequence column
+
+    size_t packed_bytes() const {return((maxLength + 3) / 4);}
+    size_t bytes_per_read() const {return(type == Type::Dictionary ? indexBytes : 1 + packed_bytes());}
+};
+
+class BinaryBarcodeFile
+{
+    public:
+
+    static constexpr char magic[8] = {'E', 'S', 'G', 'I', 'B', 'C', '0', '2'};
+    static const uint32_t chunkReads = 1 << 16;
+
+    //true if the file starts with the magic of a binary barcode file
+    static bool is_binary_file(const std::string& fileName)
+    {
+        std::ifstream file(fileName, std::ios::binary);
+        char start[sizeof(magic)];
+        return(file.read(start, sizeof(start)) && std::memcmp(start, magic, sizeof(magic)) == 0);
+    }
+
+    //writes the barcodes of all reads: columns have the name, and for a dictionary column the whitelist (more barcodes are added
+    //if reads contain them)
+    static void write(const std::string& fileName, std::vector<BinaryBarcodeColumn> columns, const std::vector<std::vector<const char*>>& reads)
+    {
+        //1.) complete the dictionaries and lengths of all columns
+        //(the keys are views of the whitelists and of the barcodes of the reads, which are unique strings)
+        std::vector<std::unordered_map<std::string_view, uint32_t>> indices(columns.size());
+        std::vector<std::vector<std::string>> whitelists(columns.size());
+        for(size_t col = 0; col < columns.size(); ++col)
+        {
+            BinaryBarcodeColumn& column = columns[col];
+            if(column.type == BinaryBarcodeColumn::Type::Sequence)
+            {
+                for(const std::vector<const char*>& read : reads)
+                {
+                    const std::string_view sequence = value(read, col);
+                    if(!is_exception(sequence)){column.maxLength = std::max(column.maxLength, static_cast<uint32_t>(sequence.size()));}
+                }
+                continue;
+            }
+            whitelists[col].swap(column.dictionary);
+            column.dictionary.clear();
+            for(const std::string& barcode : whitelists[col])
+            {
+                if(indices[col].emplace(barcode, static_cast<uint32_t>(indices[col].size())).second){column.dictionary.push_back(barcode);}
+            }
+            for(const std::vector<const char*>& read : reads)
+            {
+                if(indices[col].emplace(value(read, col), static_cast<uint32_t>(indices[col].size())).second)
+                {
+                    column.dictionary.emplace_back(value(read, col));
+                }
+            }
+            column.indexBytes = (column.dictionary.size() > 0xffff) ? 4 : 2;
+        }
+
+        std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+        if(!out.is_open())
+        {
+            std::cerr << "Error opening file: " << fileName << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        //2.) HEADER
+        out.write(magic, sizeof(magic));
+        write_int(out, static_cast<uint32_t>(columns.size()), 4);
+        for(const BinaryBarcodeColumn& column : columns)
+        {
+            write_string(out, column.name);
+            write_int(out, static_cast<uint8_t>(column.type), 1);
+            if(column.type == BinaryBarcodeColumn::Type::Dictionary)
+            {
+                write_int(out, column.indexBytes, 1);
+                write_int(out, static_cast<uint32_t>(column.dictionary.size()), 4);
+                for(const std::string& barcode : column.dictionary){write_string(out, barcode);}
+            }
+            else
+            {
+                write_int(out, column.maxLength, 4);
+            }
+        }
+        write_int(out, static_cast<uint64_t>(reads.size()), 8);
+
+        //3.) CHUNKS of reads, column by column
+        std::vector<unsigned char> buffer;
+        for(size_t chunkStart = 0; chunkStart < reads.size(); chunkStart += chunkReads)
+        {
+            const size_t chunkEnd = std::min(reads.size(), chunkStart + chunkReads);
+            write_int(out, static_cast<uint32_t>(chunkEnd - chunkStart), 4);
+            for(size_t col = 0; col < columns.size(); ++col)
+            {
+                const BinaryBarcodeColumn& column = columns[col];
+                buffer.assign((chunkEnd - chunkStart) * column.bytes_per_read(), 0);
+                unsigned char* position = buffer.data();
+                if(column.type == BinaryBarcodeColumn::Type::Dictionary)
+                {
+                    for(size_t read = chunkStart; read < chunkEnd; ++read, position += column.indexBytes)
+                    {
+                        store_int(position, indices[col].at(value(reads[read], col)), column.indexBytes);
+                    }
+                }
+                else
+                {
+                    //all lengths, then all packed sequences, then the exceptions
+                    std::vector<size_t> exceptionReads;
+                    unsigned char* packed = position + (chunkEnd - chunkStart);
+                    for(size_t read = chunkStart; read < chunkEnd; ++read, ++position, packed += column.packed_bytes())
+                    {
+                        const std::string_view sequence = value(reads[read], col);
+                        if(is_exception(sequence))
+                        {
+                            *position = BinaryBarcodeColumn::exceptionLength;
+                            exceptionReads.push_back(read);
+                            continue;
+                        }
+                        *position = static_cast<unsigned char>(sequence.size());
+                        for(size_t base = 0; base < sequence.size(); ++base)
+                        {
+                            packed[base / 4] |= static_cast<unsigned char>(base_code(sequence[base]) << (2 * (base % 4)));
+                        }
+                    }
+                    append_int(buffer, exceptionReads.size(), 4);
+                    for(const size_t read : exceptionReads)
+                    {
+                        const std::string_view sequence = value(reads[read], col);
+                        append_int(buffer, read - chunkStart, 4);
+                        append_int(buffer, sequence.size(), 4);
+                        buffer.insert(buffer.end(), sequence.begin(), sequence.end());
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+            }
+        }
+    }
+
+    //READER: maps the file and parses its header, the reads are accessed chunk by chunk
+    BinaryBarcodeFile() = default;
+    BinaryBarcodeFile(const BinaryBarcodeFile&) = delete;
+    BinaryBarcodeFile& operator=(const BinaryBarcodeFile&) = delete;
+    ~BinaryBarcodeFile(){close();}
+
+    void open(const std::string& fileName)
+    {
+        map_file(fileName);
+        size_t position = sizeof(magic);
+        if(size < position || std::memcmp(data, magic, sizeof(magic)) != 0)
+        {
+            std::cerr << "Error: " << fileName << " is not a binary barcode file\n";
+            exit(EXIT_FAILURE);
+        }
+        columns.resize(read_int(position, 4));
+        for(BinaryBarcodeColumn& column : columns)
+        {
+            column.name = read_string(position);
+            column.type = static_cast<BinaryBarcodeColumn::Type>(read_int(position, 1));
+            if(column.type == BinaryBarcodeColumn::Type::Dictionary)
+            {
+                column.indexBytes = static_cast<uint8_t>(read_int(position, 1));
+                column.dictionary.resize(read_int(position, 4));
+                for(std::string& barcode : column.dictionary){barcode = read_string(position);}
+            }
+            else
+            {
+                column.maxLength = static_cast<uint32_t>(read_int(position, 4));
+            }
+        }
+        readNum = read_int(position, 8);
+        nextChunk = position;
+    }
+
+    //tab separated column names (the header line of the tsv)
+    std::string header_line() const
+    {
+        std::string header;
+        for(size_t col = 0; col < columns.size(); ++col)
+        {
+            header += columns[col].name;
+            if(col + 1 < columns.size()){header += "\t";}
+        }
+        return header;
+    }
+
+    //moves to the next chunk, false after the last chunk
+    bool next_chunk()
+    {
+        if(nextChunk >= size){return false;}
+        size_t position = nextChunk;
+        chunkReadNum = static_cast<uint32_t>(read_int(position, 4));
+        columnData.clear();
+        exceptions.resize(columns.size());
+        for(size_t col = 0; col < columns.size(); ++col)
+        {
+            columnData.push_back(data + position);
+            position += chunkReadNum * columns[col].bytes_per_read();
+            exceptions[col].clear();
+            if(columns[col].type == BinaryBarcodeColumn::Type::Dictionary){continue;}
+            const size_t exceptionNum = read_int(position, 4);
+            for(size_t exception = 0; exception < exceptionNum; ++exception)
+            {
+                const uint32_t read = static_cast<uint32_t>(read_int(position, 4));
+                const size_t length = read_int(position, 4);
+                if(position + length > size){truncated();}
+                exceptions[col].emplace_back(read, std::string_view(reinterpret_cast<const char*>(data + position), length));
+                position += length;
+            }
+        }
+        if(position > size){truncated();}
+        nextChunk = position;
+        return true;
+    }
+
+    //dictionary index of the barcode of a read of the chunk
+    uint32_t index(const size_t col, const size_t read) const
+    {
+        const unsigned char* position = columnData[col] + read * columns[col].indexBytes;
+        uint32_t value = 0;
+        for(int i = 0; i < columns[col].indexBytes; ++i){value |= static_cast<uint32_t>(position[i]) << (8 * i);}
+        return value;
+    }
+
+    //true if a read of the chunk has no sequence in the column (exceptions are never empty)
+    bool empty_sequence(const size_t col, const size_t read) const
+    {
+        return(columnData[col][read] == 0);
+    }
+
+    //decodes the sequence of a read of the chunk into sequence
+    void sequence(const size_t col, const size_t read, std::string& sequence) const
+    {
+        static const char bases[4] = {'A', 'C', 'G', 'T'};
+        const unsigned char* lengths = columnData[col];
+        if(lengths[read] == BinaryBarcodeColumn::exceptionLength)
+        {
+            //exceptions are sorted by read
+            const auto exceptionIt = std::lower_bound(exceptions[col].begin(), exceptions[col].end(), read,
+                                                      [](const std::pair<uint32_t, std::string_view>& exception, const size_t read)
+                                                      {return exception.first < read;});
+            if(exceptionIt == exceptions[col].end() || exceptionIt->first != read){truncated();}
+            sequence.assign(exceptionIt->second);
+            return;
+        }
+        const unsigned char* packed = lengths + chunkReadNum + read * columns[col].packed_bytes();
+        sequence.resize(lengths[read]);
+        for(size_t base = 0; base < sequence.size(); ++base)
+        {
+            sequence[base] = bases[(packed[base / 4] >> (2 * (base % 4))) & 3];
+        }
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        //a file that was read into fileData is not mapped
+        if(data != nullptr && size > 0 && fileData.empty()){munmap(const_cast<unsigned char*>(data), size);}
+#endif
+        data = nullptr;
+        size = 0;
+        fileData.clear();
+    }
+
+    std::vector<BinaryBarcodeColumn> columns;
+    uint64_t readNum = 0;
+    uint32_t chunkReadNum = 0; //reads of the current chunk
+
+    private:
+
+    static std::string_view value(const std::vector<const char*>& read, const size_t col)
+    {
+        return((col < read.size() && read[col] != nullptr) ? std::string_view(read[col]) : std::string_view());
+    }
+
+    //sequences that are not 2-bit packed
+    static bool is_exception(const std::string_view sequence)
+    {
+        return(sequence.size() >= BinaryBarcodeColumn::exceptionLength || sequence.find_first_not_of("ACGT") != std::string_view::npos);
+    }
+
+    static unsigned char base_code(const char base)
+    {
+        switch(base)
+        {
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return 0;
+        }
+    }
+
+    static void store_int(unsigned char* out, const uint64_t value, const int bytes)
+    {
+        for(int i = 0; i < bytes; ++i){out[i] = static_cast<unsigned char>(value >> (8 * i));}
+    }
+    static void append_int(std::vector<unsigned char>& out, const uint64_t value, const int bytes)
+    {
+        for(int i = 0; i < bytes; ++i){out.push_back(static_cast<unsigned char>(value >> (8 * i)));}
+    }
+    static void write_int(std::ofstream& out, const uint64_t value, const int bytes)
+    {
+        unsigned char buffer[8];
+        store_int(buffer, value, bytes);
+        out.write(reinterpret_cast<const char*>(buffer), bytes);
+    }
+    static void write_string(std::ofstream& out, const std::string& text)
+    {
+        write_int(out, static_cast<uint32_t>(text.size()), 4);
+        out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+
+    uint64_t read_int(size_t& position, const int bytes)
+    {
+        if(position + bytes > size){truncated();}
+        uint64_t value = 0;
+        for(int i = 0; i < bytes; ++i){value |= static_cast<uint64_t>(data[position + i]) << (8 * i);}
+        position += bytes;
+        return value;
+    }
+    std::string read_string(size_t& position)
+    {
+        const size_t length = read_int(position, 4);
+        if(position + length > size){truncated();}
+        std::string text(reinterpret_cast<const char*>(data + position), length);
+        position += length;
+        return text;
+    }
+
+    [[noreturn]] static void truncated()
+    {
+        std::cerr << "Error: the binary barcode file is truncated\n";
+        exit(EXIT_FAILURE);
+    }
+
+    //the file is memory mapped (read into memory on Windows)
+    void map_file(const std::string& fileName)
+    {
+#ifndef _WIN32
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        struct stat fileStat;
+        if(fd >= 0 && fstat(fd, &fileStat) == 0)
+        {
+            size = static_cast<size_t>(fileStat.st_size);
+            void* mapping = (size > 0) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            ::close(fd);
+            if(mapping != MAP_FAILED)
+            {
+                data = static_cast<const unsigned char*>(mapping);
+                madvise(mapping, size, MADV_SEQUENTIAL);
+                return;
+            }
+            size = 0;
+        }
+        else if(fd >= 0)
+        {
+            ::close(fd);
+        }
+#endif
+        std::ifstream file(fileName, std::ios::binary);
+        if(!file.is_open())
+        {
+            std::cerr << "Error opening binary barcode file: " << fileName << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        fileData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        size = fileData.size();
+        data = reinterpret_cast<const unsigned char*>(fileData.data());
+    }
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    std::vector<char> fileData; //content of a file that could not be mapped
+    size_t nextChunk = 0;
+    std::vector<const unsigned char*> columnData; //start of the values of every column in the current chunk
+    std::vector<std::vector<std::pair<uint32_t, std::string_view>>> exceptions; //exceptions of every sequence column in the current chunk
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <zlib.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+//decompression of an input file in its own threads, ahead of the thread parsing the reads (kseq reads from read()).
+//The decompressed file is passed on in chunks of several MB, in the order of the file:
+//BGZF (blocked gzip, e.g., from bgzip or htslib): the blocks are independent gzip members with their size in the header,
+//      several threads read a run of blocks each (in turn) and inflate them in parallel
+//gzip (also several members) and uncompressed files: one read-ahead thread decompresses the file with gzread into large chunks
+//zstd (only if built with ZSTD=1, which links libzstd): one read-ahead thread decompresses the file with the streaming decoder
+//(also several frames), without zstd such a file must be decompressed first
+//stdin (-) and FIFOs are streams that can be read only once: they are always read by the read-ahead thread (gzread also reads
+//uncompressed input), which blocks the producer of the stream when the mapping falls behind
+class DecompressedInputStream
+{
+    public:
+
+    static const size_t readAheadChunkSize = 4 << 20; //uncompressed bytes of a chunk of the read-ahead thread
+    static const size_t bgzfBlocksPerChunk = 64; //a BGZF block has at most 64KB
+    static const size_t maxBgzfBlockSize = 1 << 16;
+
+    DecompressedInputStream() = default;
+    DecompressedInputStream(const DecompressedInputStream&) = delete;
+    DecompressedInputStream& operator=(const DecompressedInputStream&) = delete;
+    ~DecompressedInputStream(){close();}
+
+    //opens the file and starts decompressing it (with up to threads threads for BGZF), false if the file can not be opened
+    bool open(const std::string& fileName, const int threads)
+    {
+        //the format of a stream can not be detected in advance (it would consume the first bytes)
+        Format format = Format::Gzip;
+        if(!is_stream(fileName) && !detect_format(fileName, format)){return false;}
+        if(format == Format::Zstd)
+        {
+#ifdef WITH_ZSTD
+            file = std::fopen(fileName.c_str(), "rb");
+            if(file == nullptr){return false;}
+            maxChunks = 4;
+            decompressionThreads.emplace_back(&DecompressedInputStream::decompress_zstd, this);
+            return true;
+#else
+            std::cerr << "Error: " << fileName << " is compressed with zstd, which is not supported by this build (make demultiplex ZSTD=1 "
+                      << "links libzstd). Please decompress it first (zstd -d) or compress it with gzip/ bgzip.\n";
+            exit(EXIT_FAILURE);
+#endif
+        }
+
+        if(format == Format::Bgzf)
+        {
+            file = std::fopen(fileName.c_str(), "rb");
+            if(file == nullptr){return false;}
+            const int threadNum = std::max(1, threads);
+            maxChunks = 2*threadNum + 2;
+            for(int i = 0; i < threadNum; ++i){decompressionThreads.emplace_back(&DecompressedInputStream::decompress_bgzf, this);}
+        }
+        else
+        {
+            gzFp = (fileName == "-") ? gzdopen(standard_input(), "r") : gzopen(fileName.c_str(), "r");
+            if(gzFp == Z_NULL){return false;}
+            gzbuffer(gzFp, 1 << 20);
+            maxChunks = 4;
+            decompressionThreads.emplace_back(&DecompressedInputStream::decompress_gzip, this);
+        }
+        return true;
+    }
+
+    //copies up to length decompressed bytes into buffer, returns 0 at the end of the file
+    int read(void* buffer, const unsigned length)
+    {
+        while(currentPosition == currentChunk.size())
+        {
+            if(!next_chunk()){return 0;}
+        }
+        const size_t bytes = std::min<size_t>(length, currentChunk.size() - currentPosition);
+        std::copy(currentChunk.data() + currentPosition, currentChunk.data() + currentPosition + bytes, static_cast<char*>(buffer));
+        currentPosition += bytes;
+        return static_cast<int>(bytes);
+    }
+
+    //files that are neither gzip nor zstd compressed (they can be memory mapped)
+    static bool is_uncompressed(const std::string& fileName)
+    {
+        Format format;
+        return !is_stream(fileName) && detect_format(fileName, format) && format == Format::Plain;
+    }
+
+    //stdin (-) and other input that is not a regular file (e.g. a named pipe)
+    static bool is_stream(const std::string& fileName)
+    {
+        if(fileName == "-"){return true;}
+        std::error_code error;
+        const std::filesystem::file_status status = std::filesystem::status(fileName, error);
+        return !error && std::filesystem::exists(status) && !std::filesystem::is_regular_file(status);
+    }
+
+    //bytes of the (compressed) file that were decompressed so far
+    long long compressed_offset() const {return compressedOffset.load();}
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stop = true;
+        }
+        queueChanged.notify_all();
+        for(std::thread& thread : decompressionThreads){thread.join();}
+        decompressionThreads.clear();
+        if(file != nullptr){std::fclose(file); file = nullptr;}
+        if(gzFp != nullptr){gzclose(gzFp); gzFp = nullptr;}
+    }
+
+    private:
+
+    enum class Format {Plain, Gzip, Bgzf, Zstd};
+
+    //file descriptor of stdin (in binary mode)
+    static int standard_input()
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        return _fileno(stdin);
+#else
+        return fileno(stdin);
+#endif
+    }
+
+    //the format is taken from the first bytes of the file: BGZF is a gzip member with the extra subfield 'BC'
+    static bool detect_format(const std::string& fileName, Format& format)
+    {
+        FILE* fp = std::fopen(fileName.c_str(), "rb");
+        if(fp == nullptr){return false;}
+        unsigned char header[18];
+        const size_t headerLength = std::fread(header, 1, sizeof(header), fp);
+        std::fclose(fp);
+
+        format = Format::Plain;
+        if(headerLength >= 4 && header[0] == 0x28 && header[1] == 0xb5 && header[2] == 0x2f && header[3] == 0xfd)
+        {
+            format = Format::Zstd;
+        }
+        else if(headerLength >= 10 && header[0] == 0x1f && header[1] == 0x8b)
+        {
+            format = Format::Gzip;
+            const bool extraField = (header[3] & 4);
+            if(extraField && headerLength == 18 && header[12] == 'B' && header[13] == 'C'){format = Format::Bgzf;}
+        }
+        return true;
+    }
+
+    //waits for the next chunk in the order of the file, false at the end of the file
+    bool next_chunk()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [this]()
+        {
+            return readyChunks.count(consumedChunks) || (lastChunk >= 0 && consumedChunks > static_cast<size_t>(lastChunk));
+        });
+        std::map<size_t, std::string>::iterator chunk = readyChunks.find(consumedChunks);
+        if(chunk == readyChunks.end()){return false;}
+        currentChunk.swap(chunk->second);
+        currentPosition = 0;
+        readyChunks.erase(chunk);
+        ++consumedChunks;
+        lock.unlock();
+        queueChanged.notify_all();
+        return true;
+    }
+
+    //waits until the chunk with the next number fits into the queue (called with the file locked), false if the stream is closed
+    bool reserve_chunk(size_t& chunkIdx)
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueChanged.wait(lock, [this](){return stop || nextChunk < consumedChunks + maxChunks;});
+        if(stop){return false;}
+        chunkIdx = nextChunk++;
+        return true;
+    }
+
+    void publish_chunk(const size_t chunkIdx, std::string& data, const bool last)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            readyChunks[chunkIdx].swap(data);
+            if(last){lastChunk = static_cast<long long>(chunkIdx);}
+        }
+        queueChanged.notify_all();
+    }
+
+    //read-ahead thread for gzip (gzread handles several members) and uncompressed files
+    void decompress_gzip()
+    {
+        bool last = false;
+        while(!last)
+        {
+            size_t chunkIdx;
+            if(!reserve_chunk(chunkIdx)){return;}
+            std::string data(readAheadChunkSize, '\0');
+            const int bytes = gzread(gzFp, &data[0], static_cast<unsigned>(readAheadChunkSize));
+            if(bytes < 0)
+            {
+                int error;
+                std::cerr << "Error decompressing the input file: " << gzerror(gzFp, &error) << "\n";
+                exit(EXIT_FAILURE);
+            }
+            data.resize(bytes);
+            last = (static_cast<size_t>(bytes) < readAheadChunkSize);
+            compressedOffset = static_cast<long long>(gzoffset(gzFp));
+            publish_chunk(chunkIdx, data, last);
+        }
+    }
+
+#ifdef WITH_ZSTD
+    //read-ahead thread for zstd: the streaming decoder fills one chunk after the other (frames follow each other in the file)
+    void decompress_zstd()
+    {
+        ZSTD_DStream* stream = ZSTD_createDStream();
+        if(stream == nullptr)
+        {
+            std::cerr << "Error initializing the decompression of the input file\n";
+            exit(EXIT_FAILURE);
+        }
+        std::vector<char> input(ZSTD_DStreamInSize());
+        ZSTD_inBuffer in{input.data(), 0, 0};
+        size_t frameStatus = 0; //0 once a frame is complete
+        bool last = false;
+        while(!last)
+        {
+            size_t chunkIdx;
+            if(!reserve_chunk(chunkIdx)){break;}
+            std::string data(readAheadChunkSize, '\0');
+            ZSTD_outBuffer out{&data[0], data.size(), 0};
+            while(out.pos < out.size)
+            {
+                //the decoder first writes what it still holds, it needs more input once it consumed all and did not fill the chunk
+                frameStatus = ZSTD_decompressStream(stream, &out, &in);
+                if(ZSTD_isError(frameStatus))
+                {
+                    std::cerr << "Error decompressing the input file: " << ZSTD_getErrorName(frameStatus) << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                if(out.pos < out.size && in.pos == in.size)
+                {
+                    in.size = std::fread(input.data(), 1, input.size(), file);
+                    in.pos = 0;
+                    compressedOffset += static_cast<long long>(in.size);
+                    if(in.size == 0){last = true; break;}
+                }
+            }
+            if(last && frameStatus != 0)
+            {
+                std::cerr << "Error: the zstd compressed input file is truncated\n";
+                exit(EXIT_FAILURE);
+            }
+            data.resize(out.pos);
+            publish_chunk(chunkIdx, data, last);
+        }
+        ZSTD_freeDStream(stream);
+    }
+#endif
+
+    //BGZF threads: read the next run of blocks (one thread at a time), inflate them in parallel
+    void decompress_bgzf()
+    {
+        z_stream stream{};
+        if(inflateInit2(&stream, -15) != Z_OK)
+        {
+            std::cerr << "Error initializing the decompression of the input file\n";
+            exit(EXIT_FAILURE);
+        }
+        std::vector<std::string> blocks;
+        std::string data;
+        while(true)
+        {
+            size_t chunkIdx;
+            bool last = false;
+            {
+                std::lock_guard<std::mutex> fileLock(fileMutex);
+                if(fileEnd || !reserve_chunk(chunkIdx)){break;}
+                blocks.resize(bgzfBlocksPerChunk);
+                size_t blockNum = 0;
+                while(blockNum < bgzfBlocksPerChunk && read_bgzf_block(blocks[blockNum])){++blockNum;}
+                blocks.resize(blockNum);
+                last = fileEnd = (blockNum < bgzfBlocksPerChunk);
+            }
+
+            data.clear();
+            for(const std::string& block : blocks){inflate_bgzf_block(stream, block, data);}
+            publish_chunk(chunkIdx, data, last);
+        }
+        inflateEnd(&stream);
+    }
+
+    //reads the next block of the file (called with the file locked), false at the end of the file
+    bool read_bgzf_block(std::string& block)
+    {
+        unsigned char header[12];
+        const size_t headerLength = std::fread(header, 1, sizeof(header), file);
+        if(headerLength == 0){return false;}
+        if(headerLength < sizeof(header) || header[0] != 0x1f || header[1] != 0x8b || !(header[3] & 4))
+        {
+            std::cerr << "Error: invalid BGZF block in the input file\n";
+            exit(EXIT_FAILURE);
+        }
+        const size_t extraLength = header[10] | (header[11] << 8);
+        std::string extra(extraLength, '\0');
+        if(std::fread(&extra[0], 1, extraLength, file) != extraLength)
+        {
+            std::cerr << "Error: truncated BGZF block in the input file\n";
+            exit(EXIT_FAILURE);
+        }
+
+        //block size (minus one) from the BC subfield
+        long long blockSize = -1;
+        for(size_t position = 0; position + 4 <= extraLength;)
+        {
+            const size_t subfieldLength = static_cast<unsigned char>(extra[position + 2]) | (static_cast<unsigned char>(extra[position + 3]) << 8);
+            if(extra[position] == 'B' && extra[position + 1] == 'C' && subfieldLength == 2 && position + 6 <= extraLength)
+            {
+                blockSize = (static_cast<unsigned char>(extra[position + 4]) | (static_cast<unsigned char>(extra[position + 5]) << 8)) + 1;
+            }
+            position += 4 + subfieldLength;
+        }
+        const long long remaining = blockSize - static_cast<long long>(sizeof(header) + extraLength);
+        if(blockSize < 0 || remaining < 8)
+        {
+            std::cerr << "Error: invalid BGZF block in the input file (mixed BGZF and gzip members?)\n";
+            exit(EXIT_FAILURE);
+        }
+        block.resize(remaining);
+        if(std::fread(&block[0], 1, remaining, file) != static_cast<size_t>(remaining))
+        {
+            std::cerr << "Error: truncated BGZF block in the input file\n";
+            exit(EXIT_FAILURE);
+        }
+        compressedOffset += blockSize;
+        return true;
+    }
+
+    //inflates the deflate data of a block (followed by CRC32 and the uncompressed size) and appends it to data
+    static void inflate_bgzf_block(z_stream& stream, const std::string& block, std::string& data)
+    {
+        const size_t trailer = block.size() - 8;
+        const unsigned char* footer = reinterpret_cast<const unsigned char*>(block.data()) + trailer;
+        const uint32_t crc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | (static_cast<uint32_t>(footer[3]) << 24);
+        const size_t blockLength = footer[4] | (footer[5] << 8) | (footer[6] << 16) | (static_cast<uint32_t>(footer[7]) << 24);
+        if(blockLength > maxBgzfBlockSize)
+        {
+            std::cerr << "Error: invalid BGZF block in the input file\n";
+            exit(EXIT_FAILURE);
+        }
+
+        const size_t start = data.size();
+        data.resize(start + blockLength);
+        inflateReset(&stream);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(block.data()));
+        stream.avail_in = static_cast<uInt>(trailer);
+        stream.next_out = reinterpret_cast<Bytef*>(&data[start]);
+        stream.avail_out = static_cast<uInt>(blockLength);
+        const int status = inflate(&stream, Z_FINISH);
+        if(status != Z_STREAM_END || stream.avail_out != 0 ||
+           crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data.data() + start), static_cast<uInt>(blockLength)) != crc)
+        {
+            std::cerr << "Error: corrupted BGZF block in the input file\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    //input file (BGZF: read by the thread holding fileMutex, zstd: by the read-ahead thread, gzip and uncompressed files: gzFp)
+    FILE* file = nullptr;
+    gzFile gzFp = nullptr;
+    std::mutex fileMutex;
+    bool fileEnd = false;
+    std::atomic<long long> compressedOffset{0};
+    std::vector<std::thread> decompressionThreads;
+
+    //decompressed chunks by their number in the file, at most maxChunks ahead of the chunk that is parsed
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::map<size_t, std::string> readyChunks;
+    size_t nextChunk = 0;
+    size_t consumedChunks = 0;
+    size_t maxChunks = 4;
+    long long lastChunk = -1;
+    bool stop = false;
+
+    //chunk that is parsed right now (only used by the parsing thread)
+    std::string currentChunk;
+    size_t currentPosition = 0;
+};
+
+//read function for kseq
+inline int read_decompressed_input(DecompressedInputStream* stream, void* buffer, const unsigned length)
+{
+    return stream->read(buffer, length);
+}
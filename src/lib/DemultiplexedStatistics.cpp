@@ -90,6 +90,31 @@ void DemultiplexingStats::update(OneLineDemultiplexingStatsPtr lineStatsPtr, boo
 
 }
 
+void DemultiplexingStats::initializePartialStats(const DemultiplexingStats& fullStats)
+{
+    statsLock = std::make_unique<std::mutex>();
+    validPositions = fullStats.validPositions;
+}
+
+void DemultiplexingStats::merge(const DemultiplexingStats& other)
+{
+    perfectMatches += other.perfectMatches;
+    noMatches += other.noMatches;
+    moderateMatches += other.moderateMatches;
+
+    //other has a subset of the keys (partial statistics)
+    for(const auto& [key, value] : other.failedLinesMappingFw){failedLinesMappingFw.at(key) += value;}
+    for(const auto& [key, value] : other.failedLinesMappingRv){failedLinesMappingRv.at(key) += value;}
+    for(const auto& [key, value] : other.insertions){insertions.at(key) += value;}
+    for(const auto& [key, value] : other.deletions){deletions.at(key) += value;}
+    for(const auto& [key, value] : other.substitutions){substitutions.at(key) += value;}
+    for(const auto& [key, value] : other.mismatchNumber)
+    {
+        std::vector<int>& mismatchCounts = mismatchNumber.at(key);
+        for(size_t i = 0; i < value.size(); ++i){mismatchCounts.at(i) += value.at(i);}
+    }
+}
+
 void DemultiplexingStats::write_mm_types(const std::string& outputFile) 
 {
     std::ofstream out(outputFile);
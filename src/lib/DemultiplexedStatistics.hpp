@@ -53,12 +53,17 @@ class DemultiplexingStats{
     public:     
 
         void initializeStats(const MultipleBarcodePatternVectorPtr& barcodePatternList);
+        //statistics for a part of the reads (e.g., of one worker thread) that are merged into fullStats later:
+        //only barcodes that are found in these reads get an entry
+        void initializePartialStats(const DemultiplexingStats& fullStats);
         void update(OneLineDemultiplexingStatsPtr lineStatsPtr, bool result, std::string& foundPatternName, std::vector<std::string>& barcodeList);
         
         void write_mm_number(const std::string& outputFile);
         void write_last_mapped_position(const std::string& outputFile);
         void write_mm_types(const std::string& outputFile);
         void write(const std::string& directory, const std::string& prefix, const int patternNumber);
+        //adds the counts of other (initialized with the same patterns or partial statistics of them, e.g., of one worker thread)
+        void merge(const DemultiplexingStats& other);
 
         //UPDATE FUNCTIONS
         void update_failedLinesMapping(std::pair<std::string, int> failedFw, std::pair<std::string, int> failedRv)
@@ -70,7 +75,7 @@ class DemultiplexingStats{
             {
                 //key is <PATTERN>_<LastMappedPosition>
                 std::string keyFw = failedFw.first + "_" + std::to_string(failedFw.second);
-                ++failedLinesMappingFw.at(keyFw);
+                ++failedLinesMappingFw[keyFw];
             }
 
             //if there was an error
@@ -79,7 +84,7 @@ class DemultiplexingStats{
             {
                 //key is <PATTERN>_<LastMappedPosition>
                 std::string keyRv = failedRv.first + "_" + std::to_string(failedRv.second);
-                ++failedLinesMappingRv.at(keyRv);
+                ++failedLinesMappingRv[keyRv];
             }
         }
 
@@ -107,21 +112,21 @@ class DemultiplexingStats{
             for (int validBarcodePos : validPositions.at(foundPatternName)) 
             {
                 std::string key = foundPatternName + "_" + std::to_string(validBarcodePos) + "_" + barcodeList.at(validBarcodePos);
-                insertions.at(key) += lineStatsPtr->insertions.at(validBarcodePos);
+                insertions[key] += lineStatsPtr->insertions.at(validBarcodePos);
             }
             
             //update deletions
             for (int validBarcodePos : validPositions.at(foundPatternName)) 
             {
                 std::string key = foundPatternName + "_" + std::to_string(validBarcodePos) + "_" + barcodeList.at(validBarcodePos);
-                deletions.at(key) += lineStatsPtr->deletions.at(validBarcodePos);
+                deletions[key] += lineStatsPtr->deletions.at(validBarcodePos);
             }
 
             //update substitutions
             for (int validBarcodePos : validPositions.at(foundPatternName)) 
             {
                 std::string key = foundPatternName + "_" + std::to_string(validBarcodePos) + "_" + barcodeList.at(validBarcodePos);
-                substitutions.at(key) += lineStatsPtr->substitutions.at(validBarcodePos);
+                substitutions[key] += lineStatsPtr->substitutions.at(validBarcodePos);
             }
 
         }
@@ -144,7 +149,10 @@ class DemultiplexingStats{
 
                 //the value of the map mismatchNumber is a vector of the length of potential mismatches +1
                 //we need to increment the count at the specific position for the number of mismatches
-                ++(mismatchNumber.at(key)).at(mmSum);
+                //(partial statistics only grow it up to the mismatches that were found)
+                std::vector<int>& mismatchCounts = mismatchNumber[key];
+                if(static_cast<int>(mismatchCounts.size()) <= mmSum){mismatchCounts.resize(mmSum + 1, 0);}
+                ++mismatchCounts.at(mmSum);
 
             }
         }
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "DemultiplexedLine.hpp"
+
+//uncompressed input (fastq or txt with one read per line) that is memory mapped and parsed by several threads:
+//the file is split into chunks of a few MB, a thread finds the first record that starts in its chunk and parses all records
+//that start in the chunk into a batch of reads. The batches are passed on in the order of the file (and are recycled, the strings
+//of the reads keep their memory). Not available on Windows (open returns false and the file is read as stream).
+class MappedInputFile
+{
+    public:
+
+    enum class Format {Fastq, Lines};
+
+    static const size_t chunkSize = 4 << 20;
+
+    MappedInputFile() = default;
+    MappedInputFile(const MappedInputFile&) = delete;
+    MappedInputFile& operator=(const MappedInputFile&) = delete;
+    ~MappedInputFile(){close();}
+
+    //maps the file and starts parsing it with threads threads, false if the file can not be mapped
+    bool open(const std::string& fileName, const Format fileFormat, const int threads)
+    {
+#ifdef _WIN32
+        (void)fileName; (void)fileFormat; (void)threads;
+        return false;
+#else
+        const int fd = ::open(fileName.c_str(), O_RDONLY);
+        if(fd < 0){return false;}
+        struct stat fileStat;
+        if(fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+        {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(fileStat.st_size);
+        if(size > 0)
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapping == MAP_FAILED)
+            {
+                ::close(fd);
+                return false;
+            }
+            data = static_cast<const char*>(mapping);
+            madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+
+        format = fileFormat;
+        chunkNum = (size + chunkSize - 1) / chunkSize;
+        const int threadNum = std::max(1, std::min(threads, static_cast<int>(std::max<size_t>(chunkNum, 1))));
+        maxChunks = 2*threadNum + 2;
+        for(int i = 0; i < threadNum; ++i){parsingThreads.emplace_back(&MappedInputFile::parse_chunks, this);}
+        return true;
+#endif
+    }
+
+    //the strings of the next read are swapped into read, false at the end of the file
+    bool next_read(fastqLine& read)
+    {
+        while(position == currentBatch.size())
+        {
+            if(!next_batch()){return false;}
+        }
+        std::swap(read, currentBatch[position]);
+        ++position;
+        return true;
+    }
+
+    //bytes of the chunks that were parsed so far
+    long long bytes_read() const {return static_cast<long long>(std::min(size, consumedBytes.load()));}
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stop = true;
+        }
+        queueChanged.notify_all();
+        for(std::thread& thread : parsingThreads){thread.join();}
+        parsingThreads.clear();
+#ifndef _WIN32
+        if(data != nullptr){munmap(const_cast<char*>(data), size);}
+#endif
+        data = nullptr;
+    }
+
+    private:
+
+    //waits for the batch of the next chunk, false at the end of the file
+    bool next_batch()
+    {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        freeBatches.push_back(std::move(currentBatch));
+        queueChanged.wait(lock, [this](){return readyBatches.count(consumedChunks) || consumedChunks == chunkNum;});
+        if(consumedChunks == chunkNum)
+        {
+            currentBatch.clear();
+            position = 0;
+            return false;
+        }
+        std::map<size_t, std::vector<fastqLine>>::iterator batch = readyBatches.find(consumedChunks);
+        currentBatch = std::move(batch->second);
+        readyBatches.erase(batch);
+        position = 0;
+        ++consumedChunks;
+        consumedBytes = consumedChunks * chunkSize;
+        lock.unlock();
+        queueChanged.notify_all();
+        return true;
+    }
+
+    void parse_chunks()
+    {
+        while(true)
+        {
+            size_t chunkIdx;
+            std::vector<fastqLine> batch;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueChanged.wait(lock, [this](){return stop || nextChunk == chunkNum || nextChunk < consumedChunks + maxChunks;});
+                if(stop || nextChunk == chunkNum){return;}
+                chunkIdx = nextChunk++;
+                if(!freeBatches.empty())
+                {
+                    batch = std::move(freeBatches.back());
+                    freeBatches.pop_back();
+                }
+            }
+
+            const size_t start = chunkIdx * chunkSize;
+            const size_t end = std::min(size, start + chunkSize);
+            size_t readNum = 0;
+            if(format == Format::Fastq){parse_fastq(start, end, batch, readNum);}
+            else{parse_lines(start, end, batch, readNum);}
+            batch.resize(readNum);
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                readyBatches[chunkIdx] = std::move(batch);
+            }
+            queueChanged.notify_all();
+        }
+    }
+
+    //end of the line starting at position (position of '\n' or the end of the file)
+    size_t line_end(const size_t position) const
+    {
+        const void* newLine = (position < size) ? std::memchr(data + position, '\n', size - position) : nullptr;
+        return newLine ? static_cast<size_t>(static_cast<const char*>(newLine) - data) : size;
+    }
+
+    //length of a line without '\r'
+    size_t line_length(const size_t position, const size_t end) const
+    {
+        return (end > position && data[end - 1] == '\r') ? end - position - 1 : end - position;
+    }
+
+    fastqLine& next_batch_read(std::vector<fastqLine>& batch, size_t& readNum)
+    {
+        if(readNum == batch.size()){batch.emplace_back();}
+        return batch[readNum++];
+    }
+
+    //txt: every line is a read, a chunk has all lines that start in it
+    void parse_lines(const size_t start, const size_t end, std::vector<fastqLine>& batch, size_t& readNum)
+    {
+        size_t position = start;
+        if(position > 0){position = line_end(position - 1) + 1;}
+        while(position < end)
+        {
+            const size_t lineEnd = line_end(position);
+            next_batch_read(batch, readNum).line.assign(data + position, lineEnd - position);
+            position = lineEnd + 1;
+        }
+    }
+
+    //a record starts at position if the line starts with '@', its third line starts with '+' and sequence and quality have the same length
+    //(a quality line that starts with '@' is followed by a header and a sequence line, which do not start with '+')
+    bool is_record_start(const size_t position) const
+    {
+        if(position >= size || data[position] != '@'){return false;}
+        const size_t sequenceStart = line_end(position) + 1;
+        const size_t sequenceEnd = line_end(sequenceStart);
+        const size_t plusStart = sequenceEnd + 1;
+        if(plusStart >= size || data[plusStart] != '+'){return false;}
+        const size_t qualityStart = line_end(plusStart) + 1;
+        return line_length(sequenceStart, sequenceEnd) == line_length(qualityStart, line_end(qualityStart));
+    }
+
+    //fastq: every record has four lines, a chunk has all records that start in it
+    void parse_fastq(const size_t start, const size_t end, std::vector<fastqLine>& batch, size_t& readNum)
+    {
+        size_t position = start;
+        if(position > 0)
+        {
+            position = line_end(position - 1) + 1;
+            while(position < end && !is_record_start(position)){position = line_end(position) + 1;}
+        }
+        while(position < end)
+        {
+            const size_t nameEnd = line_end(position);
+            const size_t sequenceStart = nameEnd + 1;
+            const size_t sequenceEnd = line_end(sequenceStart);
+            const size_t plusStart = sequenceEnd + 1;
+            const size_t qualityStart = line_end(plusStart) + 1;
+            const size_t qualityEnd = line_end(qualityStart);
+            const size_t sequenceLength = line_length(sequenceStart, sequenceEnd);
+            const size_t qualityLength = line_length(qualityStart, qualityEnd);
+            //empty lines at the end of the file
+            if(data[position] == '\n' || data[position] == '\r')
+            {
+                position = nameEnd + 1;
+                continue;
+            }
+            if(data[position] != '@' || plusStart >= size || data[plusStart] != '+' || sequenceLength != qualityLength)
+            {
+                std::cerr << "Error: invalid fastq record at byte " << position << " of the input file "
+                          << "(a record must have four lines: @name, sequence, +, quality of the same length as the sequence)\n";
+                exit(EXIT_FAILURE);
+            }
+
+            //the name ends at the first white space (as in kseq)
+            size_t nameLength = 0;
+            while(position + 1 + nameLength < nameEnd && !std::isspace(static_cast<unsigned char>(data[position + 1 + nameLength]))){++nameLength;}
+
+            fastqLine& read = next_batch_read(batch, readNum);
+            read.name.assign(data + position + 1, nameLength);
+            read.line.assign(data + sequenceStart, sequenceLength);
+            read.quality.assign(data + qualityStart, qualityLength);
+            position = qualityEnd + 1;
+        }
+    }
+
+    const char* data = nullptr;
+    size_t size = 0;
+    Format format = Format::Fastq;
+    size_t chunkNum = 0;
+    std::vector<std::thread> parsingThreads;
+
+    //batches by the number of their chunk, at most maxChunks ahead of the chunk that is read
+    std::mutex queueMutex;
+    std::condition_variable queueChanged;
+    std::map<size_t, std::vector<fastqLine>> readyBatches;
+    std::vector<std::vector<fastqLine>> freeBatches;
+    size_t nextChunk = 0;
+    size_t consumedChunks = 0;
+    size_t maxChunks = 4;
+    std::atomic<size_t> consumedBytes{0};
+    bool stop = false;
+
+    //batch that is read right now (only used by the reading thread)
+    std::vector<fastqLine> currentBatch;
+    size_t position = 0;
+};
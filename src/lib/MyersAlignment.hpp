@@ -0,0 +1,292 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+#include "helper.hpp"
+
+//edits of one alignment of the batch aligner
+struct MyersAlignmentResult
+{
+    bool found = false;
+    int targetEnd = 0;
+    int delNum = 0;
+    int insNum = 0;
+    int substNum = 0;
+};
+
+//precomputed pattern profile (match bitmasks of A,C,G,T) for a single-word Myers/Hyyroe bit-vector alignment.
+//Constant and variable barcodes are at most 64 bases, their alignment fits into one machine word and does not need
+//the edlib setup (Peq tables, mallocs) for every alignment.
+//
+//The alignment is the same as run_alignment with EDLIB_MODE_SHW and EDLIB_TASK_PATH: the pattern is aligned to a prefix of the target,
+//the end is the first position with the lowest edit distance, and the traceback follows edlib (insertion to target, deletion from
+//target, then match/mismatch). Edits are counted as in run_alignment (edits at the end of the alignment are counted as substitutions).
+//Patterns longer than 64 bases (or with other bases than ACGT) are not usable, they are aligned with edlib.
+class MyersPattern
+{
+    public:
+
+    //longest target for which the DP columns are kept on the stack for the traceback
+    static const int maxTargetLength = 256;
+    //number of targets aligned at once by align_batch (one target per lane), and their maximal length.
+    //8 lanes of 64-bit words fill one AVX-512 register (two AVX2 registers), more lanes were not faster
+    static const int batchLanes = 8;
+    static const int maxBatchTargetLength = 128;
+
+    MyersPattern(const std::string& pattern)
+    : length(static_cast<int>(pattern.size()))
+    {
+        usable = (length > 0 && length <= 64);
+        for(int i = 0; i < length && usable; ++i)
+        {
+            const int code = base_code(pattern[i]);
+            if(code < 0){usable = false; break;}
+            peq[code] |= (uint64_t(1) << i);
+        }
+    }
+
+    bool is_usable() const {return usable;}
+
+    //semi-global edit distance of the pattern to a prefix of the target (-1 if it is bigger than k, k < 0 means no limit)
+    int distance(const char* target, const int targetLength, const int k) const
+    {
+        uint64_t pv = row_mask(length);
+        uint64_t mv = 0;
+        const uint64_t highBit = uint64_t(1) << (length - 1);
+        int score = length;
+        int bestScore = score;
+        for(int j = 0; j < targetLength; ++j)
+        {
+            step(target[j], pv, mv, highBit, score);
+            if(score < bestScore){bestScore = score;}
+        }
+        return (k >= 0 && bestScore > k) ? -1 : bestScore;
+    }
+
+    //aligns the pattern to the target, adds the edits and the number of aligned target bases to the counters (like run_alignment)
+    bool align(const char* target, const int targetLength, const int k,
+               int& targetEnd, int& delNum, int& insNum, int& substNum) const
+    {
+        //vertical deltas of every DP column (column 0 is the empty target prefix)
+        uint64_t pvColumns[maxTargetLength + 1];
+        uint64_t mvColumns[maxTargetLength + 1];
+
+        uint64_t pv = row_mask(length);
+        uint64_t mv = 0;
+        pvColumns[0] = pv;
+        mvColumns[0] = mv;
+        const uint64_t highBit = uint64_t(1) << (length - 1);
+        int score = length;
+        int bestScore = score;
+        int bestColumn = 0;
+        for(int j = 0; j < targetLength; ++j)
+        {
+            step(target[j], pv, mv, highBit, score);
+            pvColumns[j + 1] = pv;
+            mvColumns[j + 1] = mv;
+            if(score < bestScore){bestScore = score; bestColumn = j + 1;}
+        }
+        if(k >= 0 && bestScore > k){return false;}
+
+        traceback(pvColumns, mvColumns, 1, target, bestColumn, bestScore, targetEnd, delNum, insNum, substNum);
+        return true;
+    }
+
+    //aligns the pattern to several targets at once (at most batchLanes targets of at most maxBatchTargetLength bases),
+    //with the same result as align for every target. The DP columns of all targets are stored as structure of arrays
+    //(column j of target l is at [j*batchLanes + l]), the lane loops are vectorized by the compiler (one target per SIMD lane).
+    void align_batch(const std::string_view* targets, const int targetNum, const int k, MyersAlignmentResult* results) const
+    {
+        uint64_t pvColumns[(maxBatchTargetLength + 1) * batchLanes];
+        uint64_t mvColumns[(maxBatchTargetLength + 1) * batchLanes];
+
+        //lane state
+        uint64_t pv[batchLanes];
+        uint64_t mv[batchLanes];
+        int64_t score[batchLanes];
+        int64_t bestScore[batchLanes];
+        int64_t bestColumn[batchLanes];
+        int64_t targetLength[batchLanes];
+        uint64_t eq[batchLanes];
+
+        int maxLength = 0;
+        for(int lane = 0; lane < batchLanes; ++lane)
+        {
+            targetLength[lane] = (lane < targetNum) ? static_cast<int64_t>(targets[lane].size()) : 0;
+            maxLength = std::max(maxLength, static_cast<int>(targetLength[lane]));
+            pv[lane] = row_mask(length);
+            mv[lane] = 0;
+            score[lane] = bestScore[lane] = length;
+            bestColumn[lane] = 0;
+            pvColumns[lane] = pv[lane];
+            mvColumns[lane] = mv[lane];
+        }
+
+        const int highBitShift = length - 1;
+        for(int j = 0; j < maxLength; ++j)
+        {
+            //match masks of the next base of every target (lanes with shorter targets are not updated anymore)
+            for(int lane = 0; lane < batchLanes; ++lane)
+            {
+                const int code = (j < targetLength[lane]) ? base_code(targets[lane][j]) : -1;
+                eq[lane] = (code >= 0) ? peq[code] : 0;
+            }
+            uint64_t* pvColumn = &pvColumns[(j + 1) * batchLanes];
+            uint64_t* mvColumn = &mvColumns[(j + 1) * batchLanes];
+            for(int lane = 0; lane < batchLanes; ++lane)
+            {
+                const uint64_t xv = eq[lane] | mv[lane];
+                const uint64_t xh = (((eq[lane] & pv[lane]) + pv[lane]) ^ pv[lane]) | eq[lane];
+                uint64_t ph = mv[lane] | ~(xh | pv[lane]);
+                uint64_t mh = pv[lane] & xh;
+                score[lane] += static_cast<int64_t>((ph >> highBitShift) & 1) - static_cast<int64_t>((mh >> highBitShift) & 1);
+                ph = (ph << 1) | 1;
+                mh <<= 1;
+                pv[lane] = mh | ~(xv | ph);
+                mv[lane] = ph & xv;
+                pvColumn[lane] = pv[lane];
+                mvColumn[lane] = mv[lane];
+
+                const bool better = (j < targetLength[lane]) & (score[lane] < bestScore[lane]);
+                bestScore[lane] = better ? score[lane] : bestScore[lane];
+                bestColumn[lane] = better ? (j + 1) : bestColumn[lane];
+            }
+        }
+
+        for(int lane = 0; lane < targetNum; ++lane)
+        {
+            MyersAlignmentResult& result = results[lane];
+            result = MyersAlignmentResult();
+            result.found = !(k >= 0 && bestScore[lane] > k);
+            if(!result.found){continue;}
+            traceback(&pvColumns[lane], &mvColumns[lane], batchLanes, targets[lane].data(),
+                      static_cast<int>(bestColumn[lane]), static_cast<int>(bestScore[lane]),
+                      result.targetEnd, result.delNum, result.insNum, result.substNum);
+        }
+    }
+
+    private:
+
+    //traceback from the end (same order as counting the edits from the back in run_alignment),
+    //column j of the DP matrix is stored at pvColumns[j*stride]/ mvColumns[j*stride]
+    void traceback(const uint64_t* pvColumns, const uint64_t* mvColumns, const size_t stride, const char* target,
+                   const int bestColumn, const int bestScore,
+                   int& targetEnd, int& delNum, int& insNum, int& substNum) const
+    {
+        int i = length;
+        int j = bestColumn;
+        int cellScore = bestScore;
+        bool replacinglastEdits = true;
+        while(i > 0 || j > 0)
+        {
+            //move up: pattern base that is not in the target (edlib code 1)
+            if(i > 0 && cell_score(pvColumns[j*stride], mvColumns[j*stride], j, i - 1) + 1 == cellScore)
+            {
+                if(replacinglastEdits){++substNum; ++targetEnd;}
+                else{++delNum;}
+                --i;
+                cellScore -= 1;
+            }
+            //move left: target base that is not in the pattern (edlib code 2)
+            else if(j > 0 && cell_score(pvColumns[(j - 1)*stride], mvColumns[(j - 1)*stride], j - 1, i) + 1 == cellScore)
+            {
+                if(replacinglastEdits){++substNum;}
+                else{++insNum;}
+                ++targetEnd;
+                --j;
+                cellScore -= 1;
+            }
+            //move diagonal: match or substitution
+            else
+            {
+                const bool match = (base_code(target[j - 1]) >= 0) && ((peq[base_code(target[j - 1])] >> (i - 1)) & 1);
+                if(match){replacinglastEdits = false;}
+                else
+                {
+                    ++substNum;
+                    cellScore -= 1;
+                }
+                ++targetEnd;
+                --i;
+                --j;
+            }
+        }
+    }
+
+    static int base_code(const char base)
+    {
+        switch (base)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    static uint64_t row_mask(const int rows)
+    {
+        return (rows >= 64) ? ~uint64_t(0) : ((uint64_t(1) << rows) - 1);
+    }
+
+    //score of DP cell (row, column): the first row is the column index (deletions in the target at the start are punished)
+    static int cell_score(const uint64_t pv, const uint64_t mv, const int column, const int row)
+    {
+        const uint64_t mask = row_mask(row);
+        return column + __builtin_popcountll(pv & mask) - __builtin_popcountll(mv & mask);
+    }
+
+    //one column of the Myers/Hyyroe algorithm (horizontal delta +1 in the first row), score is the value in the last row
+    void step(const char base, uint64_t& pv, uint64_t& mv, const uint64_t highBit, int& score) const
+    {
+        const int code = base_code(base);
+        const uint64_t eq = (code >= 0) ? peq[code] : 0;
+        const uint64_t xv = eq | mv;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        if(ph & highBit){++score;}
+        else if(mh & highBit){--score;}
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+
+    uint64_t peq[4] = {0, 0, 0, 0};
+    int length;
+    bool usable;
+};
+
+//profiles of a list of patterns (read-only, shared between clones of a barcode)
+typedef std::shared_ptr<const std::vector<MyersPattern>> MyersPatternsPtr;
+
+inline MyersPatternsPtr make_myers_patterns(const std::vector<std::string>& patterns)
+{
+    std::shared_ptr<std::vector<MyersPattern>> profiles = std::make_shared<std::vector<MyersPattern>>();
+    profiles->reserve(patterns.size());
+    for(const std::string& pattern : patterns)
+    {
+        profiles->emplace_back(pattern);
+    }
+    return profiles;
+}
+
+//run_alignment with the bit-vector aligner if the pattern (and target) allow it, otherwise with edlib
+inline bool run_alignment(const MyersPattern& profile, std::string_view pattern, std::string_view target,
+                          int& targetEnd,
+                          const EdlibAlignConfig& config,
+                          int& delNum, int& insNum, int& substNum)
+{
+    if(profile.is_usable() && target.size() <= static_cast<size_t>(MyersPattern::maxTargetLength))
+    {
+        return profile.align(target.data(), static_cast<int>(target.size()), config.k, targetEnd, delNum, insNum, substNum);
+    }
+    return run_alignment(pattern, target, targetEnd, config, delNum, insNum, substNum);
+}
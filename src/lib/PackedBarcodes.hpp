@@ -0,0 +1,309 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#endif
+
+//2-bit packed copy of a barcode whitelist (forward and reverse complement) together with a cheap banded
+//lower bound for the semi-global edit distance (EDLIB_MODE_SHW) of every barcode against a read.
+//VariableBarcode uses it to skip barcodes that can never be accepted before calling edlib.
+//
+//LOWER BOUND: in any alignment with <= k edits the i-th base of the barcode can only be matched to a base of the read
+//at position i-k...i+k. Every barcode base that has no equal base in this window must therefore be a substitution or insertion,
+//the number of such bases is a lower bound for the edit distance (as long as the distance is <= k).
+//The bound is computed for all positions at once on the 2-bit words (XOR of the barcode with shifted copies of the read),
+//and for several barcodes at once with AVX2/SSE2 (scalar fallback otherwise).
+class PackedBarcodeWhitelist
+{
+    public:
+
+    //number of barcodes for which lower bounds are calculated in one call
+    static constexpr size_t blockSize = 64;
+
+    PackedBarcodeWhitelist(const std::vector<std::string>& barcodes, const std::vector<std::string>& revCompBarcodes, const int band)
+    : band(band)
+    {
+        //a bigger band is not worth filtering (nearly every barcode would pass anyways)
+        usable = (band >= 0 && band <= maxBand && !barcodes.empty());
+        for(size_t i = 0; i < barcodes.size() && usable; ++i)
+        {
+            uint64_t fwWord, rvWord;
+            if(barcodes.at(i).size() > 32 || barcodes.at(i).empty() ||
+               !pack(barcodes.at(i), fwWord) || !pack(revCompBarcodes.at(i), rvWord))
+            {
+                //barcodes with other bases than ACGT or longer than 32 bases are not packed, we simply align all of them
+                usable = false;
+                break;
+            }
+            fwWords.push_back(fwWord);
+            rvWords.push_back(rvWord);
+            lengthMasks.push_back(position_mask(barcodes.at(i).size()));
+        }
+        //pad to a multiple of blockSize, padded barcodes have an empty length mask and never matter
+        while(usable && fwWords.size() % blockSize != 0)
+        {
+            fwWords.push_back(0);
+            rvWords.push_back(0);
+            lengthMasks.push_back(0);
+        }
+    }
+
+    bool is_usable() const {return usable;}
+
+    //writes the lower bounds of the barcodes [blockStart, blockStart+blockSize) into lowerBounds
+    //fastqLine and targetOffset are the same as in Barcode::align
+    void lower_bounds(std::string_view fastqLine, const unsigned int targetOffset, const bool reverse,
+                      const size_t blockStart, uint8_t* lowerBounds) const
+    {
+        //packed read for every shift of the band (low bit of each 2-bit pair in valid marks positions inside the read)
+        uint64_t shiftedRead[maxShifts];
+        uint64_t shiftedValid[maxShifts];
+        const int shiftNum = pack_read_shifts(fastqLine, targetOffset, shiftedRead, shiftedValid);
+
+        const uint64_t* words = reverse ? &rvWords[blockStart] : &fwWords[blockStart];
+        compute_bounds(words, &lengthMasks[blockStart], blockSize, shiftedRead, shiftedValid, shiftNum, lowerBounds);
+    }
+
+    //same as above for a list of (at most blockSize) barcode IDs, e.g. candidates of an index
+    void lower_bounds(std::string_view fastqLine, const unsigned int targetOffset, const bool reverse,
+                      const uint32_t* barcodeIds, const size_t barcodeNum, uint8_t* lowerBounds) const
+    {
+        uint64_t shiftedRead[maxShifts];
+        uint64_t shiftedValid[maxShifts];
+        const int shiftNum = pack_read_shifts(fastqLine, targetOffset, shiftedRead, shiftedValid);
+
+        uint64_t words[blockSize];
+        uint64_t masks[blockSize];
+        const std::vector<uint64_t>& packedWords = reverse ? rvWords : fwWords;
+        for(size_t i = 0; i < barcodeNum; ++i)
+        {
+            words[i] = packedWords[barcodeIds[i]];
+            masks[i] = lengthMasks[barcodeIds[i]];
+        }
+        compute_bounds(words, masks, barcodeNum, shiftedRead, shiftedValid, shiftNum, lowerBounds);
+    }
+
+    //prepares lower bounds between barcodes of the whitelist (every barcode used as a read starting at offset 0), used for
+    //the conversion rates between barcodes. Must be called before the whitelist is shared between threads.
+    void prepare_pairwise_bounds(const std::vector<std::string>& barcodes)
+    {
+        if(!usable){return;}
+        const size_t barcodeNum = fwWords.size();
+        pairShiftNum = 2*band + 1;
+        pairShiftedWords.assign(pairShiftNum * barcodeNum, 0);
+        pairShiftedValid.assign(pairShiftNum * barcodeNum, 0);
+        uint64_t shiftedRead[maxShifts];
+        uint64_t shiftedValid[maxShifts];
+        for(size_t j = 0; j < barcodes.size(); ++j)
+        {
+            pack_read_shifts(barcodes.at(j), 0, shiftedRead, shiftedValid);
+            for(int s = 0; s < pairShiftNum; ++s)
+            {
+                pairShiftedWords[s * barcodeNum + j] = shiftedRead[s];
+                pairShiftedValid[s * barcodeNum + j] = shiftedValid[s];
+            }
+        }
+    }
+
+    //lower bounds of the distance between barcode patternId (as pattern) and all barcodes (as read),
+    //lowerBounds must have space for the padded number of barcodes (multiple of blockSize)
+    void pairwise_lower_bounds(const size_t patternId, uint8_t* lowerBounds) const
+    {
+        const size_t barcodeNum = fwWords.size();
+        const uint64_t word = fwWords[patternId];
+        const uint64_t mask = lengthMasks[patternId];
+        size_t j = 0;
+#if defined(__AVX2__)
+        const __m256i lowBits = _mm256_set1_epi64x((long long)0x5555555555555555ULL);
+        const __m256i barcodeWord = _mm256_set1_epi64x((long long)word);
+        const __m256i barcodeMask = _mm256_set1_epi64x((long long)mask);
+        for(; j + 4 <= barcodeNum; j += 4)
+        {
+            __m256i matched = _mm256_setzero_si256();
+            for(int s = 0; s < pairShiftNum; ++s)
+            {
+                const __m256i readWords = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&pairShiftedWords[s * barcodeNum + j]));
+                const __m256i readValid = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&pairShiftedValid[s * barcodeNum + j]));
+                const __m256i diff = _mm256_xor_si256(barcodeWord, readWords);
+                const __m256i equal = _mm256_andnot_si256(_mm256_or_si256(diff, _mm256_srli_epi64(diff, 1)), lowBits);
+                matched = _mm256_or_si256(matched, _mm256_and_si256(equal, readValid));
+            }
+            alignas(32) uint64_t unmatched[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(unmatched), _mm256_andnot_si256(matched, barcodeMask));
+            for(int lane = 0; lane < 4; ++lane){lowerBounds[j + lane] = count_bound(unmatched[lane]);}
+        }
+#endif
+        for(; j < barcodeNum; ++j)
+        {
+            uint64_t matched = 0;
+            for(int s = 0; s < pairShiftNum; ++s)
+            {
+                const uint64_t diff = word ^ pairShiftedWords[s * barcodeNum + j];
+                matched |= ~(diff | (diff >> 1)) & 0x5555555555555555ULL & pairShiftedValid[s * barcodeNum + j];
+            }
+            lowerBounds[j] = count_bound(mask & ~matched);
+        }
+    }
+
+    //number of barcodes including padding
+    size_t padded_size() const {return fwWords.size();}
+
+    private:
+
+    //called once per block of barcodes, not inlined (inlined into the alignment loop gcc reports a bogus
+    //-Waggressive-loop-optimizations warning for the remainder loop)
+    __attribute__((noinline)) static void compute_bounds(const uint64_t* words, const uint64_t* masks, const size_t barcodeNum,
+                               const uint64_t* shiftedRead, const uint64_t* shiftedValid, const int shiftNum, uint8_t* lowerBounds)
+    {
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        const __m256i lowBits = _mm256_set1_epi64x((long long)0x5555555555555555ULL);
+        for(; i + 4 <= barcodeNum; i += 4)
+        {
+            const __m256i barcodeWords = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+            __m256i matched = _mm256_setzero_si256();
+            for(int s = 0; s < shiftNum; ++s)
+            {
+                const __m256i diff = _mm256_xor_si256(barcodeWords, _mm256_set1_epi64x((long long)shiftedRead[s]));
+                const __m256i equal = _mm256_andnot_si256(_mm256_or_si256(diff, _mm256_srli_epi64(diff, 1)), lowBits);
+                matched = _mm256_or_si256(matched, _mm256_and_si256(equal, _mm256_set1_epi64x((long long)shiftedValid[s])));
+            }
+            alignas(32) uint64_t unmatched[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(unmatched),
+                               _mm256_andnot_si256(matched, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i))));
+            for(int lane = 0; lane < 4; ++lane){lowerBounds[i + lane] = count_bound(unmatched[lane]);}
+        }
+#elif defined(__SSE2__)
+        const __m128i lowBits = _mm_set1_epi64x((long long)0x5555555555555555ULL);
+        for(; i + 2 <= barcodeNum; i += 2)
+        {
+            const __m128i barcodeWords = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+            __m128i matched = _mm_setzero_si128();
+            for(int s = 0; s < shiftNum; ++s)
+            {
+                const __m128i diff = _mm_xor_si128(barcodeWords, _mm_set1_epi64x((long long)shiftedRead[s]));
+                const __m128i equal = _mm_andnot_si128(_mm_or_si128(diff, _mm_srli_epi64(diff, 1)), lowBits);
+                matched = _mm_or_si128(matched, _mm_and_si128(equal, _mm_set1_epi64x((long long)shiftedValid[s])));
+            }
+            alignas(16) uint64_t unmatched[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(unmatched),
+                            _mm_andnot_si128(matched, _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks + i))));
+            lowerBounds[i] = count_bound(unmatched[0]);
+            lowerBounds[i + 1] = count_bound(unmatched[1]);
+        }
+#endif
+        //scalar fallback (and remainder)
+        for(; i < barcodeNum; ++i)
+        {
+            uint64_t matched = 0;
+            for(int s = 0; s < shiftNum; ++s)
+            {
+                const uint64_t diff = words[i] ^ shiftedRead[s];
+                matched |= ~(diff | (diff >> 1)) & 0x5555555555555555ULL & shiftedValid[s];
+            }
+            lowerBounds[i] = count_bound(masks[i] & ~matched);
+        }
+    }
+
+    static const int maxBand = 15;
+    static const int maxShifts = 2*maxBand + 1;
+
+    static inline uint8_t count_bound(const uint64_t unmatched)
+    {
+        return static_cast<uint8_t>(__builtin_popcountll(unmatched));
+    }
+
+    //low bit of the 2-bit pair of each of the first 'length' positions
+    static inline uint64_t position_mask(const size_t length)
+    {
+        uint64_t mask = 0;
+        for(size_t i = 0; i < length && i < 32; ++i){mask |= (1ULL << (2*i));}
+        return mask;
+    }
+
+    static inline int base_code(const char c)
+    {
+        switch (c)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    //position i of the sequence is stored in bits 2i and 2i+1
+    static bool pack(const std::string& seq, uint64_t& word)
+    {
+        word = 0;
+        for(size_t i = 0; i < seq.size(); ++i)
+        {
+            const int code = base_code(seq[i]);
+            if(code < 0){return false;}
+            word |= (static_cast<uint64_t>(code) << (2*i));
+        }
+        return true;
+    }
+
+    //packs the read (starting at targetOffset) once for every shift s in [-band, band], such that position i of word s holds
+    //read base i+s. Bases that are not ACGT (e.g., N) are packed as 'A', this can only make the bound smaller (never wrong).
+    int pack_read_shifts(std::string_view fastqLine, const unsigned int targetOffset,
+                         uint64_t* shiftedRead, uint64_t* shiftedValid) const
+    {
+        const long long readLength = (targetOffset < fastqLine.size()) ? (long long)(fastqLine.size() - targetOffset) : 0;
+
+        //pack read positions [0, 32+band) of the window once
+        const int windowLength = 32 + band;
+        uint64_t window[2] = {0, 0};
+        uint64_t windowValid[2] = {0, 0};
+        for(int j = 0; j < windowLength && j < readLength; ++j)
+        {
+            const int code = std::max(base_code(fastqLine[targetOffset + j]), 0);
+            window[j/32] |= (static_cast<uint64_t>(code) << (2*(j%32)));
+            windowValid[j/32] |= (1ULL << (2*(j%32)));
+        }
+
+        int shiftNum = 0;
+        for(int s = -band; s <= band; ++s)
+        {
+            if(s < 0)
+            {
+                shiftedRead[shiftNum] = window[0] << (2*(-s));
+                shiftedValid[shiftNum] = windowValid[0] << (2*(-s));
+            }
+            else if(s == 0)
+            {
+                shiftedRead[shiftNum] = window[0];
+                shiftedValid[shiftNum] = windowValid[0];
+            }
+            else
+            {
+                shiftedRead[shiftNum] = (window[0] >> (2*s)) | (window[1] << (64 - 2*s));
+                shiftedValid[shiftNum] = (windowValid[0] >> (2*s)) | (windowValid[1] << (64 - 2*s));
+            }
+            ++shiftNum;
+        }
+        return shiftNum;
+    }
+
+    int band;
+    bool usable;
+    //barcodes as 2-bit words, padded to a multiple of blockSize
+    std::vector<uint64_t> fwWords;
+    std::vector<uint64_t> rvWords;
+    std::vector<uint64_t> lengthMasks;
+    //shifted barcodes as reads for pairwise bounds (shift-major: [shift * barcodeNum + barcode])
+    int pairShiftNum = 0;
+    std::vector<uint64_t> pairShiftedWords;
+    std::vector<uint64_t> pairShiftedValid;
+};
+typedef std::shared_ptr<const PackedBarcodeWhitelist> PackedBarcodeWhitelistPtr;
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+
+#include "helper.hpp"
+
+//UMI sequence packed with 2 bits per base (base i in bits 2i and 2i+1), encoded once per UMI before the UMIs of a
+//single cell/ feature are compared to each other. UMIs with other bases than ACGT or longer than 32 bases are not packed,
+//they are compared on their characters.
+struct PackedUmi
+{
+    static const size_t maxPackedLength = 32;
+
+    uint64_t codes = 0;
+    std::string_view sequence;
+    bool packed = false;
+
+    PackedUmi() = default;
+    explicit PackedUmi(const char* umi)
+    : sequence(umi)
+    {
+        packed = (sequence.size() <= maxPackedLength);
+        for(size_t i = 0; i < sequence.size() && packed; ++i)
+        {
+            uint64_t code;
+            switch (sequence[i])
+            {
+                case 'A': code = 0; break;
+                case 'C': code = 1; break;
+                case 'G': code = 2; break;
+                case 'T': code = 3; break;
+                default: packed = false; code = 0; break;
+            }
+            codes |= (code << (2*i));
+        }
+        if(!packed){codes = 0;}
+    }
+};
+
+//longest UMIs for which the fronts are kept on the stack, longer UMIs are aligned with outputSense
+static const unsigned int maxBoundedUmiLength = 64;
+
+//the front algorithm of outputSense (same fronts, same stopping criteria and therefore exactly the same result),
+//but with the fronts on the stack and the previous front kept in a rolling variable instead of copying the whole vector.
+//lcp(row, column) is the longest common prefix of sequence[row...] and pattern[column...] (both positions inside the sequences).
+template<typename LcpFunction>
+inline bool bounded_umi_fronts(const unsigned int m, const unsigned int n, const unsigned int mismatches, unsigned int& score,
+                               const LcpFunction& lcp)
+{
+    unsigned int front[2*maxBoundedUmiLength + 3];
+    std::fill(front, front + m + n + 3, UINT_MAX);
+    const unsigned int offset = m + 1;
+    const unsigned int endDiagonal = n - m + offset;
+
+    front[offset] = (m == 0 || n == 0) ? 0 : lcp(0, 0);
+    if(front[endDiagonal] == m)
+    {
+        score = 0;
+        return true;
+    }
+
+    const unsigned int maxD = std::min(std::max(m, n), mismatches);
+    for(unsigned int d = 1; d <= maxD; ++d)
+    {
+        const unsigned int first = offset - std::min(m, d);
+        const unsigned int last = offset + std::min(n, d);
+        //value of the diagonal below in the previous front (already overwritten in front)
+        unsigned int previousBelow = front[first - 1];
+        for(unsigned int i = first; i <= last; ++i)
+        {
+            const unsigned int previous = front[i];
+            const unsigned int aVal = (previousBelow != UINT_MAX) ? previousBelow : 0;
+            const unsigned int bVal = (front[i + 1] != UINT_MAX) ? front[i + 1] + 1 : 0;
+            const unsigned int cVal = (previous != UINT_MAX) ? previous + 1 : 0;
+            const unsigned int l = std::max(std::max(aVal, bVal), cVal);
+
+            //column index wraps around for diagonals below the main diagonal (as in front)
+            const unsigned int column = i - offset + l;
+            if(l >= m)
+            {
+                front[i] = m;
+            }
+            else if(column < n)
+            {
+                front[i] = l + lcp(l, column);
+            }
+            //otherwise the front keeps its value of an earlier round
+            previousBelow = previous;
+        }
+
+        if(front[endDiagonal] == m)
+        {
+            score = d;
+            return true;
+        }
+    }
+
+    score = mismatches + 1;
+    return false;
+}
+
+//bounded edit distance of two UMIs, returns the same similarity and score as outputSense(a, b, mismatches, score)
+//without any allocation: packed UMIs compare up to 32 bases at once (XOR of the 2-bit codes, the first difference is found with ctz)
+inline bool bounded_umi_distance(const PackedUmi& a, const PackedUmi& b, const unsigned int mismatches, unsigned int& score)
+{
+    const unsigned int m = a.sequence.size();
+    const unsigned int n = b.sequence.size();
+
+    if(a.packed && b.packed)
+    {
+        if(m == n && a.codes == b.codes)
+        {
+            score = 0;
+            return true;
+        }
+        //the diagonal of the end cell is not reached by a front below its length difference
+        if(std::max(m, n) - std::min(m, n) > mismatches)
+        {
+            score = mismatches + 1;
+            return false;
+        }
+        return bounded_umi_fronts(m, n, mismatches, score, [&a, &b, m, n](const unsigned int row, const unsigned int column)
+        {
+            const unsigned int maxLength = std::min(m - row, n - column);
+            const uint64_t diff = (a.codes >> (2*row)) ^ (b.codes >> (2*column));
+            if(diff == 0){return maxLength;}
+            return std::min(maxLength, static_cast<unsigned int>(__builtin_ctzll(diff) / 2));
+        });
+    }
+
+    if(m > maxBoundedUmiLength || n > maxBoundedUmiLength)
+    {
+        return outputSense(std::string(a.sequence), std::string(b.sequence), mismatches, score);
+    }
+    return bounded_umi_fronts(m, n, mismatches, score, [&a, &b, m, n](unsigned int row, unsigned int column)
+    {
+        unsigned int length = 0;
+        while(row < m && column < n && a.sequence[row] == b.sequence[column])
+        {
+            ++length; ++row; ++column;
+        }
+        return length;
+    });
+}
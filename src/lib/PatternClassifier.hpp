@@ -0,0 +1,293 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <numeric>
+
+#include "Barcode.hpp"
+#include "DemultiplexedLine.hpp"
+#include "helper.hpp"
+
+//pre-classification of reads to the barcode patterns they can map to, before mapping every pattern.
+//All k-mers of the constant barcodes of all patterns are stored in one table per read (and k), a read is scanned only once and
+//every k-mer of the read marks the positions of the constant barcodes that contain it.
+//
+//q-gram lemma: if a constant barcode of length L maps with <= e edits, at least L+1-k(e+1) of its k-mers occur in the read.
+//A constant with less hits can not map, and a pattern is only skipped if one of the constants it needs can not map
+//(the result of the mapping therefore does not change). k is chosen per constant as big as possible (up to maxK)
+//such that the bound is positive, constants that are too short for it (or contain other bases than ACGT) are never used to skip a pattern.
+//
+//Which constants a pattern needs depends on the mapping:
+//single-end: all constants before a stop [*], read-end [-] on the read
+//detached paired-end: the same for the forward pattern on the forward read and the reverse pattern on the reverse read
+//paired-end: constants are mapped on the forward read or (reverse complement) on the reverse read, or are missing in between
+//            the mapped parts. Missing constants must be in one run of constants without other barcodes.
+class PatternClassifier
+{
+    public:
+
+    static constexpr int minK = 4;
+    static constexpr int maxK = 8;
+
+    PatternClassifier(const MultipleBarcodePatternVectorPtr& patterns, const input& input)
+    : patternNum(patterns->size())
+    {
+        const bool pairedEnd = !input.reverseFile.empty();
+        const bool detached = pairedEnd && input.detachedReverseMapping;
+        patternElements.resize(patternNum);
+        allowMissingRun.assign(patternNum, pairedEnd && !detached);
+
+        for(size_t patternIdx = 0; patternIdx < patternNum; ++patternIdx)
+        {
+            const BarcodePatternPtr& pattern = patterns->at(patternIdx);
+            if(pairedEnd && !detached)
+            {
+                //every constant is needed in the forward read or the reverse read (reverse complement)
+                int run = 0;
+                for(const BarcodePtr& barcode : *(pattern->barcodePattern))
+                {
+                    if(!barcode->is_constant()){++run; continue;}
+                    const std::string sequence = barcode->get_patterns().at(0);
+                    std::vector<size_t> probes;
+                    if(!add_probe(sequence, barcode->mismatches, 0, probes) ||
+                       !add_probe(Barcode::generate_reverse_complement(sequence), barcode->mismatches, 1, probes))
+                    {
+                        continue;
+                    }
+                    patternElements[patternIdx].push_back({probes, run});
+                }
+            }
+            else
+            {
+                add_needed_constants(*(pattern->barcodePattern), 0, patternElements[patternIdx]);
+                if(detached && pattern->detachedReversePattern)
+                {
+                    add_needed_constants(*(pattern->detachedReversePattern), 1, patternElements[patternIdx]);
+                }
+            }
+        }
+
+        for(int read = 0; read < 2; ++read)
+        {
+            for(int k = minK; k <= maxK; ++k)
+            {
+                build_table(read, k);
+            }
+        }
+
+        usable = false;
+        for(const std::vector<Element>& elements : patternElements){if(!elements.empty()){usable = true;}}
+        usable = usable && (patternNum > 1);
+    }
+
+    //a classifier without any constant (or with only one pattern) is not worth running
+    bool is_usable() const {return usable;}
+    size_t pattern_number() const {return patternNum;}
+
+    //writes the indices of the patterns the read might map to into candidates, in the order of the pattern file
+    //or with the most likely pattern first (most k-mers of its constants found in the read)
+    void classify(const std::pair<fastqLine, fastqLine>& line, std::vector<size_t>& candidates, const bool orderByLikelihood) const
+    {
+        //positions of every probe that were found in the read (scratch of the thread)
+        static thread_local std::vector<uint64_t> foundPositions;
+        foundPositions.assign(probeWords, 0);
+
+        scan(line.first.line, 0, foundPositions);
+        if(!line.second.line.empty()){scan(line.second.line, 1, foundPositions);}
+
+        static thread_local std::vector<int> likelihood;
+        likelihood.assign(patternNum, 0);
+        candidates.clear();
+        for(size_t patternIdx = 0; patternIdx < patternNum; ++patternIdx)
+        {
+            bool plausible = true;
+            int missingRun = -1;
+            int hits = 0;
+            for(const Element& element : patternElements[patternIdx])
+            {
+                bool present = false;
+                for(const size_t probeIdx : element.probes)
+                {
+                    const Probe& probe = probes[probeIdx];
+                    int probeHits = 0;
+                    for(size_t word = 0; word < probe.words; ++word)
+                    {
+                        probeHits += __builtin_popcountll(foundPositions[probe.firstWord + word]);
+                    }
+                    hits += probeHits;
+                    if(probeHits >= probe.threshold){present = true;}
+                }
+                if(present){continue;}
+
+                //a missing constant: only allowed (for paired-end) if all missing constants are in the same run
+                if(!allowMissingRun[patternIdx] || (missingRun >= 0 && missingRun != element.run))
+                {
+                    plausible = false;
+                    break;
+                }
+                missingRun = element.run;
+            }
+            if(!plausible){continue;}
+            candidates.push_back(patternIdx);
+            //patterns without any constant have no evidence and are mapped last
+            likelihood[patternIdx] = patternElements[patternIdx].empty() ? -1 : hits;
+        }
+
+        if(orderByLikelihood)
+        {
+            std::stable_sort(candidates.begin(), candidates.end(), [](const size_t a, const size_t b)
+            {
+                return likelihood[a] > likelihood[b];
+            });
+        }
+    }
+
+    private:
+
+    //k-mers of a constant barcode that are looked up in one of the reads
+    struct Probe
+    {
+        int read;
+        int k;
+        int threshold;
+        size_t firstWord;
+        size_t words;
+        std::string sequence;
+    };
+    //a constant barcode of a pattern: found if one of its probes is found
+    struct Element
+    {
+        std::vector<size_t> probes;
+        int run;
+    };
+
+    //constants that are mapped before the mapping of the pattern stops
+    void add_needed_constants(const BarcodeVector& barcodes, const int read, std::vector<Element>& elements)
+    {
+        int run = 0;
+        for(const BarcodePtr& barcode : barcodes)
+        {
+            if(barcode->is_stop() || barcode->is_read_end() || barcode->is_dna()){break;}
+            if(!barcode->is_constant()){continue;}
+            std::vector<size_t> probeIds;
+            if(add_probe(barcode->get_patterns().at(0), barcode->mismatches, read, probeIds))
+            {
+                elements.push_back({probeIds, run++});
+            }
+        }
+    }
+
+    bool add_probe(const std::string& sequence, const int mismatches, const int read, std::vector<size_t>& probeIds)
+    {
+        const int length = static_cast<int>(sequence.size());
+        const int k = std::min(maxK, length / (std::max(mismatches, 0) + 1));
+        if(k < minK){return false;}
+        for(const char base : sequence){if(base_code(base) < 0){return false;}}
+
+        Probe probe;
+        probe.read = read;
+        probe.k = k;
+        probe.threshold = length + 1 - k*(std::max(mismatches, 0) + 1);
+        probe.firstWord = probeWords;
+        probe.words = (length - k + 1 + 63) / 64;
+        probe.sequence = sequence;
+        probeWords += probe.words;
+        probeIds.push_back(probes.size());
+        probes.push_back(probe);
+        return true;
+    }
+
+    //k-mer table of all probes for one read and k: entries of a k-mer are at [offsets[code], offsets[code+1])
+    struct KmerTable
+    {
+        int read;
+        int k;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> positions; //position of the k-mer, counted over all probe words (word*64 + bit)
+    };
+
+    void build_table(const int read, const int k)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> kmers;
+        for(const Probe& probe : probes)
+        {
+            if(probe.read != read || probe.k != k){continue;}
+            for(size_t start = 0; start + k <= probe.sequence.size(); ++start)
+            {
+                uint32_t code = 0;
+                for(int i = 0; i < k; ++i){code = (code << 2) | base_code(probe.sequence[start + i]);}
+                kmers.emplace_back(code, static_cast<uint32_t>(probe.firstWord*64 + start));
+            }
+        }
+        if(kmers.empty()){return;}
+        std::sort(kmers.begin(), kmers.end());
+
+        KmerTable table;
+        table.read = read;
+        table.k = k;
+        table.offsets.assign((size_t(1) << (2*k)) + 1, 0);
+        for(const std::pair<uint32_t, uint32_t>& kmer : kmers){++table.offsets[kmer.first + 1];}
+        std::partial_sum(table.offsets.begin(), table.offsets.end(), table.offsets.begin());
+        for(const std::pair<uint32_t, uint32_t>& kmer : kmers){table.positions.push_back(kmer.second);}
+        tables.push_back(std::move(table));
+    }
+
+    //one pass over the read: the last maxK bases are kept as 2-bit code, the k-mer of every table is its lower 2k bits
+    void scan(const std::string& sequence, const int read, std::vector<uint64_t>& foundPositions) const
+    {
+        uint32_t code = 0;
+        int validBases = 0;
+        for(const char base : sequence)
+        {
+            const int baseCode = base_code(base);
+            if(baseCode < 0){validBases = 0; continue;}
+            code = (code << 2) | baseCode;
+            ++validBases;
+            for(const KmerTable& table : tables)
+            {
+                if(table.read != read || validBases < table.k){continue;}
+                const uint32_t kmer = code & ((uint32_t(1) << (2*table.k)) - 1);
+                for(uint32_t entry = table.offsets[kmer]; entry < table.offsets[kmer + 1]; ++entry)
+                {
+                    const uint32_t position = table.positions[entry];
+                    foundPositions[position / 64] |= (uint64_t(1) << (position % 64));
+                }
+            }
+        }
+    }
+
+    static int base_code(const char base)
+    {
+        switch (base)
+        {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    size_t patternNum;
+    bool usable;
+    std::vector<Probe> probes;
+    size_t probeWords = 0;
+    std::vector<KmerTable> tables;
+    std::vector<std::vector<Element>> patternElements;
+    std::vector<bool> allowMissingRun;
+};
+typedef std::shared_ptr<const PatternClassifier> PatternClassifierPtr;
+
+//how often every pattern was mapped, skipped by the classifier and finally assigned to a read (shared by all threads)
+struct PatternRoutingStats
+{
+    PatternRoutingStats(const size_t patternNum) : mapped(patternNum), skipped(patternNum), matched(patternNum) {}
+
+    std::vector<std::atomic<unsigned long long>> mapped;
+    std::vector<std::atomic<unsigned long long>> skipped;
+    std::vector<std::atomic<unsigned long long>> matched;
+};
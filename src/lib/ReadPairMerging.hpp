@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+
+#include "DemultiplexedLine.hpp"
+#include "ReverseComplement.hpp"
+
+//merging of the forward and reverse read of a pair whose insert is shorter than the two reads together: the end of the forward read
+//and the start of the reverse complement of the reverse read are the same bases. The overlap is searched with seeds (k-mers at the
+//start of the reverse complement that are looked up in the forward read), every candidate offset is verified with the hamming distance
+//of the whole overlap. In the overlap the base with the higher quality is taken.
+//Pairs with an overlap that is too short, too many mismatches or a reverse read that reaches beyond the start of the forward read
+//(read-through into the adapter) are not merged.
+struct ReadPairMerger
+{
+    static const int seedLength = 12;
+    static const int seedNum = 3; //seeds at the start of the reverse complement (one of them must be without errors)
+    static const int minOverlap = 20;
+    static constexpr double maxMismatchRate = 0.1;
+
+    //merges the read pair into merged (name of the forward read), returns false if the reads do not overlap
+    static bool merge(const fastqLine& fw, const fastqLine& rv, fastqLine& merged)
+    {
+        const int fwLength = static_cast<int>(fw.line.size());
+        const int rvLength = static_cast<int>(rv.line.size());
+        if(fwLength < minOverlap || rvLength < minOverlap){return false;}
+
+        //reverse complement of the reverse read (in a buffer of the thread)
+        static thread_local std::string rvSequence;
+        rvSequence.resize(rvLength);
+        if(!reverse_complement(rv.line, &rvSequence[0])){return false;}
+
+        //offset of the reverse complement in the forward read: the overlap is fw[offset...] and rvSequence[0...fwLength-offset]
+        int bestOffset = -1;
+        int bestMismatches = 0;
+        static thread_local std::vector<int> checkedOffsets;
+        checkedOffsets.clear();
+        for(int seed = 0; seed < seedNum; ++seed)
+        {
+            const int seedStart = seed * seedLength;
+            if(seedStart + seedLength > rvLength){break;}
+            const std::string_view seedSequence(rvSequence.data() + seedStart, seedLength);
+
+            for(size_t hit = fw.line.find(seedSequence); hit != std::string::npos; hit = fw.line.find(seedSequence, hit + 1))
+            {
+                const int offset = static_cast<int>(hit) - seedStart;
+                const int overlap = std::min(fwLength - offset, rvLength);
+                if(offset < 0 || overlap < minOverlap){continue;}
+                if(std::find(checkedOffsets.begin(), checkedOffsets.end(), offset) != checkedOffsets.end()){continue;}
+                checkedOffsets.push_back(offset);
+
+                const int maxMismatches = static_cast<int>(overlap * maxMismatchRate);
+                const int mismatches = hamming_distance(fw.line.data() + offset, rvSequence.data(), overlap, maxMismatches);
+                if(mismatches > maxMismatches){continue;}
+                //the longest overlap wins for the same number of mismatches (repeats in the read)
+                if(bestOffset < 0 || mismatches < bestMismatches || (mismatches == bestMismatches && offset < bestOffset))
+                {
+                    bestOffset = offset;
+                    bestMismatches = mismatches;
+                }
+            }
+        }
+        if(bestOffset < 0){return false;}
+
+        //forward read up to the overlap, consensus of the overlap, rest of the reverse read
+        const int overlap = std::min(fwLength - bestOffset, rvLength);
+        const int mergedLength = std::max(fwLength, bestOffset + rvLength);
+        const bool withQuality = (fw.quality.size() == fw.line.size()) && (rv.quality.size() == rv.line.size());
+        merged.name = fw.name;
+        merged.line.assign(fw.line, 0, bestOffset);
+        merged.line.resize(mergedLength);
+        merged.quality.clear();
+        if(withQuality)
+        {
+            merged.quality.assign(fw.quality, 0, bestOffset);
+            merged.quality.resize(mergedLength);
+        }
+        for(int i = 0; i < overlap; ++i)
+        {
+            const int position = bestOffset + i;
+            const char fwBase = fw.line[position];
+            const char rvBase = rvSequence[i];
+            if(!withQuality)
+            {
+                merged.line[position] = fwBase;
+                continue;
+            }
+            //quality of the reverse complement base is the quality of the base at the mirrored position in the reverse read
+            const char fwQuality = fw.quality[position];
+            const char rvQuality = rv.quality[rvLength - 1 - i];
+            if(fwBase == rvBase)
+            {
+                merged.line[position] = fwBase;
+                merged.quality[position] = std::max(fwQuality, rvQuality);
+            }
+            else
+            {
+                //the base with the higher quality, its quality is lowered by the quality of the other base
+                merged.line[position] = (rvQuality > fwQuality) ? rvBase : fwBase;
+                merged.quality[position] = static_cast<char>(minQuality + std::max(2, std::abs(fwQuality - rvQuality)));
+            }
+        }
+        //the forward read can be longer than the insert (the reverse read ends inside of it)
+        for(int position = bestOffset + overlap; position < mergedLength; ++position)
+        {
+            if(position < fwLength)
+            {
+                merged.line[position] = fw.line[position];
+                if(withQuality){merged.quality[position] = fw.quality[position];}
+            }
+            else
+            {
+                const int rvPosition = position - bestOffset;
+                merged.line[position] = rvSequence[rvPosition];
+                if(withQuality){merged.quality[position] = rv.quality[rvLength - 1 - rvPosition];}
+            }
+        }
+        return true;
+    }
+
+    private:
+
+    static const char minQuality = 33;
+
+    //number of mismatches of two sequences, stops counting above maxMismatches
+    static int hamming_distance(const char* a, const char* b, const int length, const int maxMismatches)
+    {
+        int mismatches = 0;
+        for(int i = 0; i < length && mismatches <= maxMismatches; ++i)
+        {
+            mismatches += (a[i] != b[i]);
+        }
+        return mismatches;
+    }
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string_view>
+#include <array>
+#include <cstddef>
+
+#if defined(__SSSE3__)
+    #include <tmmintrin.h>
+#endif
+
+//complement of every character (0 for characters that are not A,C,G,T,N)
+inline constexpr std::array<char, 256> make_complement_table()
+{
+    std::array<char, 256> table{};
+    table['A'] = 'T';
+    table['C'] = 'G';
+    table['G'] = 'C';
+    table['T'] = 'A';
+    table['N'] = 'N';
+    return table;
+}
+inline constexpr std::array<char, 256> complementTable = make_complement_table();
+
+//writes the reverse complement of seq into out (seq.size() characters) and checks in the same pass that seq only contains A,C,G,T,N.
+//Returns false if it contains other characters (out is then not a valid sequence).
+//With SSSE3 16 bases are processed at once: the low 4 bits of A,C,G,T,N differ (1,3,7,4,14), a byte shuffle with these bits
+//as index looks up the complement and the expected base (to validate the read), a second shuffle reverses the bases.
+inline bool reverse_complement(std::string_view seq, char* out)
+{
+    const size_t length = seq.size();
+    size_t done = 0;
+    bool valid = true;
+
+    #if defined(__SSSE3__)
+        //expected base and complement for every low nibble: unused nibbles expect a byte with another low nibble (never matches)
+        const __m128i bases = _mm_setr_epi8(1, 'A', 0, 'C', 'T', 0, 0, 'G', 0, 0, 0, 0, 0, 0, 'N', 0);
+        const __m128i complements = _mm_setr_epi8(0, 'T', 0, 'G', 'A', 0, 0, 'C', 0, 0, 0, 0, 0, 0, 'N', 0);
+        const __m128i reverseOrder = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        const __m128i lowNibble = _mm_set1_epi8(0x0F);
+        for(; done + 16 <= length; done += 16)
+        {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq.data() + length - done - 16));
+            const __m128i nibbles = _mm_and_si128(block, lowNibble);
+            valid &= (_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_shuffle_epi8(bases, nibbles))) == 0xFFFF);
+            const __m128i complement = _mm_shuffle_epi8(complements, nibbles);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + done), _mm_shuffle_epi8(complement, reverseOrder));
+        }
+    #endif
+
+    for(; done < length; ++done)
+    {
+        const char complement = complementTable[static_cast<unsigned char>(seq[length - 1 - done])];
+        valid &= (complement != 0);
+        out[done] = complement;
+    }
+    return valid;
+}
@@ -10,6 +10,7 @@
 #include <atomic>
 #include <mutex>
 #include <algorithm>
+#include <filesystem>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <iostream>
@@ -39,67 +40,34 @@ inline bool endWith(std::string const &fullString, std::string const &ending)
     }
 }
 
-//total number of reads for gzipped files
-inline unsigned long long totalNumberOfLines(std::string fileName)
+inline void printProgress(double percentage) 
 {
-    unsigned long long totalReads = 0;
-    unsigned char buffer[1000];
-    gzFile fp = gzopen(fileName.c_str(),"r");
-    if(NULL == fp)
-    {
-        fprintf(stderr,"Fail to open file: %s\n", fileName.c_str());
-    }
-    while(!gzeof(fp))
-    {
-        gzread(fp, buffer, 999);
-        for (const unsigned char &c : buffer) 
-        {
-            if ( c == '\n' )
-            {
-                if(totalReads == ULLONG_MAX)
-                {
-                    std::cout << "WARNING: Analysing more than " << std::to_string(ULLONG_MAX) << " reads. There will be no status update\n";
-                    gzrewind(fp);
-                    return(ULLONG_MAX);
-                }
-                ++totalReads;
-            }
-        }
-    }
-    gzrewind(fp);
-
-    return totalReads;
+    int val = (int) (percentage*100);
+    int loadLength = (int) (percentage * PBWIDTH);
+    int emptyLength = PBWIDTH - loadLength;
+    std::cout << "\t\r[" << std::string(loadLength, '|') << std::string(emptyLength, ' ') << "] " << val << "%" << std::flush;
 }
 
-inline unsigned long long numberOfReads(std::string fileName)
+//size of an input file in bytes (0 if it is unknown), the progress of reading it is the part of the bytes that were read
+//(for gzipped files the compressed bytes): the input is read only once, without counting the reads first
+inline unsigned long long fileSize(const std::string& fileName)
 {
-    unsigned long long totalReads = 0;
-    
-    if(endWith(fileName, "fastq") || endWith(fileName, "fastq.gz"))
-    {
-        unsigned long long totalLines = totalNumberOfLines(fileName);
-        if(totalLines==ULLONG_MAX){return(ULLONG_MAX);}
-        totalReads = (totalLines/4);
-    }
-    else if(endWith(fileName, "txt"))
-    {
-        std::ifstream fileStream;
-        fileStream.open(fileName);
-        totalReads = std::count(std::istreambuf_iterator<char>(fileStream), std::istreambuf_iterator<char>(), '\n');
-        fileStream.clear();
-        fileStream.seekg(0);
-        fileStream.close();
-    }
-
-    return totalReads;
+    std::error_code error;
+    const std::uintmax_t size = std::filesystem::file_size(fileName, error);
+    return error ? 0 : static_cast<unsigned long long>(size);
 }
 
-inline void printProgress(double percentage) 
+//updates the status bar whenever the read part of the file reaches the next percent
+inline void printFileProgress(const long long bytesRead, const unsigned long long totalBytes, int& lastPercent)
 {
-    int val = (int) (percentage*100);
-    int loadLength = (int) (percentage * PBWIDTH);
-    int emptyLength = PBWIDTH - loadLength;
-    std::cout << "\t\r[" << std::string(loadLength, '|') << std::string(emptyLength, ' ') << "] " << val << "%" << std::flush;
+    if(totalBytes == 0 || bytesRead < 0){return;}
+    const double perc = std::min(1.0, bytesRead/(double)totalBytes);
+    const int percent = static_cast<int>(perc*100);
+    if(percent > lastPercent)
+    {
+        lastPercent = percent;
+        printProgress(perc);
+    }
 }
 
 //stores all the input parameters for the mapping tools
@@ -112,20 +80,39 @@ struct input{
 
     std::string reverseFile = "";
     bool detachedReverseMapping = false;
+    //reverse complement the reverse read once and look it up in the forward barcode indexes
+    bool orientReverseRead = false;
+    //map the reverse read only if the forward read does not map all barcodes of the pattern without edits
+    bool lazyReverseMapping = false;
+    //merge overlapping forward and reverse reads into one read before mapping
+    bool mergeReadPairs = false;
+    //forward and reverse read of a pair are consecutive records of the input file
+    bool interleavedReads = false;
 
     std::string barcodeFile; //file of all barcode-vectors, each line sequentially representing a barcode 
     std::string mismatchFile; //file withg several lines with coma seperated list of mismathces per barcode
     std::string patternLine; //list of patterns in abstract form
 
     std::string barcodePatternsFile;
+    //with several patterns take the first pattern that maps (most likely patterns first) instead of the best one
+    bool firstPatternMatch = false;
+    //memory (MB) for the neighborhood indexes of all barcode columns together, columns that do not fit are aligned
+    int indexMemory = 4096;
 
     //additional informations
     bool writeStats = false; 
     bool writeFailedLines = false;
     bool writeFilesOnTheFly = false;
+    //output files are BGZF compressed (.gz) with this level (0: uncompressed), a block has at most outputBlockSize uncompressed bytes
+    int outputCompressionLevel = 0;
+    int outputBlockSize = 65280;
+    //barcode-only patterns are written as binary columnar files (.bin, read by count) instead of tsv files
+    bool binaryOutput = false;
     
     long long int fastqReadBucketSize = 10000000;
     int threads = 5;
+    //number of reads mapped together in one job (constant barcodes are aligned for all reads of a job at once)
+    int batchSize = 64;
 };
 
 struct levenshtein_value{
@@ -283,7 +270,7 @@ inline std::string stripQuotes(const std::string& input)
 
     //TODO: add an alternative strategy without saving ins, del, subst for cases where the quality is not needed
     //and running time is more important
-inline bool run_alignment(std::string pattern, const std::string target, 
+inline bool run_alignment(std::string_view pattern, std::string_view target, 
                           int& targetEnd,
                           EdlibAlignConfig config,
                           int& delNum, int& insNum, int& substNum)
@@ -293,8 +280,8 @@ inline bool run_alignment(std::string pattern, const std::string target,
 
     // Run the alignment
     EdlibAlignResult result = edlibAlign(
-        pattern.c_str(), pattern.length(),
-        target.c_str(), target.length(),
+        pattern.data(), pattern.length(),
+        target.data(), target.length(),
         config
     );
 
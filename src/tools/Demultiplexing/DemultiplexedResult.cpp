@@ -25,23 +25,29 @@ void DemultiplexedResult::concatenateFiles(const std::vector<std::string>& tmpFi
     }
 }
 
-void DemultiplexedResult::update_stats(OneLineDemultiplexingStatsPtr lineStatsPtr, bool result, std::string& foundPatternName, std::vector<std::string>& barcodeList)
+void DemultiplexedResult::update_stats(WorkerOutput& worker, OneLineDemultiplexingStatsPtr lineStatsPtr, bool result, std::string& foundPatternName, std::vector<std::string>& barcodeList)
 {
-    dxStat.update(lineStatsPtr, result, foundPatternName, barcodeList);
+    worker.stats.update(lineStatsPtr, result, foundPatternName, barcodeList);
+}
+
+void DemultiplexedResult::merge_worker_statistics()
+{
+    for(const WorkerOutput& worker : workers)
+    {
+        dxStat.merge(worker.stats);
+    }
 }
 
 //writes the dna (fastq) and barcode (tsv) data
-void DemultiplexedResult::write_dna_line(TmpPatternStream& dnaLineStream, const DemultiplexedLine& demultiplexedLine, const boost::thread::id& threadID)
+void DemultiplexedResult::write_dna_line(WorkerOutput& worker, const size_t patternIdx, const DemultiplexedLine& demultiplexedLine)
 {
-    std::shared_ptr<std::ofstream> barcodeStream = dnaLineStream.barcodeStream;
-    std::shared_ptr<std::ofstream> dnaStream = dnaLineStream.dnaStream;
+    TmpPatternStream& dnaLineStream = worker.patternStreams[patternIdx];
+    std::shared_ptr<OutputFileStream> barcodeStream = dnaLineStream.barcodeStream;
+    std::shared_ptr<OutputFileStream> dnaStream = dnaLineStream.dnaStream;
 
-    //create a read ID (threadID and fastq line number)
+    //create a read ID (worker and line number within the worker)
     unsigned long readCount = ++dnaLineStream.lineNumber;
-    std::ostringstream oss;
-    oss << threadID;
-    std::string threadIDString = oss.str();
-    std::string lineName =  threadIDString + "_" + std::to_string(readCount) + "_" + demultiplexedLine.dnaName;
+    std::string lineName =  std::to_string(worker.workerIdx) + "_" + std::to_string(readCount) + "_" + demultiplexedLine.dnaName;
     
     //write RNA data to dnaStream (FASTQ)
     *dnaStream << "@" << lineName << "\n";
@@ -68,34 +74,32 @@ void DemultiplexedResult::write_dna_line(TmpPatternStream& dnaLineStream, const
     
 }
 
-void DemultiplexedResult::close_and_concatenate_fileStreams(const input& input)
+void DemultiplexedResult::close_and_concatenate_fileStreams()
 {
     //1.) CLOSE all file streams
-    //iterate over all threads
-    for (auto threadID_patternStreamMap_pair : tmpStreamMap) 
+    //iterate over all workers
+    for (WorkerOutput& worker : workers) 
     {
-        //CLOSED FAILED LINE STREAMS: failed file per thread
-        std::pair<std::shared_ptr<std::ofstream>, std::shared_ptr<std::ofstream>> failedFileStream = get_failedStream_for_threadID_at(threadID_patternStreamMap_pair.first);
+        //CLOSED FAILED LINE STREAMS: failed file per worker
         //close the first stream definitely
-        failedFileStream.first->close();
-        if(failedFileStream.second != nullptr)
+        worker.failedStreams.first->close();
+        if(worker.failedStreams.second != nullptr)
         {
             //and the second only if we have paired-end sequencing
-            failedFileStream.second->close();
+            worker.failedStreams.second->close();
         }
 
         //CLOSE DNA-LINE STREAMS: for failed (DNA, barcode-tsv)-pair we have one file per pattern (with DNA)
-        for (auto patternStreams_pair : threadID_patternStreamMap_pair.second) 
+        for (TmpPatternStream& patternStream : worker.patternStreams) 
         {
-            std::shared_ptr<std::ofstream> dnaStream = get_dnaStream_for_threadID_at(threadID_patternStreamMap_pair.first, patternStreams_pair.first);
-            if(dnaStream != nullptr)
+            if(patternStream.dnaStream != nullptr)
             {
-                dnaStream->close();
-                std::shared_ptr<std::ofstream> barcodeStream = get_barcodeStream_for_threadID_at(threadID_patternStreamMap_pair.first, patternStreams_pair.first);
-                barcodeStream->close();
+                patternStream.dnaStream->close();
+                patternStream.barcodeStream->close();
             }
         }
     }
+    const int workerNum = static_cast<int>(workers.size());
 
     //2.) CONCATENATE all files
     //CONCATENATED FAILED LINES FILES
@@ -103,7 +107,7 @@ void DemultiplexedResult::close_and_concatenate_fileStreams(const input& input)
     //ALWAYS concatenate the failed lines for the first fileFilesName (FW or single-read)
     size_t dotPos = failedLines.first.find_last_of('.');  // Find the last dot
     std::string failedLinesTmpFileNameFW;
-    for(int i = 0; i < input.threads; ++i)
+    for(int i = 0; i < workerNum; ++i)
     {
         failedLinesTmpFileNameFW = failedLines.first.substr(0, dotPos) + std::to_string(i) + failedLines.first.substr(dotPos);
         failedFileListFW.push_back(failedLinesTmpFileNameFW);
@@ -116,7 +120,7 @@ void DemultiplexedResult::close_and_concatenate_fileStreams(const input& input)
         std::vector<std::string> failedFileListRV;
         dotPos = failedLines.second.find_last_of('.');  // Find the last dot
         std::string failedLinesTmpFileNameRV;
-        for(int i = 0; i < input.threads; ++i)
+        for(int i = 0; i < workerNum; ++i)
         {
             failedLinesTmpFileNameRV = failedLines.second.substr(0, dotPos) + std::to_string(i) + failedLines.second.substr(dotPos);
             failedFileListRV.push_back(failedLinesTmpFileNameRV);
@@ -137,7 +141,7 @@ void DemultiplexedResult::close_and_concatenate_fileStreams(const input& input)
         
             //list all temporary dna-files (FASTQ)/ barcode-files (tsv) and combine them
 
-            for(int i = 0; i < input.threads; ++i)
+            for(int i = 0; i < workerNum; ++i)
             {
                 //pattern and thread specific DNA file
                 size_t dotPos = fileIt->second.dnaFile.find_last_of('.');  // Find the last dot
@@ -160,14 +164,23 @@ void DemultiplexedResult::close_and_concatenate_fileStreams(const input& input)
 void DemultiplexedResult::write_output(const input& input)
 {
     //if tmp files were written (for failed/ DNA&barcode reads)
-    close_and_concatenate_fileStreams(input);
+    close_and_concatenate_fileStreams();
 
     //write all barcode-only files (data is still in memory at this point)
     for (const auto& [patternName, demultiplexedReadsPtrTmp] : demultiplexedReads) 
     {
-        write_demultiplexed_barcodes(input, demultiplexedReadsPtrTmp->get_all_reads(), stripQuotes(patternName));
+        if(binaryOutput)
+        {
+            write_binary_barcodes(demultiplexedReadsPtrTmp->get_all_reads(), patternName);
+        }
+        else
+        {
+            write_demultiplexed_barcodes(input, demultiplexedReadsPtrTmp->get_all_reads(), stripQuotes(patternName));
+        }
     }
     
+    finish_compressed_files();
+
     //write the results
     if(input.writeStats)
     {
@@ -175,6 +188,20 @@ void DemultiplexedResult::write_output(const input& input)
     }
 }
 
+void DemultiplexedResult::finish_compressed_files()
+{
+    if(compressionLevel <= 0){return;}
+    for(const auto& [patternName, patternFiles] : finalFiles)
+    {
+        //binary barcode files are not compressed (count maps them into memory)
+        if(patternFiles.dnaFile == "" && binaryOutput){continue;}
+        BgzfStreamBuffer::append_eof(patternFiles.barcodeFile);
+        if(patternFiles.dnaFile != ""){BgzfStreamBuffer::append_eof(patternFiles.dnaFile);}
+    }
+    BgzfStreamBuffer::append_eof(failedLines.first);
+    if(failedLines.second != ""){BgzfStreamBuffer::append_eof(failedLines.second);}
+}
+
 //initialize the statistics file/ lines that could not be mapped
 //FILES: mismatches per barcode / mismatches per barcodePattern/ failedLines
 void DemultiplexedResult::initialize_additional_output(const input& input, 
@@ -184,7 +211,7 @@ void DemultiplexedResult::initialize_additional_output(const input& input,
     //we need to initialize 1 or 2 files for failed lines - depending on paired/ single read
     if(input.reverseFile == "")
     {
-        std::string failedLinesName = "FailedLines.txt";
+        std::string failedLinesName = "FailedLines.txt" + compressed_ending();
         if(input.prefix != "")
         {
             failedLinesName = input.prefix + "_" + failedLinesName;
@@ -202,7 +229,7 @@ void DemultiplexedResult::initialize_additional_output(const input& input,
     }
     else
     {
-        std::string failedLinesFWName = "FailedLines_FW.txt";
+        std::string failedLinesFWName = "FailedLines_FW.txt" + compressed_ending();
         if(input.prefix != "")
         {
             failedLinesFWName = input.prefix + "_" + failedLinesFWName;
@@ -216,7 +243,7 @@ void DemultiplexedResult::initialize_additional_output(const input& input,
         }
         failedLineFileFW.close();  // Close the file
 
-        std::string failedLinesRVName = "FailedLines_RV.txt";
+        std::string failedLinesRVName = "FailedLines_RV.txt" + compressed_ending();
         if(input.prefix != "")
         {
             failedLinesRVName = input.prefix + "_" + failedLinesRVName;
@@ -254,7 +281,7 @@ void DemultiplexedResult::initialize_output_for_pattern(const std::string& outpu
     if(pattern->containsDNA)
     {
         //tsv-file with barcodes
-        std::string barcodeTsvFileName = stripQuotes(pattern->patternName) + ".tsv";
+        std::string barcodeTsvFileName = stripQuotes(pattern->patternName) + ".tsv" + compressed_ending();
         if(prefix != "")
         {
             barcodeTsvFileName = prefix + "_" + barcodeTsvFileName;
@@ -263,7 +290,7 @@ void DemultiplexedResult::initialize_output_for_pattern(const std::string& outpu
         std::remove(patternOutputs.barcodeFile.c_str());
 
         //fastq file
-        std::string fastqFileName = stripQuotes(pattern->patternName) + ".fastq";
+        std::string fastqFileName = stripQuotes(pattern->patternName) + ".fastq" + compressed_ending();
         if(prefix != "")
         {
             fastqFileName = prefix + "_" + fastqFileName;
@@ -276,7 +303,11 @@ void DemultiplexedResult::initialize_output_for_pattern(const std::string& outpu
     }
     else //otherwise we write ONLY a tsv file of barcodes and initialize the DemultiplexedReads structure to store found reads
     {
-        std::string barcodeTsvFileName = stripQuotes(pattern->patternName) + ".tsv";
+        std::string barcodeTsvFileName = stripQuotes(pattern->patternName) + ".tsv" + compressed_ending();
+        if(binaryOutput)
+        {
+            barcodeTsvFileName = stripQuotes(pattern->patternName) + ".bin";
+        }
         if(prefix != "")
         {
             barcodeTsvFileName = prefix + "_" + barcodeTsvFileName;
@@ -288,12 +319,13 @@ void DemultiplexedResult::initialize_output_for_pattern(const std::string& outpu
         demultiplexedReads.emplace(pattern->patternName, std::make_shared<DemultiplexedReads>());
         //STORE OUTPUT-FILE NAMES IN LIST
         finalFiles[pattern->patternName] = patternOutputs;
+        //the header of a binary file is written with the reads
+        if(binaryOutput){return;}
     }
 
     //2) WRITE HEADER OF BARCODE DATA   (if barcodes correspont to a fastq, the first column stores the read names)
     //write header line for barcode file: e.g.: [ACGGCATG][BC1.txt][15X]
-    std::ofstream barcodeOutputStream;   
-    barcodeOutputStream.open(patternOutputs.barcodeFile, std::ofstream::app);
+    OutputFileStream barcodeOutputStream(patternOutputs.barcodeFile, compressionLevel, compressionBlockSize, std::ofstream::app);
 
     //store the read name in the first column for DNA reads (to map fastq-alignment to barcodes)
     if(pattern->containsDNA)
@@ -380,50 +412,49 @@ void DemultiplexedResult::initialize(const input& input, const MultipleBarcodePa
     initialize_additional_output(input, barcodePatternList);
 }
 
-//initializes all TEMPORARY FILES for a single thread ID, those files are counted from 0 to THREADNUM-1
-// (i is the index that is also used as tmp name suffix - the actual thradID is not used in these names, only in the maps)
-void DemultiplexedResult::initialize_tmp_file(const int i)
+//initializes all TEMPORARY FILES of a worker, those files are counted from 0 to WORKERNUM-1
+// (the index of the worker is also used as tmp name suffix)
+void DemultiplexedResult::initialize_tmp_files(WorkerOutput& worker)
 {
+    const int i = worker.workerIdx;
 
-    //create a map of pattern name to open streams for barcodes, fastq for every thread
+    //create a stream for barcodes, fastq for every pattern (in the order of patterns)
     //those thread files have no header, the header is only written in final file
-    std::unordered_map<std::string, TmpPatternStream> tmpFileStreams;
+    worker.patternStreams.resize(patternList->size());
     size_t dotPos; // temporary variable storing endpoint of file names (position of dot in filename)
 
     //the files that r written immediately are failed/ DNA files
-    // fileIT (first: patternName, second: barcode,DNA,faield file names)
-    for(auto fileIt = finalFiles.begin(); fileIt != finalFiles.end(); ++fileIt)
+    for(size_t patternIdx = 0; patternIdx < patternList->size(); ++patternIdx)
     {
         // Create an ofstream pointer and open the file
-        //tmp-file name is final name + threadID
+        //tmp-file name is final name + worker index
         //only create a temporary stream for a pattern that does contain a DNA region
-        if(fileIt->second.dnaFile != "")
+        const FinalPatternFiles& patternFiles = finalFiles.at(patternList->at(patternIdx)->patternName);
+        if(patternFiles.dnaFile != "")
         {
-            TmpPatternStream tmpStream; // struct storing a stream for barcode(tsv) and DNA(FASTQ)
+            TmpPatternStream& tmpStream = worker.patternStreams[patternIdx]; // struct storing a stream for barcode(tsv) and DNA(FASTQ)
             //TEMPORARY BARCODE-tsv STREAM
-            dotPos = fileIt->second.barcodeFile.find_last_of('.');  // Find the last dot
-            std::string barcodeTmpFileName = fileIt->second.barcodeFile.substr(0, dotPos) + std::to_string(i) + fileIt->second.barcodeFile.substr(dotPos);
-            std::shared_ptr<std::ofstream> outFileBarcode = std::make_shared<std::ofstream>(barcodeTmpFileName);
+            dotPos = patternFiles.barcodeFile.find_last_of('.');  // Find the last dot
+            std::string barcodeTmpFileName = patternFiles.barcodeFile.substr(0, dotPos) + std::to_string(i) + patternFiles.barcodeFile.substr(dotPos);
+            std::shared_ptr<OutputFileStream> outFileBarcode = std::make_shared<OutputFileStream>(barcodeTmpFileName, compressionLevel, compressionBlockSize);
             if (!outFileBarcode->is_open()) 
             {
-                std::cerr << "Error opening file: " << fileIt->second.barcodeFile << std::endl;
+                std::cerr << "Error opening file: " << patternFiles.barcodeFile << std::endl;
                 exit(EXIT_FAILURE);
             }
             tmpStream.barcodeStream = outFileBarcode;
 
             //TEMPORARY DNA STREAM
-            //tmp-file name is final name + threadID
-            dotPos = fileIt->second.dnaFile.find_last_of('.');  // Find the last dot
-            std::string dnaTmpFileName = fileIt->second.dnaFile.substr(0, dotPos) + std::to_string(i) + fileIt->second.dnaFile.substr(dotPos);
-            std::shared_ptr<std::ofstream> outFileDna = std::make_shared<std::ofstream>(dnaTmpFileName);
+            //tmp-file name is final name + worker index
+            dotPos = patternFiles.dnaFile.find_last_of('.');  // Find the last dot
+            std::string dnaTmpFileName = patternFiles.dnaFile.substr(0, dotPos) + std::to_string(i) + patternFiles.dnaFile.substr(dotPos);
+            std::shared_ptr<OutputFileStream> outFileDna = std::make_shared<OutputFileStream>(dnaTmpFileName, compressionLevel, compressionBlockSize);
             if (!outFileDna->is_open()) 
             {
-                std::cerr << "Error opening file: " << fileIt->second.dnaFile << std::endl;
+                std::cerr << "Error opening file: " << patternFiles.dnaFile << std::endl;
                 exit(EXIT_FAILURE);
             }
             tmpStream.dnaStream = outFileDna;
-        
-            tmpFileStreams[fileIt->first] = tmpStream;
         }
 
     }
@@ -432,7 +463,7 @@ void DemultiplexedResult::initialize_tmp_file(const int i)
     dotPos = failedLines.first.find_last_of('.');  // Find the last dot
     std::string failedLinesTmpFileName = failedLines.first.substr(0, dotPos) + std::to_string(i) + failedLines.first.substr(dotPos);
     
-    std::shared_ptr<std::ofstream> outFileFailedLineFW = std::make_shared<std::ofstream>(failedLinesTmpFileName);
+    std::shared_ptr<OutputFileStream> outFileFailedLineFW = std::make_shared<OutputFileStream>(failedLinesTmpFileName, compressionLevel, compressionBlockSize);
     if (!outFileFailedLineFW->is_open()) 
     {
         std::cerr << "Error opening file: " << failedLines.first << std::endl;
@@ -440,66 +471,36 @@ void DemultiplexedResult::initialize_tmp_file(const int i)
     }
 
     // check if we also have a reverse read that we need to store temporarily
-    std::shared_ptr<std::ofstream> outFileFailedLineRV = nullptr;
+    std::shared_ptr<OutputFileStream> outFileFailedLineRV = nullptr;
     if(failedLines.second != "")
     {
         dotPos = failedLines.second.find_last_of('.');  // Find the last dot
         std::string failedLinesTmpFileNameRv = failedLines.second.substr(0, dotPos) + std::to_string(i) + failedLines.second.substr(dotPos);
         
-        outFileFailedLineRV = std::make_shared<std::ofstream>(failedLinesTmpFileNameRv);
+        outFileFailedLineRV = std::make_shared<OutputFileStream>(failedLinesTmpFileNameRv, compressionLevel, compressionBlockSize);
         if (!outFileFailedLineRV->is_open()) 
         {
             std::cerr << "Error opening file: " << failedLines.second << std::endl;
             exit(EXIT_FAILURE);
         }
     }
-
-    std::unique_lock<std::mutex> fileLock(*threadFileOpenerMutex);
-    --(*threadToInitializePtr);
-    //add the new list of temporary streams to map
-    tmpStreamMap[boost::this_thread::get_id()] = tmpFileStreams;
-
-    //add the temporary failedLine to map
-    failedStreamMap[boost::this_thread::get_id()] = std::make_pair(outFileFailedLineFW, outFileFailedLineRV);
-    //decrease number of threads that need initialization, when all are initialized we can continue program in main function
-    if (*threadToInitializePtr == 0) 
-    {
-        cvPtr->notify_all();  // Notify when all tasks are done
-        fileLock.unlock();
-    }
-    else
-    {
-        //lock threads if we did not finish them - like this we can be 100% sure that evey thread gets called EXACTLY ONCE
-        // for initialization
-        fileLock.unlock();
-        //wait until all threads are here
-        std::unique_lock<std::mutex> lock(*threadWaitingMutex);
-        cvPtr->wait(lock, [&] { return (*threadToInitializePtr) == 0; });
-        lock.unlock();
-    }
-
+    worker.failedStreams = std::make_pair(outFileFailedLineFW, outFileFailedLineRV);
 }
 
-void DemultiplexedResult::initialize_thread_streams(boost::asio::thread_pool& pool, const int threadNum)
+WorkerOutput& DemultiplexedResult::add_worker()
 {
-    //add the initialiozation fucntion thread times, where every thread waits until threadsStarted is equal
-    //the number of threads to initialize every thread exactly once
-    for(int i = 0; i < threadNum; ++i)
-    {
-        boost::asio::post(pool, std::bind(&DemultiplexedResult::initialize_tmp_file, this, i));
-    }
-
-    //only continue once all htreads have finished 
-    // (we can NOT join, to not change the thread_ids, and waiting within thread only might let threadToInitialize go out of scope)
-    std::unique_lock<std::mutex> lock(*threadWaitingMutex);
-    cvPtr->wait(lock, [&] { return (*threadToInitializePtr) == 0; });
-    lock.unlock();
-
+    std::lock_guard<std::mutex> guard(*workerMutex);
+    WorkerOutput& worker = workers.emplace_back();
+    worker.workerIdx = static_cast<int>(workers.size()) - 1;
+    initialize_tmp_files(worker);
+    worker.stats.initializePartialStats(dxStat);
+    return worker;
 }
 
 /// write failed lines into a txt file
-void DemultiplexedResult::write_failed_line(std::pair<std::shared_ptr<std::ofstream>, std::shared_ptr<std::ofstream>>& failedFileStream, const std::pair<fastqLine, fastqLine>& failedLine)
+void DemultiplexedResult::write_failed_line(WorkerOutput& worker, const std::pair<fastqLine, fastqLine>& failedLine)
 {
+    std::pair<std::shared_ptr<OutputFileStream>, std::shared_ptr<OutputFileStream>>& failedFileStream = worker.failedStreams;
     if(failedFileStream.second == nullptr)
     {
         //for single-read write only first entry into first stream (second is a nullptr)
@@ -517,9 +518,7 @@ void DemultiplexedResult::write_failed_line(std::pair<std::shared_ptr<std::ofstr
 void DemultiplexedResult::write_demultiplexed_barcodes(const input& input, BarcodeMappingVector barcodes, const std::string& patternName)
 {
     std::string output = input.outPath;
-    std::ofstream outputFile;
-
-    std::string demultiplexedBarcodesFileName = patternName + ".tsv";
+    std::string demultiplexedBarcodesFileName = patternName + ".tsv" + compressed_ending();
     if(input.prefix != "")
     {
         demultiplexedBarcodesFileName = input.prefix + "_" + demultiplexedBarcodesFileName;
@@ -527,7 +526,7 @@ void DemultiplexedResult::write_demultiplexed_barcodes(const input& input, Barco
     std::string demultiplexedBarcodesOutput = output + "/" + demultiplexedBarcodesFileName;
 
     //write the barcodes we mapped
-    outputFile.open (demultiplexedBarcodesOutput, std::ofstream::app);
+    OutputFileStream outputFile(demultiplexedBarcodesOutput, compressionLevel, compressionBlockSize, std::ofstream::app);
     for(size_t i = 0; i < barcodes.size(); ++i)
     {
         for(size_t j = 0; j < barcodes.at(i).size(); ++j)
@@ -539,3 +538,38 @@ void DemultiplexedResult::write_demultiplexed_barcodes(const input& input, Barco
     }
     outputFile.close();
 }
+
+/// write mapped barcodes to a binary columnar file: variable barcodes and constants are stored as index of their whitelist,
+/// wildcards (UMIs) as 2-bit packed sequences
+void DemultiplexedResult::write_binary_barcodes(const BarcodeMappingVector& barcodes, const std::string& patternName)
+{
+    BarcodePatternPtr pattern = nullptr;
+    for(const BarcodePatternPtr& barcodePattern : *patternList)
+    {
+        if(barcodePattern->patternName == patternName){pattern = barcodePattern;}
+    }
+
+    //the columns of the tsv header: all barcodes except for stop, DNA and read-end (of the forward and the detached reverse pattern)
+    std::vector<BinaryBarcodeColumn> columns;
+    for(const BarcodeVectorPtr& barcodeVector : {pattern->barcodePattern, pattern->detachedReversePattern})
+    {
+        if(barcodeVector == nullptr){continue;}
+        for(const BarcodePtr& bptr : *barcodeVector)
+        {
+            if(bptr->name == "*" || bptr->name == "DNA" || bptr->name == "-"){continue;}
+            BinaryBarcodeColumn column;
+            column.name = std::filesystem::path(bptr->name).filename().string();
+            if(bptr->is_wildcard())
+            {
+                column.type = BinaryBarcodeColumn::Type::Sequence;
+            }
+            else
+            {
+                column.dictionary = bptr->get_patterns();
+            }
+            columns.push_back(std::move(column));
+        }
+    }
+
+    BinaryBarcodeFile::write(finalFiles.at(patternName).barcodeFile, std::move(columns), barcodes);
+}
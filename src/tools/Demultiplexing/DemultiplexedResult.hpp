@@ -1,27 +1,33 @@
 #pragma once
 
 #include "BarcodeMapping.hpp"
+#include "BgzfOutputStream.hpp"
+#include "BinaryBarcodeFile.hpp"
 
-#include <condition_variable>
+#include <deque>
 #include <cstdio>  // For std::remove()
 
-//threadID hash to map every thread to its own temporary files to write
-struct thread_id_hash {
-    size_t operator()(const boost::thread::id& id) const {
-        return boost::hash<boost::thread::id>()(id);
-    }
-  };
-  
   //a pattern can have a barcode & maybe a dna region
   // therefore every thread must be able to potentially write to both files 
   // this struct saves both and contains a nullptr in case of absence
   struct TmpPatternStream
   {
-      std::shared_ptr<std::ofstream> barcodeStream = nullptr;
-      std::shared_ptr<std::ofstream> dnaStream = nullptr;
+      std::shared_ptr<OutputFileStream> barcodeStream = nullptr;
+      std::shared_ptr<OutputFileStream> dnaStream = nullptr;
       unsigned long lineNumber = 0;
   };
   
+  //everything one worker thread writes while mapping reads: its temporary streams for every pattern (in the order of the patterns,
+  //only patterns with DNA have streams), for failed lines and the statistics of its reads.
+  //Only the worker that owns it writes to it, the files are concatenated and the statistics merged after mapping
+  struct WorkerOutput
+  {
+      int workerIdx = 0; //suffix of the temporary files and prefix of the DNA read names
+      std::vector<TmpPatternStream> patternStreams;
+      std::pair<std::shared_ptr<OutputFileStream>, std::shared_ptr<OutputFileStream>> failedStreams;
+      DemultiplexingStats stats;
+  };
+
   struct FinalPatternFiles
   {
       std::string barcodeFile = "";
@@ -30,53 +36,31 @@ struct thread_id_hash {
   /** @brief class to handle thread-specific output streams
   * streams are initialized from pattern data
   * depending on weather pattern contains only barcodes or also dna
-  * the threadId can provide a barcode & dna stream to write to
+  * every worker gets its own output with a barcode & dna stream to write to
   * finally this class can concatenate final files
   */
-  // ONE FAiledFile per thread -> in the end combined into one
-  // for every thread a map of pattern (which contains DNA) to its DNA/BARCODE file
+  // ONE FAiledFile per worker -> in the end combined into one
+  // for every worker a vector of patterns (the ones with DNA have a DNA/BARCODE file)
   class DemultiplexedResult
   {
       public:
   
           //the final files are created upon initilization
-          //HOWEVER, tmp files per thread need to be created when the thread-pool is set up
+          //HOWEVER, tmp files per worker are created when a worker maps its first read
           DemultiplexedResult(const input& input, const MultipleBarcodePatternVectorPtr& barcodePatternList)
+          : patternList(barcodePatternList), compressionLevel(input.outputCompressionLevel), compressionBlockSize(input.outputBlockSize),
+            binaryOutput(input.binaryOutput)
           {
               //initialze the names/ headers of final output files for each pattern
               initialize(input, barcodePatternList);
-              //thread-dependent tmp files are initialized later
-              //but initialyze the mutax for the htread initialization, which has to be shared for copy-construction of the DemultiplexedResult
-              threadFileOpenerMutex = std::make_unique<std::mutex>();
-              threadWaitingMutex = std::make_unique<std::mutex>();
-  
-              threadToInitializePtr = std::make_unique<std::atomic<unsigned int>>(input.threads);
-              cvPtr = std::make_unique<std::condition_variable>();
-  
-          }
-          void initialize_thread_streams(boost::asio::thread_pool& pool, const int threadNum);
-  
-          //return the tmp-stream for barcodes of the pattern-name for a threadID
-          std::shared_ptr<std::ofstream> get_barcodeStream_for_threadID_at(const boost::thread::id& threadID, const std::string& patternName)
-          {
-              return(tmpStreamMap.at(threadID).at(patternName).barcodeStream);
+              workerMutex = std::make_unique<std::mutex>();
           }
-          //return the tmp-stream for DNA of the pattern-name for a threadID
-          std::shared_ptr<std::ofstream> get_dnaStream_for_threadID_at(const boost::thread::id& threadID, const std::string& patternName)
-          {
-              return(tmpStreamMap.at(threadID).at(patternName).dnaStream);
-          }
-        //return the tmp-stream for DNA of the pattern-name for a threadID
-        TmpPatternStream& get_streams_for_threadID(const boost::thread::id& threadID, const std::string& patternName)
-        {
-            return(tmpStreamMap.at(threadID).at(patternName));
-        }
 
-          //return the tmp-stream for DNA of the pattern-name for a threadID
-          std::pair<std::shared_ptr<std::ofstream>, std::shared_ptr<std::ofstream>> get_failedStream_for_threadID_at(const boost::thread::id& threadID)
-          {
-              return(failedStreamMap.at(threadID));
-          }
+          //opens the temporary files of a new worker (workers are numbered in the order they are added),
+          //the output stays valid until the files are concatenated
+          WorkerOutput& add_worker();
+          //adds the statistics of all workers to the final statistics (once all reads are mapped)
+          void merge_worker_statistics();
 
           //return the demultiplexed reads for a pattern
           const BarcodeMappingVector get_demultiplexed_ab_reads(const std::string& patternName)
@@ -90,16 +74,18 @@ struct thread_id_hash {
   
           void concatenateFiles(const std::vector<std::string>& tmpFileList, const std::string& outputFile);
           //writing of final files
-          void close_and_concatenate_fileStreams(const input& input);
+          void close_and_concatenate_fileStreams();
   
-          //write a failed line that is encountered to the tmp-threadFileStreams
-          void write_failed_line(std::pair<std::shared_ptr<std::ofstream>, std::shared_ptr<std::ofstream>>& failedFileStream, const std::pair<fastqLine, fastqLine>& failedLine);
+          //write a failed line that is encountered to the tmp-files of the worker
+          void write_failed_line(WorkerOutput& worker, const std::pair<fastqLine, fastqLine>& failedLine);
           
-          //write the fastq and barcode data into temporary stream
-          void write_dna_line(TmpPatternStream& dnaLineStream, const DemultiplexedLine& demultiplexedLine, const boost::thread::id& threadID);
+          //write the fastq and barcode data into the temporary streams of the worker for the pattern
+          void write_dna_line(WorkerOutput& worker, const size_t patternIdx, const DemultiplexedLine& demultiplexedLine);
 
           //write final files: from memory or by concatenating & deleting tmp-files
           void write_demultiplexed_barcodes(const input& input, BarcodeMappingVector barcodes, const std::string& patternName);
+          //write the barcodes of a pattern (from memory) as binary columnar file, which is read by count instead of the tsv
+          void write_binary_barcodes(const BarcodeMappingVector& barcodes, const std::string& patternName);
 
           // 1.) Write DemutltiplexedReads as barcode-files for every pattern
           // 2.) write the 2 mismatch files: a) mismatches per barcode b) mismatches for the different patterns
@@ -108,7 +94,8 @@ struct thread_id_hash {
           // DNa(fastq)&barcode(TSV) file, and delete tmp files (file per thread per dna-pattern)
           void write_output(const input& input);
 
-          void update_stats(OneLineDemultiplexingStatsPtr lineStatsPtr, bool result, std::string& foundPatternName, std::vector<std::string>& barcodeList);
+          //updates the statistics of the worker
+          void update_stats(WorkerOutput& worker, OneLineDemultiplexingStatsPtr lineStatsPtr, bool result, std::string& foundPatternName, std::vector<std::string>& barcodeList);
   
           unsigned long long get_perfect_matches() const
           {
@@ -127,9 +114,17 @@ struct thread_id_hash {
   
           void initialize_additional_output(const input& input, const MultipleBarcodePatternVectorPtr& barcodePatternList);
           void initialize_output_for_pattern(const std::string& output, const std::string& prefix, const BarcodePatternPtr pattern);
+          //appends the BGZF EOF block to all final files (when the output is compressed)
+          void finish_compressed_files();
+          //file ending of the output files (.gz for compressed output)
+          std::string compressed_ending() const
+          {
+              return(compressionLevel > 0 ? ".gz" : "");
+          }
           //initializes the files for output
           void initialize(const input& input, const MultipleBarcodePatternVectorPtr& barcodePatternList);
-          void initialize_tmp_file(const int i);
+          //opens the temporary files of a worker: those files are counted from 0 to WORKERNUM-1
+          void initialize_tmp_files(WorkerOutput& worker);
 
           //maps a patternName to a list of all demultipelx-reads found for this pattern
           std::unordered_map<std::string, DemultiplexedReadsPtr> demultiplexedReads;
@@ -141,22 +136,22 @@ struct thread_id_hash {
           std::unordered_map<std::string, FinalPatternFiles> finalFiles;
           std::pair<std::string, std::string>  failedLines; //fw and rv read of failed lines, if not paired end the failed lines are stored in first entry of pair
   
-          //maps threadID -> list of streams for all patterns (ordered)
-          std::unordered_map<boost::thread::id, std::unordered_map<std::string, TmpPatternStream>, thread_id_hash> tmpStreamMap;
-          std::unordered_map<boost::thread::id, std::pair<std::shared_ptr<std::ofstream>,std::shared_ptr<std::ofstream>>, thread_id_hash> failedStreamMap;
+          //all patterns (the order of the streams of a worker)
+          MultipleBarcodePatternVectorPtr patternList;
+
+          //output files are written as BGZF blocks (every worker compresses its own files) if the level is > 0
+          int compressionLevel = 0;
+          int compressionBlockSize = BgzfStreamBuffer::maxBlockSize;
+          //patterns without DNA are written as binary barcode files (.bin) instead of tsv files
+          bool binaryOutput = false;
+
+          //outputs of all workers (a deque does not move them when a worker is added)
+          std::deque<WorkerOutput> workers;
+          std::unique_ptr<std::mutex> workerMutex;  //locking adding a worker
          
-          //data structures storing statistics: this is filled in DemultiplexerResult after reads have been mapped
+          //data structures storing statistics: the statistics of the workers are merged into it after reads have been mapped
           //in the mapping (BarcodeMapping.cpp) we fill a temporary object for one line
           DemultiplexingStats dxStat;
-  
-          //data structures for initialization of thread-specific temporary files
-          std::unique_ptr<std::mutex> threadFileOpenerMutex;  //locking writing access to the above tmpStreamMap
-          std::unique_ptr<std::mutex> threadWaitingMutex;  //locking the waiting locks to call every thread once
-          //we need both variables as class variables - like this the variables exist if main thread goes on
-          //while initializer threads still finish the initialization (initialization of shared variables is done at this point)
-          //we only close the function and end the waiting to re-use thread for upcoming demultiplexing
-          std::unique_ptr<std::atomic<unsigned int>> threadToInitializePtr; //this gets counted down in initialize_tmp_file, when zero we continue
-          std::unique_ptr<std::condition_variable> cvPtr;
 
   };
   typedef std::shared_ptr<DemultiplexedResult> DemultiplexedResultPtr; 
\ No newline at end of file
@@ -6,13 +6,10 @@
 * This function is called from every thread.
 **/
 template <typename MappingPolicy, typename FilePolicy>
-void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_wrapper(const std::pair<fastqLine, fastqLine>& line,
+void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_wrapper(WorkerContext& worker, const std::pair<fastqLine, fastqLine>& line,
                                                                     const input& input,
-                                                                    const unsigned long long lineCount,
-                                                                    const unsigned long long& totalReadCount,
                                                                     std::atomic<long long int>& elementsInQueue)
 {
-
     //FOR EVERY BARCODE-PATTERN (GET PATTERNID)
     //try to map read to this pattern until it matches and exit
     bool result = false;
@@ -21,12 +18,26 @@ void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_wrapper(const std::pa
     DemultiplexedLine finalDemultiplexedLine;
     OneLineDemultiplexingStatsPtr finalLineStatsPtr; //result for a single line
     int bestPatternScore = std::numeric_limits<int>::max();
+    size_t bestPatternIdx = 0;
+
+    //patterns the read can map to (patterns without the constant barcodes in the read are skipped)
+    std::vector<size_t>& candidates = worker.candidates;
+    select_patterns(line, input, candidates);
+    //read pairs are merged once for all patterns
+    [[maybe_unused]] const std::pair<fastqLine, fastqLine>* mergedLine = nullptr;
+    if constexpr (std::is_same<MappingPolicy, MapMergedReadPairsPolicy>::value)
+    {
+        worker.mergedReads.resize(1);
+        mergedLine = merge_read_pair(line, candidates, worker.mergedReads[0]);
+    }
 
     //map every pattern and save the overall score per pattern 
-    //*this->get_barcode_pattern() for global pattern that is shared
-    //*(thread_pattern[boost::this_thread::get_id()])
-    for(BarcodePatternPtr pattern : *(thread_pattern[boost::this_thread::get_id()]) )
+    const PatternSet& patterns = *patternSet;
+    for(const size_t patternIdx : candidates)
     {
+        const BarcodePatternPtr& pattern = patterns[patternIdx];
+        if(routingStats){++routingStats->mapped[patternIdx];}
+
         //score for this specific pattern
         int tmpPatternScore = std::numeric_limits<int>::max();
 
@@ -46,7 +57,19 @@ void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_wrapper(const std::pa
         }
 
         //write demultiplexed information into demultiplexedLine, this is passed by reference and can be accessed here
-        if(this->demultiplex_read(line, tmpDemultiplexedLine, pattern, input, lineCount, totalReadCount, tmpPatternScore, lineStatsPtr) && tmpPatternScore < bestPatternScore)
+        //a pattern only replaces the best one with fewer edits: its mapping is stopped once it reaches the best score
+        //(in first-match mode every pattern is mapped completely)
+        const int scoreBound = input.firstPatternMatch ? std::numeric_limits<int>::max() : bestPatternScore;
+        bool mapped;
+        if constexpr (std::is_same<MappingPolicy, MapMergedReadPairsPolicy>::value)
+        {
+            mapped = this->split_line_into_barcode_patterns(line, mergedLine, tmpDemultiplexedLine, input, pattern, tmpPatternScore, lineStatsPtr, scoreBound);
+        }
+        else
+        {
+            mapped = this->demultiplex_read(line, tmpDemultiplexedLine, pattern, input, tmpPatternScore, lineStatsPtr, scoreBound);
+        }
+        if(mapped && tmpPatternScore < bestPatternScore)
         {
             //as soon as a pattern matches, we exit and safe it!
             foundPatternName = pattern->patternName;
@@ -54,46 +77,278 @@ void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_wrapper(const std::pa
             finalDemultiplexedLine = tmpDemultiplexedLine;
             finalLineStatsPtr = lineStatsPtr;
             bestPatternScore = tmpPatternScore;
-            //TODO: potentailly break here if we do not want to map all patterns
-            //break;
+            bestPatternIdx = patternIdx;
+            //the first pattern that maps is taken if we do not search for the best one
+            if(input.firstPatternMatch){break;}
         }
 
         //in case we have only ONE PATTERN we can get statistics for the failed line, otherwise not
-        if(this->get_barcode_pattern()->size() == 1)
+        if(patterns.size() == 1)
         {
             finalLineStatsPtr = lineStatsPtr;
         }
     }
+    if(result && routingStats){++routingStats->matched[bestPatternIdx];}
+
+    write_line_result(worker, line, input, result, bestPatternIdx, foundPatternName, finalDemultiplexedLine, finalLineStatsPtr);
+
+    //count down elements to process
+    --elementsInQueue;
+
+}
+
+/**
+* @brief like demultiplex_wrapper for a batch of reads: every pattern is mapped to all reads of the batch at once
+* (constant barcodes are aligned to several reads simultaneously), then the best pattern of every read is written.
+**/
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::demultiplex_batch_wrapper(WorkerContext& worker, const std::vector<std::pair<fastqLine, fastqLine>>& lines,
+                                                                          const input& input,
+                                                                          std::atomic<long long int>& elementsInQueue)
+{
+    const size_t lineNum = lines.size();
+    const PatternSet& patterns = *patternSet;
+
+    //best pattern of every read
+    std::vector<bool> results(lineNum, false);
+    std::vector<std::string> foundPatternNames(lineNum);
+    std::vector<DemultiplexedLine> finalDemultiplexedLines(lineNum);
+    std::vector<OneLineDemultiplexingStatsPtr> finalLineStatsPtrs(lineNum);
+    std::vector<int> bestPatternScores(lineNum, std::numeric_limits<int>::max());
+    std::vector<size_t> bestPatternIdxs(lineNum, 0);
+
+    //patterns of every read in the order they are mapped
+    std::vector<std::vector<size_t>> candidates(lineNum);
+    size_t rounds = 0;
+    for(size_t i = 0; i < lineNum; ++i)
+    {
+        select_patterns(lines[i], input, candidates[i]);
+        rounds = std::max(rounds, candidates[i].size());
+    }
+    //read pairs are merged once for all patterns
+    std::vector<const std::pair<fastqLine, fastqLine>*>& mergedLines = worker.mergedReadPtrs;
+    if constexpr (std::is_same<MappingPolicy, MapMergedReadPairsPolicy>::value)
+    {
+        worker.mergedReads.resize(lineNum);
+        mergedLines.resize(lineNum);
+        for(size_t i = 0; i < lineNum; ++i)
+        {
+            mergedLines[i] = merge_read_pair(lines[i], candidates[i], worker.mergedReads[i]);
+        }
+    }
 
+    //result of every read for the current pattern
+    std::vector<bool> tmpResults;
+    std::vector<int> tmpPatternScores;
+    std::vector<DemultiplexedLine> tmpDemultiplexedLines;
+    std::vector<OneLineDemultiplexingStatsPtr> lineStatsPtrs;
+    std::vector<int> scoreBounds;
+    //reads that map the current pattern (pointers into the batch)
+    std::vector<size_t> readIdxs;
+    std::vector<const std::pair<fastqLine, fastqLine>*> readSubset;
+    std::vector<const std::pair<fastqLine, fastqLine>*> mergedSubset;
+
+    //in round r every read is mapped to its r-th pattern: all reads that map the same pattern in this round are mapped together
+    for(size_t round = 0; round < rounds; ++round)
+    {
+        for(size_t patternIdx = 0; patternIdx < patterns.size(); ++patternIdx)
+        {
+            readIdxs.clear();
+            for(size_t i = 0; i < lineNum; ++i)
+            {
+                if(round < candidates[i].size() && candidates[i][round] == patternIdx && !(input.firstPatternMatch && results[i]))
+                {
+                    readIdxs.push_back(i);
+                }
+            }
+            if(readIdxs.empty()){continue;}
+            readSubset.clear();
+            for(const size_t i : readIdxs){readSubset.push_back(&lines[i]);}
+            if constexpr (std::is_same<MappingPolicy, MapMergedReadPairsPolicy>::value)
+            {
+                mergedSubset.clear();
+                for(const size_t i : readIdxs){mergedSubset.push_back(mergedLines[i]);}
+            }
+            const size_t readNum = readIdxs.size();
+
+            const BarcodePatternPtr& pattern = patterns[patternIdx];
+            if(routingStats){routingStats->mapped[patternIdx] += readNum;}
+            tmpPatternScores.assign(readNum, std::numeric_limits<int>::max());
+            tmpDemultiplexedLines.assign(readNum, DemultiplexedLine());
+            lineStatsPtrs.assign(readNum, nullptr);
+            scoreBounds.assign(readNum, std::numeric_limits<int>::max());
+            for(size_t read = 0; read < readNum; ++read)
+            {
+                //mapping of a read stops once it reaches the score of its best pattern so far
+                if(!input.firstPatternMatch){scoreBounds[read] = bestPatternScores[readIdxs[read]];}
+                if(input.writeStats){lineStatsPtrs[read] = std::make_shared<OneLineDemultiplexingStats>();}
+
+                //use ONLY the forward read name (in the DNA/barcode file later we also add threadID and a readID within thread for unique names)
+                if(pattern->containsDNA){tmpDemultiplexedLines[read].dnaName = lines[readIdxs[read]].first.name;}
+            }
+
+            if constexpr (std::is_same<MappingPolicy, MapMergedReadPairsPolicy>::value)
+            {
+                this->split_lines_into_barcode_patterns(readSubset, mergedSubset, tmpDemultiplexedLines,
+                                                        input, pattern, tmpPatternScores, tmpResults, lineStatsPtrs, scoreBounds);
+            }
+            else
+            {
+                this->demultiplex_reads(readSubset, tmpDemultiplexedLines, pattern, input, tmpPatternScores, tmpResults, lineStatsPtrs, scoreBounds);
+            }
+
+            for(size_t read = 0; read < readNum; ++read)
+            {
+                const size_t i = readIdxs[read];
+                if(tmpResults[read] && tmpPatternScores[read] < bestPatternScores[i])
+                {
+                    foundPatternNames[i] = pattern->patternName;
+                    results[i] = true;
+                    finalDemultiplexedLines[i] = std::move(tmpDemultiplexedLines[read]);
+                    finalLineStatsPtrs[i] = lineStatsPtrs[read];
+                    bestPatternScores[i] = tmpPatternScores[read];
+                    bestPatternIdxs[i] = patternIdx;
+                }
+
+                //in case we have only ONE PATTERN we can get statistics for the failed line, otherwise not
+                if(patterns.size() == 1)
+                {
+                    finalLineStatsPtrs[i] = lineStatsPtrs[read];
+                }
+            }
+        }
+    }
+    if(routingStats)
+    {
+        for(size_t i = 0; i < lineNum; ++i){if(results[i]){++routingStats->matched[bestPatternIdxs[i]];}}
+    }
+
+    for(size_t i = 0; i < lineNum; ++i)
+    {
+        write_line_result(worker, lines[i], input, results[i], bestPatternIdxs[i], foundPatternNames[i], finalDemultiplexedLines[i], finalLineStatsPtrs[i]);
+    }
+
+    //count down elements to process
+    elementsInQueue -= lineNum;
+}
+
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::select_patterns(const std::pair<fastqLine, fastqLine>& line, const input& input,
+                                                                std::vector<size_t>& candidates)
+{
+    const size_t patternNum = patternSet->size();
+    if(classifier == nullptr)
+    {
+        candidates.resize(patternNum);
+        std::iota(candidates.begin(), candidates.end(), 0);
+        return;
+    }
+
+    //in first-match mode the most likely pattern is mapped first
+    classifier->classify(line, candidates, input.firstPatternMatch);
+    if(routingStats)
+    {
+        for(size_t patternIdx = 0; patternIdx < patternNum; ++patternIdx)
+        {
+            if(std::find(candidates.begin(), candidates.end(), patternIdx) == candidates.end()){++routingStats->skipped[patternIdx];}
+        }
+    }
+}
+
+template <typename MappingPolicy, typename FilePolicy>
+const std::pair<fastqLine, fastqLine>* Demultiplexer<MappingPolicy, FilePolicy>::merge_read_pair(const std::pair<fastqLine, fastqLine>& line,
+                                                                                                  const std::vector<size_t>& candidates,
+                                                                                                  std::pair<fastqLine, fastqLine>& mergedLine)
+{
+    const PatternSet& patterns = *patternSet;
+    for(const size_t patternIdx : candidates)
+    {
+        if(MapMergedReadPairsPolicy::is_mergeable(patterns[patternIdx]))
+        {
+            return MapMergedReadPairsPolicy::merge_pair(line, mergedLine) ? &mergedLine : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::print_routing_stats()
+{
+    if(!routingStats){return;}
+    std::cout << "=>\tREADS PER PATTERN (mapped | skipped by constant k-mers | assigned):\n";
+    const PatternSet& patterns = *patternSet;
+    for(size_t patternIdx = 0; patternIdx < patterns.size(); ++patternIdx)
+    {
+        std::cout << "\t" << patterns[patternIdx]->patternName << ": " << routingStats->mapped[patternIdx].load()
+                  << " | " << routingStats->skipped[patternIdx].load() << " | " << routingStats->matched[patternIdx].load() << "\n";
+    }
+    std::cout << "=>\tPATTERN MAPPINGS STOPPED AT THE BEST SCORE: " << prunedPatternMappings.load()
+              << " (" << prunedBarcodeAlignments.load() << " barcode alignments skipped)\n";
+}
+
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::init_workers(const input& input)
+{
+    for(int thread = 0; thread < std::max(1, input.threads); ++thread)
+    {
+        freeWorkers.push_back(&workers.emplace_back(WorkerContext{fileWriter->add_worker(), {}, {}, {}}));
+    }
+}
+
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::write_line_result(WorkerContext& worker, const std::pair<fastqLine, fastqLine>& line, const input& input,
+                                                                  const bool result, const size_t patternIdx,
+                                                                  std::string& foundPatternName, DemultiplexedLine& finalDemultiplexedLine,
+                                                                  OneLineDemultiplexingStatsPtr finalLineStatsPtr)
+{
     //BARCODE only information is stored (e.g., protein+barcode, guide+barcode)
     if(result && !finalDemultiplexedLine.containsDNA)
     {
         //store in a shared object
-        //this->fileWriter->add_demultiplexed_line(foundPatternName, finalDemultiplexedLine.barcodeList);
+        this->fileWriter->add_demultiplexed_line(foundPatternName, finalDemultiplexedLine.barcodeList);
     }
     else if(result && finalDemultiplexedLine.containsDNA)
     {
         //write out immediately into file for thread (bcs. RNA reads are not very repretitive and might take quite some memory)
         // call write_dna_line
-        this->fileWriter->write_dna_line(fileWriter->get_streams_for_threadID(boost::this_thread::get_id(), foundPatternName), finalDemultiplexedLine, boost::this_thread::get_id());
+        this->fileWriter->write_dna_line(worker.output, patternIdx, finalDemultiplexedLine);
     }
     else if(!result && input.writeFailedLines)
     {
-        //write failed line to file, get the filestreams for thread
-        std::pair<std::shared_ptr<std::ofstream>, std::shared_ptr<std::ofstream>> failedFileStream = fileWriter->get_failedStream_for_threadID_at(boost::this_thread::get_id());  
-        fileWriter->write_failed_line(failedFileStream, line);
+        //write failed line to the file of the worker
+        fileWriter->write_failed_line(worker.output, line);
     }
 
     //update statistics
     if(input.writeStats)
     {
         //if we mapped the line store mapping information
-        fileWriter->update_stats(finalLineStatsPtr, result, foundPatternName, finalDemultiplexedLine.barcodeList);
+        fileWriter->update_stats(worker.output, finalLineStatsPtr, result, foundPatternName, finalDemultiplexedLine.barcodeList);
     }
+}
 
-    //count down elements to process
-    --elementsInQueue;
+template <typename MappingPolicy, typename FilePolicy>
+void Demultiplexer<MappingPolicy, FilePolicy>::map_read_batch(ReadBatch* batch, const input& input, std::atomic<long long int>& elementsInQueue)
+{
+    WorkerContext* worker = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(workerMutex);
+        worker = freeWorkers.back();
+        freeWorkers.pop_back();
+    }
+
+    if(batch->size() == 1)
+    {
+        demultiplex_wrapper(*worker, batch->front(), input, elementsInQueue);
+    }
+    else
+    {
+        demultiplex_batch_wrapper(*worker, *batch, input, elementsInQueue);
+    }
+    readBatches.put(batch);
 
+    std::lock_guard<std::mutex> guard(workerMutex);
+    freeWorkers.push_back(worker);
 }
 
 /// overwritten run_mapping function to allow processing of only a subset of fastq lines at a time
@@ -102,36 +357,65 @@ void Demultiplexer<MappingPolicy, FilePolicy>::run_mapping(const input& input)
 {
     std::cout << "START DEMULTIPLEXING\n";
 
-    //generate a pool of threads
+    //generate a pool of threads and a worker context (with its tmp files) for every thread
+    init_workers(input);
     boost::asio::thread_pool pool(input.threads); //create thread pool
-    //initialize thread-dependent tmp files
-    fileWriter->initialize_thread_streams(pool, input.threads);
-    //initialize copies of Mapping pattern for all threads
-    initialize_thread_patterns(pool, input.threads);
 
     //read line by line and add to thread pool
-    this->FilePolicy::init_file(input.inFile, input.reverseFile);
-    std::pair<fastqLine, fastqLine> line;
-    unsigned long long lineCount = 0; //using atomic<int> as thread safe read count
+    this->FilePolicy::init_file(input.inFile, input.reverseFile, input.threads);
+    unsigned long long lineCount = 0; //number of reads, only counted by this thread
     std::atomic<long long int> elementsInQueue(0);
-    unsigned long long totalReadCount = FilePolicy::get_read_number();
+    //the input is read only once: the status bar shows the part of the input file that was read
+    const unsigned long long totalBytes = FilePolicy::get_file_size();
+    int lastPercent = -1;
+    auto update_progress = [&]()
+    {
+        if(lineCount % 1024 == 0){printFileProgress(FilePolicy::get_bytes_read(), totalBytes, lastPercent);}
+    };
 
-    while(FilePolicy::get_next_line(line))
+    //reads are parsed directly into a recycled batch (a single read by default, with a batch size > 1 reads are mapped in batches)
+    const size_t batchSize = static_cast<size_t>(std::max(1, input.batchSize));
+    auto post_batch = [&](ReadBatch* batch)
     {
         //wait to enqueue new elements in case we have a maximum bucket size
         if(input.fastqReadBucketSize>0)
         {
             while(input.fastqReadBucketSize <= elementsInQueue.load()){}
         }
-        //increase job count and push the job in the queue
-        ++elementsInQueue;
-        boost::asio::post(pool, std::bind(&Demultiplexer::demultiplex_wrapper, this, line, input, ++lineCount, totalReadCount, std::ref(elementsInQueue)));
+        //increase job count and push the job in the queue (the batch and input are not copied)
+        elementsInQueue += batch->size();
+        boost::asio::post(pool, std::bind(&Demultiplexer::map_read_batch, this, batch, std::cref(input), std::ref(elementsInQueue)));
+    };
+
+    ReadBatch* batch = readBatches.get(batchSize);
+    size_t readNum = 0;
+    while(FilePolicy::get_next_line((*batch)[readNum]))
+    {
+        ++lineCount;
+        update_progress();
+        if(++readNum == batchSize)
+        {
+            post_batch(batch);
+            batch = readBatches.get(batchSize);
+            readNum = 0;
+        }
+    }
+    if(readNum > 0)
+    {
+        batch->resize(readNum);
+        post_batch(batch);
+    }
+    else
+    {
+        readBatches.put(batch);
     }
     //iterate through the barcode map and let threads 
     pool.join();
+    fileWriter->merge_worker_statistics();
 
     printProgress(1); std::cout << "\n"; // end the progress bar
-    if(totalReadCount != ULLONG_MAX && input.writeStats)
+    const unsigned long long totalReadCount = lineCount;
+    if(totalReadCount > 0 && input.writeStats)
     {
       
         std::cout << "=>\tPERFECT MATCHES: " << std::to_string((unsigned long long)(100*(this->fileWriter->get_perfect_matches())/(double)totalReadCount)) 
@@ -139,6 +423,22 @@ void Demultiplexer<MappingPolicy, FilePolicy>::run_mapping(const input& input)
                   << "% | MISMATCHES: " << std::to_string((unsigned long long)(100*(this->fileWriter->get_failed_matches())/(double)totalReadCount)) << "%\n";
     }
 
+    print_routing_stats();
+    if(!input.reverseFile.empty())
+    {
+        std::cout << "=>\tREVERSE READS NOT MAPPED: " << skippedReverseMappingsComplete.load() << " (forward read mapped the whole pattern) | "
+                  << skippedReverseMappingsFailed.load() << " (forward read failed in detached mode) | "
+                  << skippedReverseMappingsPruned.load() << " (forward read can not beat the best pattern in detached mode)\n";
+        if(input.mergeReadPairs)
+        {
+            std::cout << "=>\tREAD PAIRS MERGED: " << mergedReadPairs.load() << " | NOT MERGED (mapped as pairs): " << unmergedReadPairs.load() << "\n";
+        }
+    }
+
+    #ifdef COUNT_ALLOCATIONS
+        std::cout << "=>\tHEAP ALLOCATIONS PER READ IN BARCODE ALIGNMENTS: " << alignmentAllocations.load()/(double)std::max(lineCount, 1ULL) << "\n";
+    #endif
+
     FilePolicy::close_file();
 }
 
@@ -154,6 +454,9 @@ void Demultiplexer<MappingPolicy, FilePolicy>::run(const input& input)
     //which stores for each pattern all possible barcodes, number of mismatches etc.
     this->generate_barcode_patterns(input);
 
+    //the patterns are not changed from here on and shared by all threads
+    patternSet = std::make_shared<const PatternSet>(this->get_barcode_pattern());
+
     //create output files and write headers for demultiplexed barcodes
     fileWriter = std::make_shared<DemultiplexedResult>(DemultiplexedResult(input, this->get_barcode_pattern()));
 
@@ -164,6 +467,14 @@ void Demultiplexer<MappingPolicy, FilePolicy>::run(const input& input)
     //    this->initializeStats();
     //}
 
+    //classify reads by the constant barcodes of the patterns before mapping them (with several patterns)
+    if(patternSet->size() > 1)
+    {
+        routingStats = std::make_unique<PatternRoutingStats>(patternSet->size());
+        PatternClassifierPtr patternClassifier = std::make_shared<const PatternClassifier>(this->get_barcode_pattern(), input);
+        if(patternClassifier->is_usable()){classifier = patternClassifier;}
+    }
+
     //run mapping
     this->run_mapping(input);
 
@@ -177,4 +488,10 @@ void Demultiplexer<MappingPolicy, FilePolicy>::run(const input& input)
 
 template class Demultiplexer<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromFastqFilePolicy>;
 template class Demultiplexer<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromTxtFilesPolicy>;
-template class Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromFastqFilePolicyPairedEnd>;
\ No newline at end of file
+template class Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromFastqFilePolicyPairedEnd>;
+template class Demultiplexer<MapMergedReadPairsPolicy, ExtractLinesFromFastqFilePolicyPairedEnd>;
+#ifdef WITH_HTSLIB
+template class Demultiplexer<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromBamFilePolicy>;
+template class Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromBamFilePolicy>;
+template class Demultiplexer<MapMergedReadPairsPolicy, ExtractLinesFromBamFilePolicy>;
+#endif
@@ -1,7 +1,47 @@
 #pragma once
 
 #include "DemultiplexedResult.hpp"
+#include "PatternClassifier.hpp"
 #include <limits>
+#include <deque>
+
+//reads are parsed into batches that are recycled: once a worker mapped a batch it is returned to the pool and the next reads
+//are parsed into the same strings (they keep their memory, parsing a read does not allocate)
+typedef std::vector<std::pair<fastqLine, fastqLine>> ReadBatch;
+class ReadBatchPool
+{
+    public:
+        //a free batch with readNum reads
+        ReadBatch* get(const size_t readNum)
+        {
+            ReadBatch* batch = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!freeBatches.empty())
+                {
+                    batch = freeBatches.back();
+                    freeBatches.pop_back();
+                }
+                else
+                {
+                    batches.push_back(std::make_unique<ReadBatch>());
+                    batch = batches.back().get();
+                }
+            }
+            batch->resize(readNum);
+            return batch;
+        }
+        void put(ReadBatch* batch)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeBatches.push_back(batch);
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ReadBatch>> batches;
+        std::vector<ReadBatch*> freeBatches;
+};
 
 /** @brief class to map several barcode Patterns simultaneously, 
  * and handles writing of results/ or storage in RAM
@@ -16,76 +56,63 @@ class Demultiplexer : private Mapping<MappingPolicy, FilePolicy>
 {
     private:
 
-        void demultiplex_wrapper(const std::pair<fastqLine, fastqLine>& line,
+        //state of one worker of the pool: its output (temporary files and statistics) and the buffers that are reused
+        //for every read. The contexts are created before mapping (one per thread), a task takes a free context and returns it
+        struct WorkerContext
+        {
+            WorkerOutput& output;
+            std::vector<size_t> candidates; //patterns the current read is mapped to
+            //merged reads of the current read pairs (-j): every pair is merged once for all its patterns,
+            //mergedReadPtrs[i] is the merged read of pair i or nullptr if its reads do not overlap
+            std::vector<std::pair<fastqLine, fastqLine>> mergedReads;
+            std::vector<const std::pair<fastqLine, fastqLine>*> mergedReadPtrs;
+        };
+
+        void demultiplex_wrapper(WorkerContext& worker, const std::pair<fastqLine, fastqLine>& line,
                                 const input& input,
-                                const unsigned long long lineCount,
-                                const unsigned long long& totalReadCount,
                                 std::atomic<long long int>& elementsInQueue);
+        //same for a batch of reads (mapped together with demultiplex_reads)
+        void demultiplex_batch_wrapper(WorkerContext& worker, const std::vector<std::pair<fastqLine, fastqLine>>& lines,
+                                       const input& input,
+                                       std::atomic<long long int>& elementsInQueue);
+        //writes the result of one read (DNA or failed line) and updates the statistics of the worker
+        void write_line_result(WorkerContext& worker, const std::pair<fastqLine, fastqLine>& line, const input& input, const bool result,
+                               const size_t patternIdx, std::string& foundPatternName, DemultiplexedLine& finalDemultiplexedLine,
+                               OneLineDemultiplexingStatsPtr finalLineStatsPtr);
         void run_mapping(const input& input);
+        //maps a batch of the pool (a single read or a batch of reads) with a free worker context and returns both to their pools
+        void map_read_batch(ReadBatch* batch, const input& input, std::atomic<long long int>& elementsInQueue);
+        //creates one worker context for every thread of the pool
+        void init_workers(const input& input);
+        //indices of the patterns that are mapped to the read (in this order), all patterns if there is no classifier
+        void select_patterns(const std::pair<fastqLine, fastqLine>& line, const input& input, std::vector<size_t>& candidates);
+        //merges a read pair into mergedLine once for all its patterns (only MapMergedReadPairsPolicy and only if one of its
+        //patterns can be mapped on the merged read), returns mergedLine or nullptr if the pair is not merged
+        const std::pair<fastqLine, fastqLine>* merge_read_pair(const std::pair<fastqLine, fastqLine>& line,
+                                                               const std::vector<size_t>& candidates,
+                                                               std::pair<fastqLine, fastqLine>& mergedLine);
+        //prints how often every pattern was mapped, skipped, assigned (and how many mappings were stopped by the score bound)
+        void print_routing_stats();
 
-        //map to store the temporary output files (e.g., for RAM efficient laptop usage)
-        //theadID maps to a vector of ordered fileStreams for every pattern in the order of
+        //stores the temporary output files (e.g., for RAM efficient laptop usage)
+        //every worker has a vector of ordered fileStreams for every pattern in the order of
         //the inout file. ASSURE THE RIGHT ORDER!! We explicitely do not use the patternNames
         //to avoid another string-hash as we can also simply keep the order of patterns
         DemultiplexedResultPtr fileWriter;
 
-        std::unordered_map<boost::thread::id, MultipleBarcodePatternVectorPtr, thread_id_hash> thread_pattern;
-        
-        void create_pattern_copy_in_thread(std::shared_ptr<std::mutex> threadFillMutex,
-                                           std::shared_ptr<std::mutex> threadWaitingMutex,
-                                           std::shared_ptr<std::atomic<unsigned int> > threadToInitializePtr,
-                                           std::shared_ptr<std::condition_variable> cvPtr)
-        {
-            MultipleBarcodePatternVectorPtr origional = this->get_barcode_pattern();
-            MultipleBarcodePatternVectorPtr copy = std::make_shared<std::vector<BarcodePatternPtr>>();
-            for (const auto& pattern : *origional)
-            {
-                BarcodePatternPtr patternCopy(pattern);
-                copy->push_back(pattern ? patternCopy : nullptr);
-            }
+        //pre-classification of reads to patterns (only for several patterns with constant barcodes)
+        PatternClassifierPtr classifier;
+        std::unique_ptr<PatternRoutingStats> routingStats;
 
-            std::unique_lock<std::mutex> threadFillLock(*threadFillMutex);
-            --(*threadToInitializePtr);
-            //add the pattern copy to thead->copy map
-            thread_pattern.emplace(boost::this_thread::get_id(), copy);
+        //the patterns shared by all workers
+        PatternSetPtr patternSet;
 
-            //decrease number of threads that need initialization, when all are initialized we can continue program in main function
-            if (*threadToInitializePtr == 0) 
-            {
-                cvPtr->notify_all();  // Notify when all tasks are done
-                threadFillLock.unlock();
-            }
-            else
-            {
-                //lock threads if we did not finish them - like this we can be 100% sure that evey thread gets called EXACTLY ONCE
-                // for initialization
-                threadFillLock.unlock();
-                //wait until all threads are here
-                std::unique_lock<std::mutex> lock(*threadWaitingMutex);
-                cvPtr->wait(lock, [&] { return (*threadToInitializePtr) == 0; });
-                lock.unlock();
-            }
-        }
-
-        void initialize_thread_patterns(boost::asio::thread_pool& pool, const int threadNum)
-        {
-            std::shared_ptr<std::mutex> threadFillMutex = std::make_shared<std::mutex>();
-            std::shared_ptr<std::mutex> threadWaitingMutex = std::make_shared<std::mutex>();
-            std::shared_ptr<std::atomic<unsigned int>> threadToInitializePtr = std::make_shared<std::atomic<unsigned int>>(threadNum);
-            std::shared_ptr<std::condition_variable> cvPtr = std::make_shared<std::condition_variable>();
-  
-            for(int i = 0; i < threadNum; ++i)
-            {
-                boost::asio::post(pool, std::bind(&Demultiplexer::create_pattern_copy_in_thread, this, threadFillMutex, threadWaitingMutex, 
-                threadToInitializePtr, cvPtr));
-            }
+        //contexts of all workers: at most one task per thread runs at a time, there is always a free context for a task
+        std::deque<WorkerContext> workers;
+        std::vector<WorkerContext*> freeWorkers;
+        std::mutex workerMutex; //locking taking and returning a context
 
-            //only continue once all htreads have finished 
-            // (we can NOT join, to not change the thread_ids, and waiting within thread only might let threadToInitialize go out of scope)
-            std::unique_lock<std::mutex> lock(*threadWaitingMutex);
-            cvPtr->wait(lock, [&] { return (*threadToInitializePtr) == 0; });
-            lock.unlock();
-        }
+        ReadBatchPool readBatches;
 
     public:
         void run(const input& input);
@@ -6,6 +6,9 @@
 #include <regex>
 #include <thread>
 
+//the counting operator new is defined here (only used when compiled with COUNT_ALLOCATIONS)
+#define DEFINE_ALLOCATION_COUNTER
+#include "AllocationCounter.hpp"
 #include "Barcode.hpp"
 #include "Demultiplexer.hpp"
 
@@ -61,6 +64,18 @@
 
 using namespace boost::program_options;
 
+bool is_bam_input(const std::string& fileName)
+{
+    return(endWith(fileName, ".bam") || endWith(fileName, ".cram"));
+}
+
+//stdin and named pipes have no file ending: they are read as fastq(.gz) unless they end with txt
+bool is_fastq_input(const std::string& fileName)
+{
+    return(endWith(fileName, "fastq") || endWith(fileName, "fastq.gz") || endWith(fileName, "fastq.zst") || 
+           (DecompressedInputStream::is_stream(fileName) && !endWith(fileName, "txt")));
+}
+
 bool parse_arguments(char** argv, int argc, input& input)
 {
     try
@@ -69,14 +84,29 @@ bool parse_arguments(char** argv, int argc, input& input)
         desc.add_options()
             ("input,i", value<std::string>(&(input.inFile))->required(), "single file in fastq(.gz) format or the forward read file, if <-r> is also set for the\
             reverse reads. It is also possible to provide a txt file with fastq-lines only (with no fastq-quality lines. For txt-files only the single-read option\
-            with forward read only is supported: -i file.txt)")
+            with forward read only is supported: -i file.txt). Unaligned BAM/CRAM files (.bam, .cram) are read if demultiplex is built with htslib (make demultiplex \
+            HTSLIB=1), reads with the flags READ1 and READ2 are then mapped as read pairs without <-r>. Zstd compressed fastq files (.fastq.zst) are read if \
+            demultiplex is built with libzstd (make demultiplex ZSTD=1). With <-i -> fastq(.gz) reads are streamed from stdin, \
+            named pipes are streamed as well (both are fastq(.gz) unless the name ends with txt).")
             //optional for reverse mapping: no recommended, join reads first
             ("reverse,r", value<std::string>(&(input.reverseFile))->default_value(""), "Use this parameter for paired-end analysis as the reverse read file. <-i> is the forward read in \
             this case.")
+            ("interleaved,x", value<bool>(&(input.interleavedReads))->default_value(false), "paired-end analysis of an interleaved fastq(.gz) file <-i> \
+            (the forward and reverse read of a pair are consecutive records, e.g. from samtools fastq or bcl-convert). Giving the same file for <-i> and <-r> does the same.")
             ("detached,d", value<bool>(&(input.detachedReverseMapping))->default_value(false),"detached mapping of forward and reverse read. In this case we do not \
             assume the whole pattern is one sequence from 5'->3'. We rather have two seperate reads for FW and RV and we map both reads individually and the reverse\
             read is not a reverse complement of the pattern itself. In this case we must additionally add a read seperator [-] to clarify where FW and RV reads end. \
             Barcodes for the reverse read are then mapped as they are and are not reverse complements of the pattern.")
+            ("orientReverseRead,c", value<bool>(&(input.orientReverseRead))->default_value(false), "for paired-end mapping (not detached): reverse complement \
+            every reverse read once and look up variable barcodes of the reverse read in the indexes of the forward barcodes. The indexes of the reverse complement barcodes \
+            (exact matches, barcodes within the allowed mismatches) are then not created, which halves their memory. The mapping result is the same.")
+            ("lazyReverse,l", value<bool>(&(input.lazyReverseMapping))->default_value(false), "for paired-end mapping (not detached): map the reverse \
+            read only if the forward read does not contain all barcodes of the pattern or maps them with mismatches. A forward read that maps the whole pattern \
+            perfectly is taken without confirming its barcodes in the reverse read (the reverse read can then not fail the mapping or add mismatches).")
+            ("mergeReads,j", value<bool>(&(input.mergeReadPairs))->default_value(false), "for paired-end mapping (not detached): merge forward and reverse read \
+            into one read if they overlap (at least 20 bases with at most 10% mismatches, in the overlap the base with the higher quality is taken) and map the \
+            merged read like a single read. Barcodes in the overlap are then mapped only once. Pairs that do not overlap and patterns with [*], [-] or [DNA] \
+            are mapped as read pairs.")
 
             ("output,o", value<std::string>(&(input.outPath))->required(), "output directory. All files including failed lines, statistics will be saved here.")
             ("namePrefix,n", value<std::string>(&(input.prefix))->default_value(""), "a prefix for file names. Default uses no prefix.")
@@ -101,14 +131,32 @@ bool parse_arguments(char** argv, int argc, input& input)
             This should be a comma seperated list of numbers for each substring of the sequence enclosed in squared brackets. E.g.: 2,1,2,1,2. (Also add mismatches for the STOP[*], UMI[X], READSEPERATOR[-] -  \
             this number is not used however, UMIs are aligned in BarcodeProcessing.) We need one line for every line in the barcodePatternsFile.")
 
+            ("firstPatternMatch,a", value<bool>(&(input.firstPatternMatch))->default_value(false), "with several patterns assign a read to the first pattern that maps \
+            instead of mapping all patterns and taking the one with the fewest mismatches. Patterns are tried in the order of how many k-mers of their constant \
+            barcodes (linkers) are in the read. Patterns whose linkers can not be in the read are skipped in both cases.")
+
             ("threat,t", value<int>(&(input.threads))->default_value(5), "number of threads")
             ("fastqReadBucketSize,s", value<long long int>(&(input.fastqReadBucketSize))->default_value(-1), "number of lines of the fastQ file that should be read into RAM \
             and be processed, before the next fastq read is processed. By default it equal to 100X the thread number.")
+            ("batchSize,b", value<int>(&(input.batchSize))->default_value(64), "number of reads that are mapped together in one job. With a batch of reads \
+            constant barcodes (linkers) are aligned to several reads at once (one read per SIMD lane), each read keeps its own position. \
+            Batches are only used for single-read input, paired-end reads are mapped one by one. Default is 64 (1 maps every read as its own job).")
             ("writeStats,q", value<bool>(&(input.writeStats))->default_value(false), "writing Statistics about the barcode mapping. This creates three files: \
             ..._Quality_lastPositionMapped.txt stores how often mapping failed at which position for reads that could not be mapped (THIS IS ONLY WRITTEN IF WE HAVE ONLY ONE PATTERN) \
             ..._Quality_typeMM.txt stores for every barcode how often we observed a Subst, Ins, Del \
             ..._Quality_numberMM.txt stores how many mismatches we observed in which barcodes \n")
             ("writeFailedLines,f", value<bool>(&(input.writeFailedLines))->default_value(false), "write failed lines to an extra file.\n")
+            ("compressOutput,z", value<int>(&(input.outputCompressionLevel))->default_value(0), "compression level (1-9) of the output files: fastq, tsv and \
+            failed line files are then written as BGZF (blocked gzip, files end with .gz, readable by gzip, zcat, htslib and count). Every thread compresses \
+            its own blocks. Default is 0 (uncompressed).")
+            ("compressionBlockSize,k", value<int>(&(input.outputBlockSize))->default_value(65280), "uncompressed bytes of a BGZF block of compressed output \
+            files (1024-65280). Default is 65280 (as bgzip).")
+            ("indexMemory,g", value<int>(&(input.indexMemory))->default_value(4096), "memory in MB for the indexes of all sequences within the \
+            allowed mismatches of a barcode whitelist (for up to 2 mismatches). The indexes of all barcode columns together stay below this limit, \
+            whitelists whose index does not fit anymore are aligned instead. 0 disables the indexes. Default is 4096.")
+            ("binaryOutput,y", value<bool>(&(input.binaryOutput))->default_value(false), "write the barcodes of patterns without DNA as binary \
+            columnar file (.bin) instead of a tsv: barcodes are stored as index of their whitelist, UMIs as 2-bit packed bases. Count reads this file \
+            directly (memory mapped). Default is false (tsv).")
 
             ("help,h", "help message");
 
@@ -128,6 +176,59 @@ bool parse_arguments(char** argv, int argc, input& input)
         }
 
         notify(vm);
+
+        //interleaved read pairs are read from the input file: it is also the reverse read file
+        if(input.interleavedReads)
+        {
+            if(!input.reverseFile.empty() && input.reverseFile != input.inFile)
+            {
+                std::cerr << "Error: interleaved read pairs (-x) are read from the input file (-i), no other reverse read file (-r) is allowed\n";
+                return false;
+            }
+            input.reverseFile = input.inFile;
+        }
+
+        //paired-end reads of BAM/CRAM files are records of the input file: it is then also the reverse read file
+        if(is_bam_input(input.inFile))
+        {
+#ifdef WITH_HTSLIB
+            if(!input.reverseFile.empty() && !input.interleavedReads)
+            {
+                std::cerr << "Error: for BAM/CRAM input (-i) read pairs are taken from the input file, no reverse read file (-r) is allowed\n";
+                return false;
+            }
+            if(input.reverseFile.empty() && ExtractLinesFromBamFilePolicy::is_paired(input.inFile)){input.reverseFile = input.inFile;}
+#else
+            std::cerr << "Error: demultiplex was built without htslib, build it with <make demultiplex HTSLIB=1> to read BAM/CRAM input\n";
+            return false;
+#endif
+        }
+
+        if(input.mergeReadPairs && (input.reverseFile.empty() || input.detachedReverseMapping))
+        {
+            std::cerr << "Error: merging of read pairs (-j) is only supported for paired-end input that is not mapped detached (-d)\n";
+            return false;
+        }
+        if(input.orientReverseRead && (input.reverseFile.empty() || input.detachedReverseMapping))
+        {
+            std::cerr << "Error: orienting reverse reads (-c) is only supported for paired-end input that is not mapped detached (-d)\n";
+            return false;
+        }
+        if(input.outputCompressionLevel < 0 || input.outputCompressionLevel > 9)
+        {
+            std::cerr << "Error: the compression level of the output (-z) must be between 0 (uncompressed) and 9\n";
+            return false;
+        }
+        if(input.indexMemory < 0)
+        {
+            std::cerr << "Error: the index memory (-g) must be at least 0 MB\n";
+            return false;
+        }
+        if(input.outputBlockSize < 1024 || input.outputBlockSize > BgzfStreamBuffer::maxBlockSize)
+        {
+            std::cerr << "Error: the block size of compressed output (-k) must be between 1024 and " << BgzfStreamBuffer::maxBlockSize << " bytes\n";
+            return false;
+        }
     }
     catch(std::exception& e)
     {
@@ -159,6 +260,10 @@ void write_parameter_file(const input& input)
     outFile << "barcodeFile = " << input.barcodeFile << "\n";
     outFile << "patternLine = " << input.patternLine << "\n";
     outFile << "detached reverse read = " << input.detachedReverseMapping << "\n";
+    outFile << "orient reverse read = " << input.orientReverseRead << "\n";
+    outFile << "lazy reverse read = " << input.lazyReverseMapping << "\n";
+    outFile << "merge read pairs = " << input.mergeReadPairs << "\n";
+    outFile << "interleaved read pairs = " << input.interleavedReads << "\n";
 
     outFile << "writeStats = " << (input.writeStats ? "true" : "false") << "\n";
     outFile << "writeFailedLines = " << (input.writeFailedLines ? "true" : "false") << "\n";
@@ -166,6 +271,12 @@ void write_parameter_file(const input& input)
 
     outFile << "fastqReadBucketSize = " << input.fastqReadBucketSize << "\n";
     outFile << "threads = " << input.threads << "\n";
+    outFile << "batchSize = " << input.batchSize << "\n";
+    outFile << "output compression level = " << input.outputCompressionLevel << "\n";
+    outFile << "output block size = " << input.outputBlockSize << "\n";
+    outFile << "index memory = " << input.indexMemory << " MB\n";
+    outFile << "binary barcode output = " << (input.binaryOutput ? "true" : "false") << "\n";
+    outFile << "firstPatternMatch = " << (input.firstPatternMatch ? "true" : "false") << "\n";
     
     // Write mismatchFile path and its contents
     outFile << "mismatchFile = " << input.mismatchFile << "\n";
@@ -216,24 +327,52 @@ int main(int argc, char** argv)
         }
 
         // run demultiplexing
-        if(!input.reverseFile.empty())
+        if(is_bam_input(input.inFile))
+        {
+#ifdef WITH_HTSLIB
+            if(input.reverseFile.empty())
+            {
+                Demultiplexer<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromBamFilePolicy> mapping;
+                mapping.run(input);
+            }
+            else if(input.mergeReadPairs)
+            {
+                Demultiplexer<MapMergedReadPairsPolicy, ExtractLinesFromBamFilePolicy> mapping;
+                mapping.run(input);
+            }
+            else
+            {
+                Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromBamFilePolicy> mapping;
+                mapping.run(input);
+            }
+#endif
+        }
+        else if(!input.reverseFile.empty())
         {
             //run in paired-end mode (allowing only fastq(.gz) format)
-            if(!(endWith(input.inFile, "fastq") || endWith(input.inFile, "fastq.gz")))
+            if(!is_fastq_input(input.inFile))
             {
                 std::cout << "Wrong file format for forward-read file <-i>!\n";
                 exit(EXIT_FAILURE);
             }
-            if(!(endWith(input.reverseFile, "fastq") || endWith(input.reverseFile, "fastq.gz")))
+            if(!is_fastq_input(input.reverseFile))
             {
                 std::cout << "Wrong file format for reverse-read file <-r>!\n";
                 exit(EXIT_FAILURE);
             }
 
-            Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromFastqFilePolicyPairedEnd> mapping;
-            mapping.run(input);
+            if(input.mergeReadPairs)
+            {
+                Demultiplexer<MapMergedReadPairsPolicy, ExtractLinesFromFastqFilePolicyPairedEnd> mapping;
+                mapping.run(input);
+            }
+            else
+            {
+                Demultiplexer<MapEachBarcodeSequentiallyPolicyPairwise, ExtractLinesFromFastqFilePolicyPairedEnd> mapping;
+                mapping.run(input);
+            }
         }
-        else if(endWith(input.inFile, "fastq") || endWith(input.inFile, "fastq.gz"))
+        else if(is_fastq_input(input.inFile))
         {
             Demultiplexer<MapEachBarcodeSequentiallyPolicy, ExtractLinesFromFastqFilePolicy> mapping;
             mapping.run(input);
@@ -245,7 +384,7 @@ int main(int argc, char** argv)
         }
         else
         {
-            fprintf(stderr,"Input file must be of format: <.fastq> | <.fastq.gz> | <.txt>!!!\nFail to open file: %s\n", input.inFile.c_str());
+            fprintf(stderr,"Input file must be of format: <.fastq> | <.fastq.gz> | <.fastq.zst> | <.txt> | <.bam> | <.cram>!!!\nFail to open file: %s\n", input.inFile.c_str());
             exit(EXIT_FAILURE);
         }
     }
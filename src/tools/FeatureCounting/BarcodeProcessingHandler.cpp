@@ -348,31 +348,17 @@ void BarcodeProcessingHandler::parse_barcode_sharing_file(std::string& barcodeFu
 
 void BarcodeProcessingHandler::parse_barcode_file(const std::string& inFile)
 {
-    //reopen file for line counting
-    std::ifstream file;
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-    bool gz = isGzipped(inFile);
-    std::istream* instream = openFile(inFile, file, inbuf, gz);
-    if (!instream)
-    {
-        std::cerr << "Error reading input file or file is empty! Please double check if the file exists:" << inFile << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    unsigned long long totalReads = 0;
-    std::string line;
-    while (std::getline(*instream, line)) 
+    //the file is read only once (progress is the position in the file)
+    unsigned long long currentReads = 0;
+    if(BinaryBarcodeFile::is_binary_file(inFile))
     {
-        ++totalReads;
+        parseBinaryBarcodeFile(inFile, currentReads);
+        return;
     }
-    if (instream != &file) delete instream;
-    instream = nullptr;
-
-    unsigned long long currentReads = 0;
-    parseBarcodeLines(inFile, totalReads, currentReads);
+    parseBarcodeLines(inFile, currentReads);
 }
 
-void BarcodeProcessingHandler::parseBarcodeLines(const std::string& inFile, const unsigned long long& totalReads, unsigned long long& currentReads)
+void BarcodeProcessingHandler::parseBarcodeLines(const std::string& inFile, unsigned long long& currentReads)
 {
     //reopen file
     std::ifstream file;
@@ -389,6 +375,9 @@ void BarcodeProcessingHandler::parseBarcodeLines(const std::string& inFile, cons
     std::cout << "STEP[1/3]\t(READING ALL LINES INTO MEMORY)\n";
     int elements = 0; //check that each row has the correct number of barcodes
     unsigned long long readCount = 0;
+    //status bar: bytes read from the (compressed) file
+    const unsigned long long totalBytes = fileSize(inFile);
+    int lastPercent = -1;
     while(std::getline(*instream, line))
     {
         //check Windows-specific trailing newlines
@@ -411,9 +400,8 @@ void BarcodeProcessingHandler::parseBarcodeLines(const std::string& inFile, cons
         }
         add_line_to_temporary_data(line, elements, readCount);   
 
-        double perc = currentReads/ (double)totalReads;
         ++currentReads;
-        printProgress(perc);        
+        if(currentReads % 4096 == 0){printFileProgress(static_cast<long long>(file.tellg()), totalBytes, lastPercent);}
     }
 
     result.set_total_reads(currentReads-1); //minus header line
@@ -423,6 +411,188 @@ void BarcodeProcessingHandler::parseBarcodeLines(const std::string& inFile, cons
     std::cout << "\n";
 }
 
+void BarcodeProcessingHandler::parseBinaryBarcodeFile(const std::string& inFile, unsigned long long& currentReads)
+{
+    BinaryBarcodeFile file;
+    file.open(inFile);
+    std::cout << "STEP[1/3]\t(READING ALL LINES INTO MEMORY)\n";
+
+    //AB, treatment and single cell are resolved from the dictionary indices of the reads if their columns are dictionaries,
+    //otherwise the barcodes of every read are decoded and added like a line of the tsv
+    const std::vector<BinaryBarcodeColumn>& columns = file.columns;
+    auto is_column = [&columns](const int col){return(col >= 0 && static_cast<size_t>(col) < columns.size());};
+    auto is_dictionary = [&columns, &is_column](const int col)
+                         {return(is_column(col) && columns[col].type == BinaryBarcodeColumn::Type::Dictionary);};
+    bool byIndex = is_dictionary(static_cast<int>(barcodeInformation.featureIdx)) &&
+                   (barcodeInformation.treatmentIdx == -1 || is_dictionary(barcodeInformation.treatmentIdx));
+    for(const int col : barcodeInformation.scBarcodeIndices){byIndex = byIndex && is_dictionary(col);}
+    for(const int col : barcodeInformation.umiIdx){byIndex = byIndex && is_column(col);}
+
+    unsigned long long readCount = 0;
+    if(byIndex)
+    {
+        addBinaryReadsByIndex(file, currentReads, readCount);
+    }
+    else
+    {
+        addBinaryReads(file, currentReads, readCount);
+    }
+
+    result.set_total_reads(currentReads);
+    result.set_total_ab_reads(readCount);
+
+    printProgress(1);
+    std::cout << "\n";
+}
+
+void BarcodeProcessingHandler::addBinaryReads(BinaryBarcodeFile& file, unsigned long long& currentReads, unsigned long long& readCount)
+{
+    const std::vector<BinaryBarcodeColumn>& columns = file.columns;
+    //barcodes of the current read: the barcode of its dictionary or the decoded sequence for every column
+    std::vector<std::string> barcodes(columns.size());
+    int lastPercent = -1;
+    while(file.next_chunk())
+    {
+        for(size_t read = 0; read < file.chunkReadNum; ++read)
+        {
+            ++currentReads;
+            //rows with missing barcodes are skipped (as rows with the wrong number of barcodes in the tsv)
+            bool complete = true;
+            for(size_t col = 0; col < columns.size(); ++col)
+            {
+                if(columns[col].type == BinaryBarcodeColumn::Type::Dictionary){barcodes[col] = columns[col].dictionary[file.index(col, read)];}
+                else{file.sequence(col, read, barcodes[col]);}
+                if(barcodes[col].empty()){complete = false;}
+            }
+            if(!complete)
+            {
+                std::cout << "WARNING in barcode file, read " << currentReads << " has not the correct number of sequences\n";
+                continue;
+            }
+            add_barcodes_to_temporary_data(barcodes, readCount);
+        }
+        printFileProgress(static_cast<long long>(currentReads), static_cast<unsigned long long>(file.readNum), lastPercent);
+    }
+}
+
+void BarcodeProcessingHandler::addBinaryReadsByIndex(BinaryBarcodeFile& file, unsigned long long& currentReads, unsigned long long& readCount)
+{
+    std::vector<BinaryBarcodeColumn>& columns = file.columns;
+    const unsigned int featureCol = barcodeInformation.featureIdx;
+    const int treatmentCol = barcodeInformation.treatmentIdx;
+    const std::vector<int>& scCols = barcodeInformation.scBarcodeIndices;
+
+    //fused barcodes are replaced once in the dictionaries, sequence columns (UMIs) still per read
+    for(size_t col = 0; col < columns.size(); ++col)
+    {
+        const auto positionIt = barcodeSharingMap.find(col);
+        if(positionIt == barcodeSharingMap.end() || columns[col].type != BinaryBarcodeColumn::Type::Dictionary){continue;}
+        for(std::string& barcode : columns[col].dictionary)
+        {
+            const auto barcodeIt = positionIt->second.find(barcode);
+            if(barcodeIt != positionIt->second.end()){barcode = barcodeIt->second;}
+        }
+    }
+
+    //names of the dictionary entries, resolved when a read first uses the entry
+    std::vector<const char*> featureNames(columns[featureCol].dictionary.size(), nullptr);
+    std::vector<const char*> treatmentNames(treatmentCol == -1 ? 0 : columns[treatmentCol].dictionary.size(), nullptr);
+    const char* noTreatment = rawData.get_unique_name("");
+    //single cells are numbered by the dictionary indices of their barcodes: the number of the barcodes before a column and
+    //the index in the column give the number for this column, the number of the last column is the index of the single cell
+    std::vector<std::unordered_map<uint64_t, uint32_t>> scNumbers(scCols.size());
+    std::vector<const char*> singleCells;
+    //AB followed by single cell (the key of the dict of AB-SC) for the single cell number and the AB index
+    std::unordered_map<uint64_t, const char*> abScIndices;
+
+    std::string umi;
+    std::string umiPart;
+    std::vector<std::string> ciBarcodes;
+    int lastPercent = -1;
+    while(file.next_chunk())
+    {
+        for(size_t read = 0; read < file.chunkReadNum; ++read)
+        {
+            ++currentReads;
+            //rows with missing barcodes are skipped (as rows with the wrong number of barcodes in the tsv)
+            bool complete = true;
+            for(size_t col = 0; col < columns.size() && complete; ++col)
+            {
+                if(columns[col].type == BinaryBarcodeColumn::Type::Dictionary){complete = !columns[col].dictionary[file.index(col, read)].empty();}
+                else{complete = !file.empty_sequence(col, read);}
+            }
+            if(!complete)
+            {
+                std::cout << "WARNING in barcode file, read " << currentReads << " has not the correct number of sequences\n";
+                continue;
+            }
+
+            uint64_t scNumber = 0;
+            for(size_t i = 0; i < scCols.size(); ++i)
+            {
+                const uint64_t key = (scNumber << 32) | file.index(scCols[i], read);
+                scNumber = scNumbers[i].emplace(key, static_cast<uint32_t>(scNumbers[i].size())).first->second;
+            }
+            if(scNumber == singleCells.size())
+            {
+                ciBarcodes.clear();
+                for(const int col : scCols){ciBarcodes.push_back(columns[col].dictionary[file.index(col, read)]);}
+                singleCells.push_back(rawData.get_unique_name(generateSingleCellIndexFromBarcodes(ciBarcodes)));
+            }
+            const char* singleCell = singleCells[scNumber];
+
+            const uint32_t featureEntry = file.index(featureCol, read);
+            if(featureNames[featureEntry] == nullptr)
+            {
+                featureNames[featureEntry] = rawData.get_unique_name(rawData.getFeatureName(columns[featureCol].dictionary[featureEntry]));
+            }
+            const char* featureName = featureNames[featureEntry];
+
+            const char* treatment = noTreatment;
+            if(treatmentCol != -1)
+            {
+                const uint32_t treatmentEntry = file.index(treatmentCol, read);
+                if(treatmentNames[treatmentEntry] == nullptr)
+                {
+                    treatmentNames[treatmentEntry] = rawData.get_unique_name(rawData.getTreatmentName(columns[treatmentCol].dictionary[treatmentEntry]));
+                }
+                treatment = treatmentNames[treatmentEntry];
+            }
+
+            ++readCount;
+            //as add_barcodes_to_temporary_data: reads with UMIs are added to the UMI dict if reads are filtered by their UMI
+            if(!barcodeInformation.umiIdx.empty() && umiRemoval)
+            {
+                umi.clear();
+                for(const int col : barcodeInformation.umiIdx)
+                {
+                    if(columns[col].type == BinaryBarcodeColumn::Type::Dictionary)
+                    {
+                        umi += columns[col].dictionary[file.index(col, read)];
+                        continue;
+                    }
+                    file.sequence(col, read, umiPart);
+                    const auto positionIt = barcodeSharingMap.find(col);
+                    if(positionIt != barcodeSharingMap.end())
+                    {
+                        const auto barcodeIt = positionIt->second.find(umiPart);
+                        if(barcodeIt != positionIt->second.end()){umiPart = barcodeIt->second;}
+                    }
+                    umi += umiPart;
+                }
+                rawData.add_unique_to_umiDict(umi.c_str(), featureName, singleCell, treatment);
+            }
+            else
+            {
+                const char*& abScIdx = abScIndices[(scNumber << 32) | featureEntry];
+                if(abScIdx == nullptr){abScIdx = rawData.get_unique_name(std::string(featureName) + singleCell);}
+                rawData.add_unique_to_scAbDict("", featureName, singleCell, treatment, abScIdx);
+            }
+        }
+        printFileProgress(static_cast<long long>(currentReads), static_cast<unsigned long long>(file.readNum), lastPercent);
+    }
+}
+
 void BarcodeProcessingHandler::add_line_to_temporary_data(const std::string& line, const size_t& elements, unsigned long long& readCount)
 {
     //split the line into barcodes
@@ -431,28 +601,11 @@ void BarcodeProcessingHandler::add_line_to_temporary_data(const std::string& lin
     ss.str(line);
     std::string substr;
 
-    unsigned int position = 0;
     while(getline(ss, substr, '\t'))
     {
         if(substr != "")
         {
-            //check if we have to replace barcodes
-            if(!barcodeSharingMap.empty())
-            {
-                auto positionIt = barcodeSharingMap.find(position);
-                //position has replacements
-                if (positionIt != barcodeSharingMap.end()) 
-                {
-                    auto& barcodeMap = positionIt->second;
-                    auto barcodeSubstrIt = barcodeMap.find(substr);
-                    if (barcodeSubstrIt != barcodeMap.end()) 
-                    {
-                        substr = barcodeSubstrIt->second;
-                    }
-                }
-            }
             result.push_back(substr);
-            ++position;
         }
     }
 
@@ -462,6 +615,30 @@ void BarcodeProcessingHandler::add_line_to_temporary_data(const std::string& lin
         return;
     }
 
+    add_barcodes_to_temporary_data(result, readCount);
+}
+
+void BarcodeProcessingHandler::add_barcodes_to_temporary_data(std::vector<std::string>& result, unsigned long long& readCount)
+{
+    //check if we have to replace barcodes
+    if(!barcodeSharingMap.empty())
+    {
+        for(unsigned int position = 0; position < result.size(); ++position)
+        {
+            auto positionIt = barcodeSharingMap.find(position);
+            //position has replacements
+            if (positionIt != barcodeSharingMap.end()) 
+            {
+                auto& barcodeMap = positionIt->second;
+                auto barcodeSubstrIt = barcodeMap.find(result[position]);
+                if (barcodeSubstrIt != barcodeMap.end()) 
+                {
+                    result[position] = barcodeSubstrIt->second;
+                }
+            }
+        }
+    }
+
     //hand over the UMI string, ab string, singleCellstring (concatenation of CIbarcodes)
     std::vector<std::string> ciBarcodes;
     //CiBarcodes are added in order of the scBarcodeIndices, this order must always be respected!!!
@@ -639,21 +816,22 @@ void BarcodeProcessingHandler::markReadsWithNoUniqueUmi(const std::vector<umiDat
 
 void BarcodeProcessingHandler::count_umi_occurence(std::vector<int>& positionsOfSameUmi, 
                                                    umiCount& umiLineTmp,
-                                                   const std::vector<dataLinePtr>& allScAbCounts)
+                                                   const std::vector<dataLinePtr>& allScAbCounts,
+                                                   const std::vector<PackedUmi>& packedUmis)
 {
     //this stores only the number of UMIs that were collapsed into each other due to MM
     unsigned long long numberAlignedUmis = 0;
     //skip the first UMI, this is the one we compare all others to
-    const char* umia = allScAbCounts.front()->umiSeq; //comapre first element to others
+    const PackedUmi& umia = packedUmis.front(); //comapre first element to others
     for(size_t j = 1; j < allScAbCounts.size(); ++j)
     {
-        //calling outputSense algorithm, much faster than levenshtein O(e*max(m,n))
+        //calling the outputSense algorithm (on the 2-bit packed UMIs, without allocations), much faster than levenshtein O(e*max(m,n))
         //however is recently implemented without backtracking
         //before umiMismatches was increased by the length difference between the two UMIs 
         //(no longer done, those deletion should probably be considered as part of the allowed umiMismatches)
-        const char* umib = allScAbCounts.at(j)->umiSeq;
+        const PackedUmi& umib = packedUmis[j];
         unsigned int dist = UINT_MAX;
-        bool similar = outputSense(umia, umib, barcodeInformation.umiMismatches, dist);
+        bool similar = bounded_umi_distance(umia, umib, barcodeInformation.umiMismatches, dist);
 
         //if mismatches are within range, change UMI seq
         //the new 'correct' UMI sequence is the one of umiLength, if both r of
@@ -739,6 +917,17 @@ void BarcodeProcessingHandler::count_abs_per_single_cell(const std::vector<dataL
             std::sort(scAbCounts.begin(), scAbCounts.end(), sort_descending_by_umi_count);
         }
 
+        //encode every UMI only once, the packed UMIs are kept in the same order as scAbCounts
+        std::vector<PackedUmi> packedUmis;
+        if(barcodeInformation.umiMismatches > 0)
+        {
+            packedUmis.reserve(scAbCounts.size());
+            for(const dataLinePtr& line : scAbCounts)
+            {
+                packedUmis.emplace_back(line->umiSeq);
+            }
+        }
+
         //we take always first element in vector of read of same AB and SC ID (the element of most UMI counts)
         //then store all reads where UMIs are within distance, and delete those lines, and sum up their UMI counts (they might have been collapsed before on EXACT IDENTITY)
         while(!scAbCounts.empty())
@@ -777,7 +966,7 @@ void BarcodeProcessingHandler::count_abs_per_single_cell(const std::vector<dataL
             if(barcodeInformation.umiMismatches > 0)
             {
                 //add positions that should be deleted bcs. they contains same UMI, increase the count for this UMI in umiLineTmp
-                count_umi_occurence(deletePositions, umiLineTmp, scAbCounts);
+                count_umi_occurence(deletePositions, umiLineTmp, scAbCounts, packedUmis);
             }
 
             //ADD UMI if exists
@@ -792,6 +981,7 @@ void BarcodeProcessingHandler::count_abs_per_single_cell(const std::vector<dataL
             {
                 int pos = deletePositions.at(posIdx);
                 scAbCounts.erase(scAbCounts.begin() + pos);
+                if(!packedUmis.empty()){packedUmis.erase(packedUmis.begin() + pos);}
             }
 
             //increase AB count for this one UMI
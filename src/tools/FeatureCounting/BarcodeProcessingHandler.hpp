@@ -22,6 +22,8 @@
 
 #include "DemultiplexedData.hpp"
 #include "helper.hpp"
+#include "PackedUmi.hpp"
+#include "BinaryBarcodeFile.hpp"
 
 /**
  * @brief Structure storing a vector with a mapping of the barcode-sequence to a unique ID
@@ -362,7 +364,17 @@ class BarcodeProcessingHandler
         // single cells are defined by a dot seperated list of indices)
         void add_line_to_temporary_data(const std::string& line, const size_t& elements,
                                         unsigned long long& readCount);
-        void parseBarcodeLines(const std::string& inFile, const unsigned long long& totalReads, unsigned long long& currentReads);
+        //stores the barcodes of one read (one per column, from the tsv or the binary file): fused barcodes are replaced
+        //(barcodeSharingMap), then the read is added with its AB, treatment, single cell (and UMI)
+        void add_barcodes_to_temporary_data(std::vector<std::string>& result, unsigned long long& readCount);
+        void parseBarcodeLines(const std::string& inFile, unsigned long long& currentReads);
+        //parse a binary barcode file of demultiplex: the reads are read from the chunks of the mapped file
+        void parseBinaryBarcodeFile(const std::string& inFile, unsigned long long& currentReads);
+        //decodes the barcodes of every read and adds them as a line of the tsv
+        void addBinaryReads(BinaryBarcodeFile& file, unsigned long long& currentReads, unsigned long long& readCount);
+        //adds the reads by the dictionary indices of their barcodes: AB, treatment and single cell are resolved once per
+        //dictionary entry (fused barcodes are replaced in the dictionaries), only the UMI is decoded for every read
+        void addBinaryReadsByIndex(BinaryBarcodeFile& file, unsigned long long& currentReads, unsigned long long& readCount);
         
         //check if a read is in 'dataLinesToDelete' (not-unique UMI for this read)
         bool checkIfLineIsDeleted(const dataLinePtr& line, const std::vector<dataLinePtr>& dataLinesToDelete);
@@ -379,7 +391,8 @@ class BarcodeProcessingHandler
         //used within 'count_abs_per_single_cell' to get counts per UMI for reads of one AB SC combination
         void count_umi_occurence(std::vector<int>& positionsOfSameUmi, 
                                                    umiCount& umiLineTmp,
-                                                   const std::vector<dataLinePtr>& allScAbCounts);
+                                                   const std::vector<dataLinePtr>& allScAbCounts,
+                                                   const std::vector<PackedUmi>& packedUmis);
         //count the ABs per single cell (iterating over reads for a AB-SC combination and summing them, this is already a sparse vector)
         //reads of same UMI are collapsed before
         void count_abs_per_single_cell(const std::vector<dataLinePtr>& uniqueAbSc,
@@ -166,6 +166,34 @@ class UnprocessedDemultiplexedData
             add_dataLine_to_scabDict(linePtr);
         }
 
+        //returns the unique char of a name (AB, single cell, treatment), which is then passed for all reads with this name
+        const char* get_unique_name(const std::string& name)
+        {
+            return uniqueChars->getUniqueChar(name.c_str());
+        }
+        // add a dataLine whose AB, single cell and treatment are already unique chars (get_unique_name)
+        void add_unique_to_umiDict(const char* umiChar, const char* ab, const char* singleCell, const char* treatment)
+        {
+            dataLine line;
+            line.umiSeq = uniqueChars->getUniqueChar(umiChar);
+            line.abName = ab;
+            line.scID = singleCell;
+            line.treatmentName = treatment;
+
+            add_dataLine_to_umiDict(std::make_shared<dataLine>(line));
+        }
+        // same for the ABSc dict, abScIdx is the unique char of the AB name followed by the single cell
+        void add_unique_to_scAbDict(const char* umiChar, const char* ab, const char* singleCell, const char* treatment, const char* abScIdx)
+        {
+            dataLine line;
+            line.umiSeq = uniqueChars->getUniqueChar(umiChar);
+            line.abName = ab;
+            line.scID = singleCell;
+            line.treatmentName = treatment;
+
+            add_dataLine_to_scabDict(std::make_shared<dataLine>(line), abScIdx);
+        }
+
         // add a umi dataline to its final ABSc Dict structure (add a class name and add to dict)
         void add_to_scAbDict(const umiDataLinePtr& line, unsigned long long& umiCount, const char* cellClass = nullptr)
         {
@@ -314,8 +342,10 @@ class UnprocessedDemultiplexedData
          // 3.) INSERT ABSC POSITIONS
             //same for AbSingleCell
             std::string abScIdxStr = std::string((line->abName)) + std::string((line->scID));
-            
-            const char* abScIdxChar = uniqueChars->getUniqueChar(abScIdxStr.c_str());
+            add_dataLine_to_scabDict(line, uniqueChars->getUniqueChar(abScIdxStr.c_str()));
+        }
+        void add_dataLine_to_scabDict(const dataLinePtr& line, const char* abScIdxChar)
+        {
             if(positonsOfABSingleCellPtr->find(abScIdxChar) == positonsOfABSingleCellPtr->end())
             {
                 std::vector<dataLinePtr> vec;
@@ -41,7 +41,7 @@ bool parse_arguments(char** argv, int argc, std::string& inFile,  std::string& o
     {
         options_description desc("Options");
         desc.add_options()
-            ("input,i", value<std::string>(&inFile)->required(), "input file of demultiplexed reads for ABs in Single cells. (input must be a tsv file, it can be gzipped)")
+            ("input,i", value<std::string>(&inFile)->required(), "input file of demultiplexed reads for ABs in Single cells. (input must be a tsv file, it can be gzipped, or a binary barcode file (.bin) of demultiplex)")
             ("output,o", value<std::string>(&outFile)->required(), "output file with all split barcodes")
 
             ("barcodeDir,d", value<std::string>(&(barcodeDir)), " path to a directory which must contain all the barcode files (for variable barcodes). When running <demultiplex> we \
@@ -216,32 +216,38 @@ int main(int argc, char** argv)
     //generate the dictionary of barcode alternatives to idx
     BarcodeInformation barcodeIdData;
 
-    //get the first line of headers from input file
-    std::ifstream file;
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
-    bool gz = isGzipped(inFile);
-    std::istream* instream = openFile(inFile, file, inbuf, gz);
-    if (!instream)
-    {
-        std::cerr << "Error reading input file or file is empty! Please double check if the file exists:" << inFile << std::endl;
-        exit(EXIT_FAILURE);
-    };
-
+    //get the first line of headers from input file (for binary barcode files of demultiplex the column names of its header)
     std::string firstLine;
-    if (std::getline(*instream, firstLine)) 
-    {  
-        bool parseAbBarcodes = true;
-        if(abFile.empty()){parseAbBarcodes = false;}
-        generateBarcodeDicts(firstLine, barcodeDir, barcodeIndices, barcodeIdData, abBarcodes, parseAbBarcodes, featureIdx, &treatmentBarcodes, treatmentIdx, umiIdx, umiMismatches);
-    } 
+    if(BinaryBarcodeFile::is_binary_file(inFile))
+    {
+        BinaryBarcodeFile binaryFile;
+        binaryFile.open(inFile);
+        firstLine = binaryFile.header_line();
+    }
     else
     {
-        std::cerr << "Error reading header line of input file:" << inFile << std::endl;
-        exit(EXIT_FAILURE);
+        std::ifstream file;
+        boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf;
+        bool gz = isGzipped(inFile);
+        std::istream* instream = openFile(inFile, file, inbuf, gz);
+        if (!instream)
+        {
+            std::cerr << "Error reading input file or file is empty! Please double check if the file exists:" << inFile << std::endl;
+            exit(EXIT_FAILURE);
+        };
+
+        if (!std::getline(*instream, firstLine)) 
+        {
+            std::cerr << "Error reading header line of input file:" << inFile << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        //clean data if necessary
+        if (instream != &file) delete instream;
+        instream = nullptr;
     }
-    //clean data if necessary
-    if (instream != &file) delete instream;
-    instream = nullptr;
+    bool parseAbBarcodes = true;
+    if(abFile.empty()){parseAbBarcodes = false;}
+    generateBarcodeDicts(firstLine, barcodeDir, barcodeIndices, barcodeIdData, abBarcodes, parseAbBarcodes, featureIdx, &treatmentBarcodes, treatmentIdx, umiIdx, umiMismatches);
 
     BarcodeProcessingHandler dataParser(barcodeIdData);
     //if we have barcodes that must be fused (assign certain barcodes to others, bcs they come, e.g., from the same cell)